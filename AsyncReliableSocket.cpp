@@ -0,0 +1,205 @@
+/*
+ * File: AsyncReliableSocket.cpp
+ *
+ * Coroutine-based interface to reliable sockets.
+ *
+ */
+
+// C++ library includes
+#include <iostream>
+
+//OS specific includes
+#include <sys/socket.h>
+
+#include "AsyncReliableSocket.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the AsyncReliableSocket header file
+*/
+
+AsyncReliableSocket::AsyncReliableSocket(EventLoop &loop) : loop(loop) {
+}
+
+ReliableSocket &AsyncReliableSocket::socket() {
+	return this->sock;
+}
+
+Task<bool> AsyncReliableSocket::wait_until(std::function<bool()> done) {
+	while (!done()) {
+		// Handle everything that has already arrived (and expired timers)
+		int result;
+		while ((result = this->sock.pump(false)) > 0 && !done()) {
+		}
+		if (result < 0) {
+			co_return false;
+		}
+		if (done()) {
+			break;
+		}
+
+		co_await this->loop.wait_readable(this->sock.sock_fd,
+				this->sock.time_until_next_timer());
+	}
+	co_return true;
+}
+
+Task<bool> AsyncReliableSocket::connect_to_remote(char *hostname, int port_num) {
+	if (!this->sock.start_connect(hostname, port_num)) {
+		co_return false;
+	}
+
+	if (!co_await this->wait_until([this] { return this->sock.all_acked(); })) {
+		cerr << "ERROR: Remote host stopped responding during handshake\n";
+		co_return false;
+	}
+
+	cerr << "INFO: Connection ESTABLISHED\n";
+	co_return true;
+}
+
+Task<bool> AsyncReliableSocket::accept_connection(int port_num) {
+	if (!this->sock.start_accept(port_num)) {
+		co_return false;
+	}
+
+	// Wait for a segment to come from a remote host
+	while (!this->sock.accept_syn(MSG_DONTWAIT)) {
+		co_await this->loop.wait_readable(this->sock.sock_fd, -1);
+	}
+
+	if (!co_await this->wait_until([this] { return this->sock.all_acked(); })) {
+		cerr << "ERROR: Remote host stopped responding during handshake\n";
+		co_return false;
+	}
+
+	cerr << "Connection ESTABLISHED\n";
+	co_return true;
+}
+
+Task<bool> AsyncReliableSocket::send_data(const void *buffer, int length) {
+	if (!this->sock.can_send()) {
+		cerr << "INFO: Cannot send: Connection not established.\n";
+		co_return false;
+	}
+
+	if ((this->sock.coalesce_delay > 0 || this->sock.corked) && length > 0) {
+		const char *data = (const char*)buffer;
+		while (length > 0) {
+			int size = this->sock.add_pending(data, length);
+			data += size;
+			length -= size;
+			if ((int)this->sock.pending_data.size() == ReliableSocket::MAX_DATA_SIZE &&
+					!co_await this->send_pending()) {
+				co_return false;
+			}
+		}
+		if (!this->sock.pending_data.empty() && !this->sock.corked && this->sock.pending_due()) {
+			co_return co_await this->send_pending();
+		}
+		co_return true;
+	}
+
+	// Whatever is pending goes first, so the data stays in order
+	if (!co_await this->send_pending()) {
+		co_return false;
+	}
+	if (!co_await this->wait_until([this] { return this->sock.window_open(); })) {
+		cerr << "ERROR: Remote host stopped responding, aborting connection\n";
+		co_return false;
+	}
+	this->sock.send_reliably(RDT_DATA, buffer, length);
+	co_return true;
+}
+
+Task<bool> AsyncReliableSocket::flush() {
+	this->sock.corked = false;
+	co_return co_await this->send_pending();
+}
+
+Task<bool> AsyncReliableSocket::send_pending() {
+	if (this->sock.pending_data.empty()) {
+		co_return true;
+	}
+	std::vector<char> data = this->sock.take_pending();
+	if (!this->sock.can_send()) {
+		cerr << "INFO: Cannot send: Connection not established.\n";
+		co_return false;
+	}
+	if (!co_await this->wait_until([this] { return this->sock.window_open(); })) {
+		cerr << "ERROR: Remote host stopped responding, aborting connection\n";
+		co_return false;
+	}
+	this->sock.send_reliably(RDT_DATA, data.data(), data.size());
+	co_return true;
+}
+
+Task<int> AsyncReliableSocket::receive_data(char buffer[ReliableSocket::MAX_DATA_SIZE]) {
+	if (!this->sock.can_receive()) {
+		cerr << "INFO: Cannot receive: Connection not established.\n";
+		co_return 0;
+	}
+
+	if (!co_await this->wait_until([this] { return this->sock.receive_ready(); })) {
+		co_return -1;
+	}
+	co_return this->sock.take_received(buffer);
+}
+
+Task<int> AsyncReliableSocket::receive_data(SegmentLease &lease) {
+	lease.release();
+	if (!this->sock.can_receive()) {
+		cerr << "INFO: Cannot receive: Connection not established.\n";
+		co_return 0;
+	}
+
+	if (!co_await this->wait_until([this] { return this->sock.receive_ready(); })) {
+		co_return -1;
+	}
+	co_return this->sock.take_received(lease);
+}
+
+Task<ssize_t> AsyncReliableSocket::receive_data(void *buffer, size_t length) {
+	if (!this->sock.can_receive()) {
+		cerr << "INFO: Cannot receive: Connection not established.\n";
+		co_return 0;
+	}
+
+	if (!co_await this->wait_until([this] { return this->sock.receive_ready(); })) {
+		co_return -1;
+	}
+	this->sock.drain_arrived(length);
+	co_return this->sock.take_received((char*)buffer, length);
+}
+
+Task<void> AsyncReliableSocket::close_connection() {
+	if (this->sock.can_send()) {
+		co_await this->send_pending();
+	}
+	if (!this->sock.start_close()) {
+		co_return;
+	}
+
+	if (!co_await this->wait_until([this] { return this->sock.all_acked(); })) {
+		co_return;
+	}
+	this->sock.send_close();
+	if (!co_await this->wait_until([this] { return this->sock.all_acked(); })) {
+		co_return;
+	}
+	if (!co_await this->wait_until([this] { return this->sock.remote_closed; })) {
+		co_return;
+	}
+
+	if (this->sock.needs_time_wait) {
+		this->sock.start_time_wait();
+		if (!co_await this->wait_until([this] {
+				return !this->sock.timers.is_scheduled(ReliableSocket::TIMER_TIME_WAIT); })) {
+			co_return;
+		}
+	}
+
+	this->sock.finish_close();
+}
@@ -0,0 +1,128 @@
+/*
+ * File: AsyncReliableSocket.h
+ *
+ * Header / API file for the coroutine-based interface to reliable sockets.
+ *
+ */
+#ifndef ASYNC_RELIABLE_SOCKET_H
+#define ASYNC_RELIABLE_SOCKET_H
+
+#include <functional>
+
+#include "ReliableSocket.h"
+#include "rdt_event_loop.h"
+#include "rdt_task.h"
+
+/**
+ * Reliable socket whose operations are coroutines. Instead of blocking, an
+ * operation suspends until its EventLoop sees the socket become readable or
+ * a protocol timer (retransmission, keepalive, ...) come due, so one thread
+ * can run many transfers at once:
+ *
+ *     Task<void> transfer(EventLoop &loop, char *host, int port) {
+ *         AsyncReliableSocket sock(loop);
+ *         if (co_await sock.connect_to_remote(host, port)) {
+ *             co_await sock.send_data(buf, len);
+ *             co_await sock.close_connection();
+ *         }
+ *     }
+ *
+ * The protocol is the same one the blocking ReliableSocket speaks, so the
+ * two interoperate. Pointers passed to an operation must stay valid until
+ * it finishes. Unlike ReliableSocket's blocking methods, the operations
+ * don't lock: use the socket only from the thread that runs its loop.
+ */
+class AsyncReliableSocket {
+public:
+	/**
+	 * Creates an unconnected socket driven by the given loop.
+	 */
+	AsyncReliableSocket(EventLoop &loop);
+
+	/**
+	 * Connects to a remote host (see ReliableSocket::connect_to_remote()).
+	 *
+	 * @return true once the connection is established
+	 */
+	Task<bool> connect_to_remote(char *hostname, int port_num);
+
+	/**
+	 * Waits for a remote host to connect on the given port (see
+	 * ReliableSocket::accept_connection()).
+	 *
+	 * @return true once the connection is established
+	 */
+	Task<bool> accept_connection(int port_num);
+
+	/**
+	 * Sends one segment of data (see ReliableSocket::send_data()). With
+	 * coalescing or corking on (see ReliableSocket::set_coalescing() and
+	 * cork(), called through socket()), small writes are added to a
+	 * pending segment instead, just as with the blocking API.
+	 *
+	 * @return true once it has been sent (or added to the pending
+	 * 		segment), false if the connection failed
+	 */
+	Task<bool> send_data(const void *buffer, int length);
+
+	/**
+	 * Uncorks the connection and sends the pending segment, if any (see
+	 * ReliableSocket::flush()).
+	 *
+	 * @return false if the connection failed
+	 */
+	Task<bool> flush();
+
+	/**
+	 * Receives one segment of data (see ReliableSocket::receive_data()).
+	 *
+	 * @return its size, 0 at the end of the transfer, or -1 if the
+	 * 		connection was aborted
+	 */
+	Task<int> receive_data(char buffer[ReliableSocket::MAX_DATA_SIZE]);
+
+	/**
+	 * Receives one segment of data without copying it (see
+	 * ReliableSocket::receive_data(SegmentLease&)).
+	 */
+	Task<int> receive_data(SegmentLease &lease);
+
+	/**
+	 * Receives as much data as is available and fits (see
+	 * ReliableSocket::receive_data(void*, size_t)).
+	 */
+	Task<ssize_t> receive_data(void *buffer, size_t length);
+
+	/**
+	 * Tears the connection down (see ReliableSocket::close_connection()),
+	 * sending the pending segment first.
+	 */
+	Task<void> close_connection();
+
+	/**
+	 * Gives access to the underlying socket for its non-blocking methods
+	 * (get_state(), set_keepalive(), ...).
+	 */
+	ReliableSocket &socket();
+
+private:
+	EventLoop &loop;
+	ReliableSocket sock;
+
+	/*
+	 * Processes segments and expired timers, suspending while there is
+	 * nothing to do, until done() returns true.
+	 *
+	 * @return false if the connection was closed or aborted while waiting
+	 */
+	Task<bool> wait_until(std::function<bool()> done);
+
+	/*
+	 * Sends the pending segment (if any), waiting for room in the window.
+	 *
+	 * @return false if it couldn't be sent
+	 */
+	Task<bool> send_pending();
+};
+
+#endif
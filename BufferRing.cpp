@@ -0,0 +1,70 @@
+/*
+ * File: BufferRing.cpp
+ *
+ * Ring of buffers that hands data between the I/O thread and the network
+ * thread of the sender and receiver tools.
+ *
+ */
+
+#include "BufferRing.h"
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the BufferRing header file
+*/
+
+BufferRing::BufferRing(int count, size_t size) : memory(count * size) {
+	this->buffer_size = size;
+	this->lengths.resize(count);
+	for (int i = 0; i < count; i++) {
+		this->free_buffers.push_back(i);
+	}
+	this->closed = false;
+}
+
+int BufferRing::acquire() {
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->changed.wait(guard, [this] { return this->closed || !this->free_buffers.empty(); });
+	if (this->closed) {
+		return -1;
+	}
+	int index = this->free_buffers.front();
+	this->free_buffers.pop_front();
+	return index;
+}
+
+void BufferRing::publish(int index, size_t length) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->lengths[index] = length;
+	this->filled_buffers.push_back(index);
+	this->changed.notify_all();
+}
+
+int BufferRing::consume(size_t *length) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->changed.wait(guard, [this] { return this->closed || !this->filled_buffers.empty(); });
+	if (this->closed) {
+		return -1;
+	}
+	int index = this->filled_buffers.front();
+	this->filled_buffers.pop_front();
+	*length = this->lengths[index];
+	return index;
+}
+
+void BufferRing::release(int index) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->free_buffers.push_back(index);
+	this->changed.notify_all();
+}
+
+void BufferRing::close() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->closed = true;
+	this->changed.notify_all();
+}
+
+bool BufferRing::is_closed() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->closed;
+}
@@ -0,0 +1,98 @@
+/*
+ * File: BufferRing.h
+ *
+ * Header / API file for the ring of buffers that hands data between the
+ * I/O thread and the network thread of the sender and receiver tools.
+ *
+ */
+#ifndef BUFFER_RING_H
+#define BUFFER_RING_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+/**
+ * Fixed set of large buffers passed from a producer thread to a consumer
+ * thread and back, so that one can fill buffers while the other drains
+ * them (e.g. reading standard input ahead of the network). Buffers are
+ * consumed in the order they were published.
+ *
+ * A buffer is identified by its index. The producer acquire()s a free one,
+ * fills it and publish()es it; the consumer consume()s it and release()s it
+ * once done with it, which may be later and from another thread (e.g. when
+ * the last segment referring to it is acknowledged).
+ */
+class BufferRing {
+public:
+	/**
+	 * Allocates the buffers.
+	 *
+	 * @param count Number of buffers.
+	 * @param size Size of each.
+	 */
+	BufferRing(int count, size_t size);
+
+	/**
+	 * Returns a buffer's memory.
+	 */
+	char *data(int index) { return this->memory.data() + index * this->buffer_size; }
+
+	/**
+	 * Returns the size of each buffer.
+	 */
+	size_t size() { return this->buffer_size; }
+
+	/**
+	 * Waits for a free buffer.
+	 *
+	 * @return its index, or -1 if the ring was closed
+	 */
+	int acquire();
+
+	/**
+	 * Hands a filled buffer to the consumer.
+	 *
+	 * @param length Bytes of data in it (0 to mark the end of the data).
+	 */
+	void publish(int index, size_t length);
+
+	/**
+	 * Waits for the next published buffer.
+	 *
+	 * @param length Set to the bytes of data in it.
+	 * @return its index, or -1 if the ring was closed
+	 */
+	int consume(size_t *length);
+
+	/**
+	 * Gives a consumed buffer back to the producer.
+	 */
+	void release(int index);
+
+	/**
+	 * Makes acquire() and consume() return -1 from now on, e.g. when the
+	 * other thread's side failed and nothing more will be passed along.
+	 */
+	void close();
+
+	/**
+	 * Checks whether close() was called.
+	 */
+	bool is_closed();
+
+private:
+	std::vector<char> memory;
+	size_t buffer_size;
+	std::vector<size_t> lengths;
+
+	std::mutex lock;
+	std::condition_variable changed;
+	std::deque<int> free_buffers;
+	std::deque<int> filled_buffers;
+	bool closed;
+};
+
+#endif
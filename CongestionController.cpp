@@ -0,0 +1,313 @@
+/*
+ * File: CongestionController.cpp
+ *
+ * Congestion controllers for ReliableSocket.
+ *
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "CongestionController.h"
+#include "rdt_time.h"
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the CongestionController header file
+*/
+
+const char *protocol_mode_name(ProtocolMode mode) {
+	switch (mode) {
+	case MODE_STOP_AND_WAIT:
+		return "stop-and-wait";
+	case MODE_WINDOWED:
+		return "windowed";
+	default:
+		return "measuring";
+	}
+}
+
+void CongestionController::seed(double, uint32_t) {
+}
+
+ProtocolMode CongestionController::mode() {
+	return this->window() > 1 ? MODE_WINDOWED : MODE_STOP_AND_WAIT;
+}
+
+const char *StopAndWaitController::name() {
+	return "stop-and-wait";
+}
+
+uint32_t StopAndWaitController::window() {
+	return 1;
+}
+
+void StopAndWaitController::on_ack(uint32_t, uint32_t, uint64_t) {
+}
+
+void StopAndWaitController::on_loss() {
+}
+
+void StopAndWaitController::on_timeout() {
+}
+
+LedbatController::LedbatController(int target_ms) {
+	this->target_us = (uint64_t)target_ms * 1000;
+	this->cwnd = INITIAL_WINDOW;
+	this->base_minute = 0;
+	this->last_decrease_usec = 0;
+}
+
+const char *LedbatController::name() {
+	return "ledbat";
+}
+
+uint32_t LedbatController::window() {
+	return this->cwnd < MIN_WINDOW ? MIN_WINDOW : (uint32_t)this->cwnd;
+}
+
+void LedbatController::on_ack(uint32_t acked, uint32_t in_flight, uint64_t rtt_us) {
+	uint64_t now = monotonic_usec();
+	if (rtt_us > 0) {
+		this->add_sample(rtt_us, now);
+	}
+	if (this->current_delays.empty()) {
+		// Nothing to steer by yet
+		return;
+	}
+
+	uint64_t queuing_delay = this->current_delay() - this->base_delay();
+	if (queuing_delay > this->target_us) {
+		// Somebody else is filling the queue, so get out of the way in
+		// proportion to how far over the target it is
+		this->decrease(std::max(0.5, (double)this->target_us / queuing_delay), now);
+		return;
+	}
+
+	double off_target = (double)(this->target_us - queuing_delay) / this->target_us;
+	this->cwnd += off_target * acked / this->cwnd;
+
+	// Don't grow a window the application isn't filling
+	double max_allowed = in_flight + ALLOWED_INCREASE;
+	this->cwnd = std::max(std::min(this->cwnd, max_allowed), (double)MIN_WINDOW);
+}
+
+void LedbatController::on_loss() {
+	this->decrease(0.5, monotonic_usec());
+}
+
+void LedbatController::on_timeout() {
+	this->cwnd = MIN_WINDOW;
+	this->last_decrease_usec = monotonic_usec();
+}
+
+void LedbatController::add_sample(uint64_t rtt_us, uint64_t now) {
+	uint64_t minute = now / 60000000;
+	if (this->base_history.empty() || minute != this->base_minute) {
+		this->base_history.push_back(rtt_us);
+		if ((int)this->base_history.size() > BASE_HISTORY) {
+			this->base_history.erase(this->base_history.begin());
+		}
+		this->base_minute = minute;
+	} else if (rtt_us < this->base_history.back()) {
+		this->base_history.back() = rtt_us;
+	}
+
+	this->current_delays.push_back(rtt_us);
+	if ((int)this->current_delays.size() > CURRENT_FILTER) {
+		this->current_delays.pop_front();
+	}
+}
+
+uint64_t LedbatController::base_delay() {
+	return *std::min_element(this->base_history.begin(), this->base_history.end());
+}
+
+uint64_t LedbatController::current_delay() {
+	return *std::min_element(this->current_delays.begin(), this->current_delays.end());
+}
+
+void LedbatController::decrease(double factor, uint64_t now) {
+	uint64_t rtt = this->current_delays.empty() ? 0 : this->current_delay();
+	if (this->last_decrease_usec != 0 && now - this->last_decrease_usec < rtt) {
+		// Already reacted to this RTT's delay
+		return;
+	}
+	this->cwnd = std::max(this->cwnd * factor, (double)MIN_WINDOW);
+	this->last_decrease_usec = now;
+}
+
+AdaptiveController::AdaptiveController() {
+	this->current_mode = MODE_MEASURING;
+	this->cwnd = 1;
+	this->round_start_usec = 0;
+	this->round_window = 1;
+	this->round_acked = 0;
+	this->round_max_in_flight = 0;
+	this->rounds_since_probe = 0;
+	this->probing = false;
+	this->round_lost = false;
+	this->loss_cap = MAX_WINDOW;
+	this->startup_best_rate = 0;
+	this->full_pipe_rounds = 0;
+	this->min_rtt_us = 0;
+	this->min_rtt_stamp = 0;
+}
+
+const char *AdaptiveController::name() {
+	return "adaptive";
+}
+
+uint32_t AdaptiveController::window() {
+	return this->cwnd;
+}
+
+ProtocolMode AdaptiveController::mode() {
+	return this->current_mode;
+}
+
+void AdaptiveController::seed(double rate, uint32_t srtt_ms) {
+	if (rate <= 0 || srtt_ms == 0 || this->round_start_usec != 0) {
+		// Nothing to go on, or already measuring the path itself
+		return;
+	}
+	double bdp = rate * srtt_ms / 1000;
+	if (bdp < 1) {
+		this->current_mode = MODE_STOP_AND_WAIT;
+		this->cwnd = 1;
+		this->rounds_since_probe = 0;
+	} else {
+		this->cwnd = std::min((uint32_t)bdp, (uint32_t)MAX_WINDOW);
+	}
+	this->round_window = this->cwnd;
+}
+
+double AdaptiveController::bdp() {
+	if (this->min_rtt_us == 0 || this->rates.empty()) {
+		return 0;
+	}
+	return this->max_rate() * this->min_rtt_us / 1e6;
+}
+
+void AdaptiveController::on_ack(uint32_t acked, uint32_t in_flight, uint64_t rtt_us) {
+	uint64_t now = monotonic_usec();
+	if (rtt_us > 0 && (this->min_rtt_us == 0 || rtt_us <= this->min_rtt_us ||
+			now - this->min_rtt_stamp > (uint64_t)MIN_RTT_EXPIRY * 1000000)) {
+		this->min_rtt_us = rtt_us;
+		this->min_rtt_stamp = now;
+	}
+	if (this->round_start_usec == 0) {
+		// Nothing to time the first round from
+		this->round_start_usec = now;
+		return;
+	}
+
+	this->round_acked += acked;
+	this->round_max_in_flight = std::max(this->round_max_in_flight, in_flight);
+	if (this->round_acked >= this->round_window) {
+		this->end_round(now);
+	}
+}
+
+void AdaptiveController::on_loss() {
+	if (this->current_mode == MODE_WINDOWED && !this->round_lost) {
+		// The queue is too short for this window
+		this->round_lost = true;
+		this->loss_cap = std::max(this->cwnd * 3 / 4, (uint32_t)2);
+		this->cwnd = std::min(this->cwnd, this->loss_cap);
+	} else if (this->current_mode == MODE_MEASURING && !this->rates.empty()) {
+		// The queue overflowed, so the pipe is full. A loss before any
+		// window was timed is more likely noise than congestion.
+		this->choose_mode();
+	}
+}
+
+void AdaptiveController::on_timeout() {
+	this->on_loss();
+}
+
+void AdaptiveController::end_round(uint64_t now) {
+	uint64_t elapsed = now - this->round_start_usec;
+	double rate = elapsed > 0 ? this->round_acked * 1e6 / elapsed : 0;
+	bool app_limited = this->round_max_in_flight < this->round_window;
+	this->round_start_usec = now;
+	this->round_acked = 0;
+	this->round_max_in_flight = 0;
+	if (!this->round_lost && this->loss_cap < MAX_WINDOW) {
+		this->loss_cap++;
+	}
+	this->round_lost = false;
+
+	// One segment per round trip only measures the RTT, and a window the
+	// application didn't fill only says the path is at least that fast
+	if (this->round_window >= 2 && (!app_limited || rate > this->max_rate())) {
+		this->rates.push_back(rate);
+		if ((int)this->rates.size() > RATE_ROUNDS) {
+			this->rates.pop_front();
+		}
+	}
+
+	switch (this->current_mode) {
+	case MODE_MEASURING:
+		if (rate >= 1.25 * this->startup_best_rate) {
+			this->startup_best_rate = rate;
+			this->full_pipe_rounds = 0;
+			if (!app_limited) {
+				this->cwnd = std::min(2 * this->cwnd, (uint32_t)MAX_WINDOW);
+			}
+		} else if (++this->full_pipe_rounds >= FULL_PIPE_ROUNDS) {
+			this->choose_mode();
+		}
+		break;
+	case MODE_WINDOWED:
+		this->choose_mode();
+		break;
+	case MODE_STOP_AND_WAIT:
+		if (this->probing) {
+			this->probing = false;
+			this->choose_mode();
+		} else if (++this->rounds_since_probe >= PROBE_ROUNDS) {
+			// A pair of segments back to back shows whether the path can
+			// take more than one at a time now
+			this->probing = true;
+			this->rates.clear();
+			this->cwnd = 2;
+		}
+		break;
+	}
+	this->round_window = this->cwnd;
+}
+
+void AdaptiveController::choose_mode() {
+	double bdp = this->bdp();
+	if (bdp < 1) {
+		this->current_mode = MODE_STOP_AND_WAIT;
+		this->cwnd = 1;
+		this->rounds_since_probe = 0;
+		return;
+	}
+	this->current_mode = MODE_WINDOWED;
+	this->cwnd = std::clamp((uint32_t)std::ceil(bdp * WINDOW_GAIN / 100), (uint32_t)2,
+			this->loss_cap);
+}
+
+double AdaptiveController::max_rate() {
+	if (this->rates.empty()) {
+		return 0;
+	}
+	return *std::max_element(this->rates.begin(), this->rates.end());
+}
+
+std::unique_ptr<CongestionController> make_congestion_controller(const char *name) {
+	if (strcmp(name, "adaptive") == 0) {
+		return std::make_unique<AdaptiveController>();
+	}
+	if (strcmp(name, "stop-and-wait") == 0) {
+		return std::make_unique<StopAndWaitController>();
+	}
+	if (strcmp(name, "ledbat") == 0) {
+		return std::make_unique<LedbatController>();
+	}
+	return NULL;
+}
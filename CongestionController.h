@@ -0,0 +1,277 @@
+/*
+ * File: CongestionController.h
+ *
+ * Header / API file for the congestion controllers that decide how many
+ * segments a connection may have in flight.
+ *
+ */
+#ifndef CONGESTION_CONTROLLER_H
+#define CONGESTION_CONTROLLER_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+/**
+ * How a connection is sending: one segment per round trip, or a window of
+ * them. MODE_MEASURING means an AdaptiveController hasn't decided yet.
+ */
+enum ProtocolMode { MODE_MEASURING, MODE_STOP_AND_WAIT, MODE_WINDOWED };
+
+/**
+ * Returns the name of a mode ("measuring", "stop-and-wait" or "windowed").
+ */
+const char *protocol_mode_name(ProtocolMode mode);
+
+/**
+ * Decides how many segments a ReliableSocket may have sent but not yet
+ * acknowledged. The socket also never sends more than the remote host
+ * advertises it can buffer.
+ *
+ * Each connection has its own controller (see
+ * ReliableSocket::set_congestion_control()).
+ */
+class CongestionController {
+public:
+	virtual ~CongestionController() {}
+
+	/**
+	 * Returns the controller's name, as accepted by
+	 * make_congestion_controller().
+	 */
+	virtual const char *name() = 0;
+
+	/**
+	 * Returns the number of segments that may be unacknowledged at once.
+	 */
+	virtual uint32_t window() = 0;
+
+	/**
+	 * Called when an ACK acknowledges new segments.
+	 *
+	 * @param acked Number of segments it acknowledged.
+	 * @param in_flight Segments that were unacknowledged before it arrived.
+	 * @param rtt_us RTT sample it gave, or 0 if it acknowledged a
+	 * 		retransmitted segment and so can't be timed.
+	 */
+	virtual void on_ack(uint32_t acked, uint32_t in_flight, uint64_t rtt_us) = 0;
+
+	/**
+	 * Called when duplicate ACKs show that a segment was lost.
+	 */
+	virtual void on_loss() = 0;
+
+	/**
+	 * Called when the retransmission timer expires.
+	 */
+	virtual void on_timeout() = 0;
+
+	/**
+	 * Called before the first segment is sent, with what earlier
+	 * connections measured on the path (see PeerCache). By default the
+	 * controller starts cold anyway.
+	 *
+	 * @param rate Segments per second they delivered.
+	 * @param srtt_ms Their smoothed RTT.
+	 */
+	virtual void seed(double rate, uint32_t srtt_ms);
+
+	/**
+	 * Returns the mode the controller is sending in. By default, windowed
+	 * whenever the window is over one segment.
+	 */
+	virtual ProtocolMode mode();
+};
+
+/**
+ * One segment at a time, whatever the network does. AdaptiveController
+ * picks this mode by itself on paths where it is the best there is.
+ */
+class StopAndWaitController : public CongestionController {
+public:
+	const char *name() override;
+	uint32_t window() override;
+	void on_ack(uint32_t acked, uint32_t in_flight, uint64_t rtt_us) override;
+	void on_loss() override;
+	void on_timeout() override;
+};
+
+/**
+ * Low-priority, delay-based controller for background transfers, after
+ * LEDBAT (RFC 6817). It only uses capacity nobody else is using: the
+ * window grows while the queuing delay (the current RTT minus the lowest
+ * RTT seen on the path) is below the target and shrinks as soon as it is
+ * above, so competing traffic that fills the bottleneck queue pushes it
+ * out long before it would notice a loss.
+ *
+ * It works from RTT samples rather than one-way delays, so a queue on the
+ * ACK path makes it yield too. Unlike RFC 6817's linear decrease, a window
+ * over the target is cut multiplicatively (at most once per RTT, by at most
+ * half) so it yields within a few RTTs.
+ */
+class LedbatController : public CongestionController {
+public:
+	static const int DEFAULT_TARGET = 25; // ms of queuing delay to aim for
+	static const int BASE_HISTORY = 10; // minutes the base delay is the minimum over
+	static const int CURRENT_FILTER = 4; // samples the current delay is the minimum of
+	static const int INITIAL_WINDOW = 2; // segments
+	static const int MIN_WINDOW = 1; // segments
+	static const int ALLOWED_INCREASE = 1; // segments the window may exceed what is in flight by
+
+	/**
+	 * Creates a controller.
+	 *
+	 * @param target_ms Queuing delay it aims for. RFC 6817 caps this at
+	 * 		100 ms; smaller targets yield sooner.
+	 */
+	LedbatController(int target_ms = DEFAULT_TARGET);
+
+	const char *name() override;
+	uint32_t window() override;
+	void on_ack(uint32_t acked, uint32_t in_flight, uint64_t rtt_us) override;
+	void on_loss() override;
+	void on_timeout() override;
+
+private:
+	uint64_t target_us;
+	double cwnd;
+
+	// Lowest RTT of each of the last BASE_HISTORY minutes, newest last, so
+	// a route change that raises the delay is forgotten after a while
+	std::vector<uint64_t> base_history;
+	uint64_t base_minute;
+	// Most recent samples
+	std::deque<uint64_t> current_delays;
+	// When the window was last cut, so it is cut at most once per RTT
+	uint64_t last_decrease_usec;
+
+	/*
+	 * Adds an RTT sample to the base and current delay filters.
+	 */
+	void add_sample(uint64_t rtt_us, uint64_t now);
+
+	/*
+	 * Returns the lowest RTT seen in the base history.
+	 */
+	uint64_t base_delay();
+
+	/*
+	 * Returns the lowest of the most recent RTT samples.
+	 */
+	uint64_t current_delay();
+
+	/*
+	 * Cuts the window to the given fraction unless it was cut less than an
+	 * RTT ago.
+	 */
+	void decrease(double factor, uint64_t now);
+};
+
+/**
+ * Picks stop-and-wait or a window from the bandwidth-delay product (BDP) it
+ * measures. On a path whose BDP is under one segment (e.g. a slow link with
+ * a queue of a packet or two) a second segment in flight only waits in the
+ * queue, or overflows it, so stop-and-wait is as fast as anything and the
+ * gentlest; on a fat pipe only a window of about the BDP keeps it full.
+ *
+ * Each round trip (a window's worth of ACKs) gives a delivery rate sample,
+ * and the lowest RTT seen gives the path's propagation delay; their product
+ * is the BDP in segments. During startup the window starts at one segment,
+ * then doubles every round while the delivery rate keeps growing. Once it
+ * stops growing (or a segment is lost), the pipe is full: below one segment
+ * of BDP the controller stops and waits, otherwise it keeps a window of
+ * WINDOW_GAIN percent of the BDP, as measured over the last RATE_ROUNDS
+ * rounds. The extra half lets the estimate grow if the path gets faster
+ * while only queuing a fraction of a BDP at the bottleneck.
+ *
+ * Rounds of stop-and-wait say nothing about the bandwidth, so in that mode
+ * it sends a pair of segments every PROBE_ROUNDS rounds to check whether
+ * the path got faster. In windowed mode it switches back once the BDP falls
+ * under one segment. Like BBR, it steers by rate and RTT rather than loss,
+ * except that a bottleneck queue too short for the window (like the
+ * 2-packet queues transfer_test.py sets up) shows up as losses: a round
+ * with a loss caps the window at three quarters of what it was, and every
+ * round without one raises the cap by a segment. The receiver's advertised
+ * window still caps what it sends.
+ */
+class AdaptiveController : public CongestionController {
+public:
+	static const int MAX_WINDOW = 256; // segments
+	static const int WINDOW_GAIN = 150; // window in percent of the BDP, for ACK jitter and room to grow
+	static const int FULL_PIPE_ROUNDS = 2; // rounds without rate growth that end startup
+	static const int RATE_ROUNDS = 10; // rounds the delivery rate is the maximum over
+	static const int PROBE_ROUNDS = 64; // stop-and-wait rounds between probes
+	static const int MIN_RTT_EXPIRY = 10; // seconds the lowest RTT is trusted for
+
+	AdaptiveController();
+
+	const char *name() override;
+	uint32_t window() override;
+	void on_ack(uint32_t acked, uint32_t in_flight, uint64_t rtt_us) override;
+	void on_loss() override;
+	void on_timeout() override;
+	ProtocolMode mode() override;
+
+	/**
+	 * Starts from the cached BDP instead of one segment: stop-and-wait if
+	 * it is under one segment, otherwise startup goes on from a window of
+	 * the BDP (at most MAX_WINDOW), so it takes a round or two rather than
+	 * a doubling per round to fill a known fat pipe.
+	 */
+	void seed(double rate, uint32_t srtt_ms) override;
+
+	/**
+	 * Returns the measured BDP in segments, or 0 until it is known.
+	 */
+	double bdp();
+
+private:
+	ProtocolMode current_mode;
+	uint32_t cwnd;
+
+	// Current round: when it started, the window then, what was acked and
+	// the most in flight since. A round in which the application never
+	// filled the window is app-limited, so its rate is only a lower bound.
+	uint64_t round_start_usec;
+	uint32_t round_window;
+	uint32_t round_acked;
+	uint32_t round_max_in_flight;
+	uint32_t rounds_since_probe;
+	bool probing;
+	bool round_lost;
+	uint32_t loss_cap;
+
+	// Segments per second of the last RATE_ROUNDS windowed rounds
+	std::deque<double> rates;
+	// Best rate during startup, and rounds since it last grew enough
+	double startup_best_rate;
+	int full_pipe_rounds;
+
+	uint64_t min_rtt_us;
+	uint64_t min_rtt_stamp;
+
+	/*
+	 * Ends a round: takes its rate sample and adjusts the mode and window.
+	 */
+	void end_round(uint64_t now);
+
+	/*
+	 * Leaves startup for whichever mode the BDP calls for.
+	 */
+	void choose_mode();
+
+	/*
+	 * Returns the highest recent delivery rate, in segments per second.
+	 */
+	double max_rate();
+};
+
+/**
+ * Creates a controller by name: "adaptive", "stop-and-wait" or "ledbat".
+ *
+ * @return the controller, or NULL if the name is unknown
+ */
+std::unique_ptr<CongestionController> make_congestion_controller(const char *name);
+
+#endif
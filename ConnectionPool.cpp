@@ -0,0 +1,177 @@
+/*
+ * File: ConnectionPool.cpp
+ *
+ * Pool of reusable reliable connections.
+ *
+ */
+
+// C++ library includes
+#include <iostream>
+
+#include "ConnectionPool.h"
+#include "rdt_time.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the ConnectionPool header file
+*/
+
+ConnectionPool::ConnectionPool(int max_idle_per_peer, int keepalive_interval_ms,
+		int max_idle_time_ms, int connect_timeout_ms) {
+	this->max_idle_per_peer = max_idle_per_peer;
+	this->keepalive_interval = keepalive_interval_ms;
+	this->max_idle_time = max_idle_time_ms;
+	this->connect_timeout = connect_timeout_ms;
+}
+
+ConnectionPool::~ConnectionPool() {
+	for (auto &peer : this->idle) {
+		for (IdleConnection &conn : peer.second) {
+			this->retire(conn.socket);
+		}
+	}
+	this->idle.clear();
+
+	if (!this->leased.empty()) {
+		cerr << "WARNING: ConnectionPool destroyed with "
+			<< this->leased.size() << " connection(s) still acquired\n";
+	}
+}
+
+std::string ConnectionPool::peer_key(char *hostname, int port_num) {
+	return std::string(hostname) + ":" + std::to_string(port_num);
+}
+
+ReliableSocket *ConnectionPool::acquire(char *hostname, int port_num) {
+	std::string key = peer_key(hostname, port_num);
+	std::vector<IdleConnection> &conns = this->idle[key];
+
+	// Prefer the most recently used connection since its RTT estimate is
+	// the most up to date.
+	while (!conns.empty()) {
+		IdleConnection conn = conns.back();
+		conns.pop_back();
+
+		uint64_t now = monotonic_msec();
+		bool usable = conn.socket->service_idle();
+		if (usable && now - conn.last_checked >= (uint64_t)this->keepalive_interval) {
+			usable = conn.socket->probe_remote(PROBE_ATTEMPTS);
+		}
+
+		if (usable) {
+			cerr << "INFO: Reusing pooled connection to " << key << "\n";
+			this->leased[conn.socket] = key;
+			return conn.socket;
+		}
+
+		conn.socket->abort_connection();
+		delete conn.socket;
+	}
+
+	// A remote host that never answers would otherwise hold up the caller
+	// (and every connection it pools) forever
+	ReliableSocket *socket = new ReliableSocket();
+	socket->set_idle_timeout(this->connect_timeout);
+	socket->connect_to_remote(hostname, port_num);
+	if (socket->get_state() != ESTABLISHED) {
+		delete socket;
+		return NULL;
+	}
+	socket->set_idle_timeout(0);
+
+	this->leased[socket] = key;
+	return socket;
+}
+
+void ConnectionPool::release(ReliableSocket *socket) {
+	auto it = this->leased.find(socket);
+	if (it == this->leased.end()) {
+		cerr << "ERROR: Released a connection that is not from this pool\n";
+		return;
+	}
+	std::string key = it->second;
+	this->leased.erase(it);
+
+	if (socket->get_state() != ESTABLISHED) {
+		// The caller closed it (or the remote host did), so it can't be reused
+		socket->abort_connection();
+		delete socket;
+		return;
+	}
+
+	std::vector<IdleConnection> &conns = this->idle[key];
+	if ((int)conns.size() >= this->max_idle_per_peer) {
+		this->retire(socket);
+		return;
+	}
+
+	IdleConnection conn;
+	conn.socket = socket;
+	conn.idle_since = monotonic_msec();
+	conn.last_checked = conn.idle_since;
+	conns.push_back(conn);
+}
+
+void ConnectionPool::discard(ReliableSocket *socket) {
+	if (this->leased.erase(socket) == 0) {
+		cerr << "ERROR: Discarded a connection that is not from this pool\n";
+		return;
+	}
+
+	socket->abort_connection();
+	delete socket;
+}
+
+void ConnectionPool::maintain() {
+	uint64_t now = monotonic_msec();
+
+	for (auto &peer : this->idle) {
+		std::vector<IdleConnection> &conns = peer.second;
+		for (size_t i = 0; i < conns.size(); ) {
+			IdleConnection &conn = conns[i];
+
+			if (!conn.socket->service_idle()) {
+				cerr << "INFO: Pooled connection to " << peer.first << " was closed remotely\n";
+				this->retire(conn.socket);
+			} else if (now - conn.idle_since >= (uint64_t)this->max_idle_time) {
+				cerr << "INFO: Closing idle pooled connection to " << peer.first << "\n";
+				this->retire(conn.socket);
+			} else if (now - conn.last_checked < (uint64_t)this->keepalive_interval) {
+				i++;
+				continue;
+			} else if (conn.socket->probe_remote(PROBE_ATTEMPTS)) {
+				conn.last_checked = monotonic_msec();
+				i++;
+				continue;
+			} else {
+				cerr << "INFO: Dropping dead pooled connection to " << peer.first << "\n";
+				conn.socket->abort_connection();
+				delete conn.socket;
+			}
+
+			conns.erase(conns.begin() + i);
+		}
+	}
+}
+
+int ConnectionPool::idle_count() {
+	int count = 0;
+	for (auto &peer : this->idle) {
+		count += peer.second.size();
+	}
+	return count;
+}
+
+void ConnectionPool::retire(ReliableSocket *socket) {
+	// A graceful close would wait forever on a dead remote host
+	if (socket->get_state() == FIN) {
+		socket->close_connection();
+	} else if (socket->get_state() == ESTABLISHED && socket->probe_remote(PROBE_ATTEMPTS)) {
+		socket->close_connection();
+	} else {
+		socket->abort_connection();
+	}
+	delete socket;
+}
@@ -0,0 +1,130 @@
+/*
+ * File: ConnectionPool.h
+ *
+ * Header / API file for a pool of established reliable connections that can
+ * be reused for successive transfers to the same remote host.
+ *
+ */
+#ifndef CONNECTION_POOL_H
+#define CONNECTION_POOL_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ReliableSocket.h"
+
+/**
+ * Class that keeps established ReliableSockets open between transfers so
+ * callers talking to the same remote host repeatedly don't pay for a new
+ * handshake and a TIME_WAIT every time.
+ *
+ * A typical transfer looks like:
+ *
+ *     ReliableSocket *socket = pool.acquire(host, port);
+ *     socket->send_data(...);
+ *     socket->end_transfer();
+ *     pool.release(socket);
+ *
+ * The remote host must keep calling receive_data() after it returns 0 for
+ * the connection to be reused.
+ */
+class ConnectionPool {
+public:
+	static const int DEFAULT_MAX_IDLE_PER_PEER = 4;
+	static const int DEFAULT_KEEPALIVE_INTERVAL = 15000; // ms
+	static const int DEFAULT_MAX_IDLE_TIME = 120000; // ms
+	static const int DEFAULT_CONNECT_TIMEOUT = 5000; // ms
+	static const int PROBE_ATTEMPTS = 3;
+
+	/**
+	 * Creates an empty pool.
+	 *
+	 * @param max_idle_per_peer Most idle connections kept for one remote host.
+	 * @param keepalive_interval_ms Idle time after which a connection is
+	 * 		probed before it is handed out again.
+	 * @param max_idle_time_ms Idle time after which a connection is closed.
+	 * @param connect_timeout_ms Longest acquire() waits for a new
+	 * 		connection's handshake before giving up on the remote host.
+	 */
+	ConnectionPool(int max_idle_per_peer = DEFAULT_MAX_IDLE_PER_PEER,
+			int keepalive_interval_ms = DEFAULT_KEEPALIVE_INTERVAL,
+			int max_idle_time_ms = DEFAULT_MAX_IDLE_TIME,
+			int connect_timeout_ms = DEFAULT_CONNECT_TIMEOUT);
+
+	/**
+	 * Closes every idle connection in the pool.
+	 *
+	 * @note Connections that are still acquired must be released or
+	 * discarded before the pool is destroyed.
+	 */
+	~ConnectionPool();
+
+	/**
+	 * Hands out an established connection to the given remote host, reusing
+	 * an idle one if the pool has a live one and connecting otherwise.
+	 *
+	 * @param hostname Name of the remote host to connect to.
+	 * @param port_num Port number of remote host.
+	 * @return Connection owned by the pool until it is released, or NULL
+	 * 		if the remote host didn't answer in time.
+	 */
+	ReliableSocket *acquire(char *hostname, int port_num);
+
+	/**
+	 * Returns a connection to the pool once a transfer is finished.
+	 *
+	 * @param socket Connection previously returned by acquire().
+	 */
+	void release(ReliableSocket *socket);
+
+	/**
+	 * Drops a connection that the caller found to be broken, without a
+	 * teardown handshake.
+	 *
+	 * @param socket Connection previously returned by acquire().
+	 */
+	void discard(ReliableSocket *socket);
+
+	/**
+	 * Probes connections that have been idle for longer than the keepalive
+	 * interval and closes the ones that are dead or idle for too long. Should
+	 * be called periodically by long-running applications.
+	 */
+	void maintain();
+
+	/**
+	 * Returns the number of idle connections currently in the pool.
+	 */
+	int idle_count();
+
+private:
+	struct IdleConnection {
+		ReliableSocket *socket;
+		uint64_t idle_since; // monotonic_msec()
+		uint64_t last_checked;
+	};
+
+	int max_idle_per_peer;
+	int keepalive_interval;
+	int max_idle_time;
+	int connect_timeout;
+
+	// Idle connections by "host:port", most recently used last
+	std::map<std::string, std::vector<IdleConnection>> idle;
+	// Peer of each connection that is currently handed out
+	std::map<ReliableSocket*, std::string> leased;
+
+	/*
+	 * Builds the key used to look up connections to a remote host.
+	 */
+	static std::string peer_key(char *hostname, int port_num);
+
+	/*
+	 * Closes an idle connection, gracefully if the remote host still
+	 * answers and by aborting it otherwise, and frees it.
+	 */
+	void retire(ReliableSocket *socket);
+};
+
+#endif
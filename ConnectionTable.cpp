@@ -0,0 +1,190 @@
+/*
+ * File: ConnectionTable.cpp
+ *
+ * Compact table of per-connection state.
+ *
+ */
+
+#include "ConnectionTable.h"
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the ConnectionTable header file
+*/
+
+ConnectionTable::ConnectionTable(size_t expected) {
+	this->count = 0;
+
+	// Keep the hash table at most half full
+	size_t entries = INITIAL_CAPACITY;
+	while (entries < 2 * expected) {
+		entries *= 2;
+	}
+	this->keys.assign(entries, 0);
+	this->key_slots.assign(entries, -1);
+
+	this->timers.reserve(expected);
+	this->cwnds.reserve(expected);
+	this->send_seqs.reserve(expected);
+	this->ack_seqs.reserve(expected);
+	this->states.reserve(expected);
+	this->retry_counts.reserve(expected);
+	this->ids.reserve(expected);
+	this->peers.reserve(expected);
+}
+
+uint64_t ConnectionTable::peer_id(const struct sockaddr_in &addr) {
+	return ((uint64_t)addr.sin_addr.s_addr << 16) | addr.sin_port;
+}
+
+int ConnectionTable::insert(uint64_t conn_id, const struct sockaddr_in &peer) {
+	if (this->find(conn_id) >= 0) {
+		return -1;
+	}
+	if (2 * (this->count + 1) > this->keys.size()) {
+		this->grow();
+	}
+
+	int slot;
+	if (!this->free_slots.empty()) {
+		slot = this->free_slots.back();
+		this->free_slots.pop_back();
+	} else {
+		slot = this->ids.size();
+		this->timers.push_back(0);
+		this->cwnds.push_back(0);
+		this->send_seqs.push_back(0);
+		this->ack_seqs.push_back(0);
+		this->states.push_back(0);
+		this->retry_counts.push_back(0);
+		this->ids.push_back(0);
+		this->peers.push_back(peer);
+	}
+	this->timers[slot] = 0;
+	this->cwnds[slot] = 1;
+	this->send_seqs[slot] = 0;
+	this->ack_seqs[slot] = 0;
+	this->states[slot] = INIT;
+	this->retry_counts[slot] = 0;
+	this->ids[slot] = conn_id;
+	this->peers[slot] = peer;
+
+	size_t mask = this->keys.size() - 1;
+	size_t i = this->home_index(conn_id);
+	while (this->key_slots[i] >= 0) {
+		i = (i + 1) & mask;
+	}
+	this->keys[i] = conn_id;
+	this->key_slots[i] = slot;
+	this->count++;
+	return slot;
+}
+
+int ConnectionTable::find(uint64_t conn_id) {
+	size_t mask = this->keys.size() - 1;
+	for (size_t i = this->home_index(conn_id); this->key_slots[i] >= 0; i = (i + 1) & mask) {
+		if (this->keys[i] == conn_id) {
+			return this->key_slots[i];
+		}
+	}
+	return -1;
+}
+
+bool ConnectionTable::erase(uint64_t conn_id) {
+	size_t mask = this->keys.size() - 1;
+	size_t i = this->home_index(conn_id);
+	while (this->key_slots[i] >= 0 && this->keys[i] != conn_id) {
+		i = (i + 1) & mask;
+	}
+	if (this->key_slots[i] < 0) {
+		return false;
+	}
+
+	int slot = this->key_slots[i];
+	this->timers[slot] = 0;
+	this->states[slot] = CLOSED;
+	this->free_slots.push_back(slot);
+	this->count--;
+
+	// Shift later entries of the probe sequence back into the hole instead
+	// of leaving a tombstone, so lookups never probe past dead entries
+	size_t j = i;
+	for (;;) {
+		j = (j + 1) & mask;
+		if (this->key_slots[j] < 0) {
+			break;
+		}
+		size_t home = this->home_index(this->keys[j]);
+		bool home_in_between = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+		if (!home_in_between) {
+			this->keys[i] = this->keys[j];
+			this->key_slots[i] = this->key_slots[j];
+			i = j;
+		}
+	}
+	this->key_slots[i] = -1;
+	return true;
+}
+
+size_t ConnectionTable::size() {
+	return this->count;
+}
+
+void ConnectionTable::collect_expired(uint64_t now, std::vector<int> &expired) {
+	expired.clear();
+	const uint64_t *timers = this->timers.data();
+	int slots = this->timers.size();
+	for (int slot = 0; slot < slots; slot++) {
+		if (timers[slot] != 0 && timers[slot] <= now) {
+			expired.push_back(slot);
+		}
+	}
+	for (int slot : expired) {
+		this->timers[slot] = 0;
+	}
+}
+
+size_t ConnectionTable::memory_usage() {
+	return this->keys.capacity() * sizeof(uint64_t) +
+		this->key_slots.capacity() * sizeof(int32_t) +
+		this->timers.capacity() * sizeof(uint64_t) +
+		this->cwnds.capacity() * sizeof(uint32_t) +
+		this->send_seqs.capacity() * sizeof(uint32_t) +
+		this->ack_seqs.capacity() * sizeof(uint32_t) +
+		this->states.capacity() * sizeof(uint8_t) +
+		this->retry_counts.capacity() * sizeof(uint8_t) +
+		this->ids.capacity() * sizeof(uint64_t) +
+		this->peers.capacity() * sizeof(struct sockaddr_in) +
+		this->free_slots.capacity() * sizeof(int32_t);
+}
+
+size_t ConnectionTable::home_index(uint64_t conn_id) {
+	// splitmix64 finalizer, so ids that differ only in the port spread out
+	uint64_t h = conn_id;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return h & (this->keys.size() - 1);
+}
+
+void ConnectionTable::grow() {
+	std::vector<uint64_t> old_keys;
+	std::vector<int32_t> old_slots;
+	old_keys.swap(this->keys);
+	old_slots.swap(this->key_slots);
+
+	this->keys.assign(2 * old_keys.size(), 0);
+	this->key_slots.assign(2 * old_keys.size(), -1);
+	size_t mask = this->keys.size() - 1;
+	for (size_t k = 0; k < old_keys.size(); k++) {
+		if (old_slots[k] < 0) {
+			continue;
+		}
+		size_t i = this->home_index(old_keys[k]);
+		while (this->key_slots[i] >= 0) {
+			i = (i + 1) & mask;
+		}
+		this->keys[i] = old_keys[k];
+		this->key_slots[i] = old_slots[k];
+	}
+}
@@ -0,0 +1,177 @@
+/*
+ * File: ConnectionTable.h
+ *
+ * Header / API file for the compact table of per-connection state used by
+ * servers that handle very many connections on one UDP socket.
+ *
+ */
+#ifndef CONNECTION_TABLE_H
+#define CONNECTION_TABLE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "ReliableSocket.h"
+
+/**
+ * Table of connections for a server that multiplexes them all over one UDP
+ * socket instead of giving each its own ReliableSocket (and kernel socket).
+ * MultiplexServer keeps each connection's state, sequence numbers, retries
+ * and timer here. It only receives, so it leaves cwnd at one segment for
+ * servers that also send.
+ *
+ * Connections are looked up by a 64-bit connection id (see peer_id()) in an
+ * open-addressing hash table with linear probing, which gives each one a
+ * slot. The state of every connection lives in parallel arrays indexed by
+ * slot, hot fields first: a pass over every connection's timer (see
+ * collect_expired()) or sequence numbers reads one contiguous array rather
+ * than striding across whole connection objects. Slots of erased
+ * connections are reused, so they stay dense.
+ *
+ * Each connection costs 46 bytes of state plus 24 to 48 bytes of hash
+ * table (kept between a quarter and half full), so 70 to 140 bytes
+ * depending on where the arrays are in their growth: about 85 bytes with
+ * 110,000 connections. A ReliableSocket object alone is about 1,200 bytes,
+ * before its buffers and kernel socket. conn_table_bench measures this
+ * along with lookup and timer sweep times.
+ *
+ * Not thread-safe: each table belongs to one thread (e.g. one Runtime
+ * worker).
+ */
+class ConnectionTable {
+public:
+	static const int INITIAL_CAPACITY = 16; // hash table entries
+
+	/**
+	 * Creates an empty table.
+	 *
+	 * @param expected Number of connections to reserve room for.
+	 */
+	ConnectionTable(size_t expected = 0);
+
+	/**
+	 * Builds the connection id of a remote host's connection from its
+	 * address and port.
+	 */
+	static uint64_t peer_id(const struct sockaddr_in &addr);
+
+	/**
+	 * Adds a connection in state INIT with no timer armed.
+	 *
+	 * @return its slot, or -1 if the id is already in the table
+	 */
+	int insert(uint64_t conn_id, const struct sockaddr_in &peer);
+
+	/**
+	 * Looks up a connection.
+	 *
+	 * @return its slot, or -1 if it isn't in the table
+	 */
+	int find(uint64_t conn_id);
+
+	/**
+	 * Removes a connection. Its slot may be handed to the next one inserted.
+	 *
+	 * @return false if it wasn't in the table
+	 */
+	bool erase(uint64_t conn_id);
+
+	/**
+	 * Returns the number of connections in the table.
+	 */
+	size_t size();
+
+	/**
+	 * Returns the slots whose timers have expired, disarming them.
+	 *
+	 * @param now Current time (in monotonic milliseconds).
+	 * @param expired Filled with the slots (cleared first).
+	 */
+	void collect_expired(uint64_t now, std::vector<int> &expired);
+
+	/**
+	 * Returns the bytes allocated for the table, including unused capacity.
+	 */
+	size_t memory_usage();
+
+	/*
+	 * Per-slot state. Slots that aren't in use hold stale values.
+	 */
+
+	/**
+	 * Deadline (in monotonic milliseconds) of the connection's next timer,
+	 * or 0 if none is armed.
+	 */
+	uint64_t &next_timer(int slot) { return this->timers[slot]; }
+
+	/**
+	 * Congestion window, in segments.
+	 */
+	uint32_t &cwnd(int slot) { return this->cwnds[slot]; }
+
+	/**
+	 * Sequence number of the next segment to send.
+	 */
+	uint32_t &send_seq(int slot) { return this->send_seqs[slot]; }
+
+	/**
+	 * Sequence number of the next segment expected from the remote host.
+	 */
+	uint32_t &ack_seq(int slot) { return this->ack_seqs[slot]; }
+
+	/**
+	 * Times the connection's oldest unacknowledged segment was
+	 * retransmitted.
+	 */
+	uint8_t &retries(int slot) { return this->retry_counts[slot]; }
+
+	/**
+	 * Connection state.
+	 */
+	connection_status state(int slot) { return (connection_status)this->states[slot]; }
+	void set_state(int slot, connection_status state) { this->states[slot] = state; }
+
+	/**
+	 * Address of the remote host.
+	 */
+	const struct sockaddr_in &peer(int slot) { return this->peers[slot]; }
+
+	/**
+	 * Connection id the slot was inserted with.
+	 */
+	uint64_t conn_id(int slot) { return this->ids[slot]; }
+
+private:
+	// Hash table: connection id and slot of each entry, slot -1 if empty.
+	// The number of entries is a power of two.
+	std::vector<uint64_t> keys;
+	std::vector<int32_t> key_slots;
+	size_t count;
+
+	// Per-slot state, hot fields first
+	std::vector<uint64_t> timers;
+	std::vector<uint32_t> cwnds;
+	std::vector<uint32_t> send_seqs;
+	std::vector<uint32_t> ack_seqs;
+	std::vector<uint8_t> states;
+	std::vector<uint8_t> retry_counts;
+	std::vector<uint64_t> ids;
+	std::vector<struct sockaddr_in> peers;
+	// Slots of erased connections
+	std::vector<int32_t> free_slots;
+
+	/*
+	 * Returns the hash table entry a connection id's probe starts at.
+	 */
+	size_t home_index(uint64_t conn_id);
+
+	/*
+	 * Doubles the hash table and re-inserts every entry.
+	 */
+	void grow();
+};
+
+#endif
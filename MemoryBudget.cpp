@@ -0,0 +1,123 @@
+/*
+ * File: MemoryBudget.cpp
+ *
+ * Process-wide limit on memory used to buffer data.
+ *
+ */
+
+// C++ library includes
+#include <iostream>
+
+#include <cstdlib>
+
+#include "MemoryBudget.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the MemoryBudget header file
+*/
+
+MemoryBudget &MemoryBudget::instance() {
+	static MemoryBudget budget;
+	return budget;
+}
+
+MemoryBudget::MemoryBudget() {
+	this->limit = 0;
+	this->used = 0;
+	this->connections = 0;
+
+	const char *env = getenv("RDT_MEMORY_BUDGET");
+	if (env != NULL && *env != '\0') {
+		char *end;
+		size_t bytes = strtoull(env, &end, 10);
+		if (*end == 'K' || *end == 'k') {
+			bytes <<= 10;
+		} else if (*end == 'M' || *end == 'm') {
+			bytes <<= 20;
+		} else if (*end == 'G' || *end == 'g') {
+			bytes <<= 30;
+		} else if (*end != '\0') {
+			cerr << "ERROR: Ignoring malformed RDT_MEMORY_BUDGET: " << env << "\n";
+			bytes = 0;
+		}
+		this->limit = bytes;
+	}
+}
+
+void MemoryBudget::set_limit(size_t bytes) {
+	this->limit = bytes;
+}
+
+size_t MemoryBudget::get_limit() {
+	return this->limit;
+}
+
+size_t MemoryBudget::get_used() {
+	return this->used;
+}
+
+int MemoryBudget::get_connection_count() {
+	return this->connections;
+}
+
+size_t MemoryBudget::allowance(size_t held) {
+	return this->allowance(held, this->used);
+}
+
+size_t MemoryBudget::allowance(size_t held, size_t used) {
+	size_t limit = this->limit;
+	if (limit == 0) {
+		return (size_t)-1;
+	}
+	if (used >= limit) {
+		return 0;
+	}
+	size_t free = limit - used;
+	if (used < limit / 2) {
+		return free;
+	}
+
+	// Under pressure: everyone gets their fair share and no more
+	int connections = this->connections;
+	size_t share = limit / (connections > 0 ? connections : 1);
+	if (held >= share) {
+		return 0;
+	}
+	return share - held < free ? share - held : free;
+}
+
+bool MemoryBudget::try_charge(size_t bytes, size_t held) {
+	if (this->limit == 0) {
+		this->used += bytes;
+		return true;
+	}
+
+	// Other connections may charge at the same time, so check what is
+	// left and take it in one step
+	size_t used = this->used;
+	do {
+		if (this->allowance(held, used) < bytes) {
+			return false;
+		}
+	} while (!this->used.compare_exchange_weak(used, used + bytes));
+	return true;
+}
+
+void MemoryBudget::charge(size_t bytes) {
+	this->used += bytes;
+}
+
+void MemoryBudget::release(size_t bytes) {
+	this->used -= bytes;
+}
+
+void MemoryBudget::add_connection() {
+	this->connections++;
+}
+
+void MemoryBudget::remove_connection() {
+	this->connections--;
+}
@@ -0,0 +1,107 @@
+/*
+ * File: MemoryBudget.h
+ *
+ * Header / API file for the process-wide limit on memory used to buffer
+ * data.
+ *
+ */
+#ifndef MEMORY_BUDGET_H
+#define MEMORY_BUDGET_H
+
+#include <atomic>
+#include <cstddef>
+
+/**
+ * Process-wide budget for the memory connections use to buffer data: sent
+ * segments waiting for their ACK and received segments waiting for the
+ * application (in order or not). Every ReliableSocket charges what it
+ * buffers here.
+ *
+ * While less than half of the budget is used, a connection may buffer as
+ * much as its own limits allow. Past that, each connection only gets its
+ * fair share (the budget divided by the number of connections), so a few
+ * slow consumers can't starve the rest: receivers advertise smaller
+ * windows, then drop new data, and senders wait before sending more.
+ * Buffers never exceed the budget by more than one segment per connection.
+ *
+ * The budget is unlimited unless set_limit() is called or the
+ * RDT_MEMORY_BUDGET environment variable holds a size in bytes (with an
+ * optional K, M or G suffix).
+ */
+class MemoryBudget {
+public:
+	/**
+	 * Returns the budget shared by every connection in the process.
+	 */
+	static MemoryBudget &instance();
+
+	/**
+	 * Sets the budget.
+	 *
+	 * @param bytes Most memory buffers may use, or 0 for no limit.
+	 */
+	void set_limit(size_t bytes);
+
+	/**
+	 * Returns the budget, or 0 if there is no limit.
+	 */
+	size_t get_limit();
+
+	/**
+	 * Returns the memory currently charged to the budget.
+	 */
+	size_t get_used();
+
+	/**
+	 * Returns the number of connections sharing the budget.
+	 */
+	int get_connection_count();
+
+	/**
+	 * Returns how many more bytes a connection may buffer.
+	 *
+	 * @param held Bytes the connection has buffered already.
+	 */
+	size_t allowance(size_t held);
+
+	/**
+	 * Charges memory to the budget if the connection is allowed to use it
+	 * (see allowance()).
+	 *
+	 * @param bytes Memory to charge.
+	 * @param held Bytes the connection has buffered already.
+	 * @return false if it isn't, and nothing was charged
+	 */
+	bool try_charge(size_t bytes, size_t held);
+
+	/**
+	 * Charges memory to the budget whether or not it fits.
+	 */
+	void charge(size_t bytes);
+
+	/**
+	 * Gives back memory charged earlier.
+	 */
+	void release(size_t bytes);
+
+	/**
+	 * Counts a connection in (or out of) the fair share.
+	 */
+	void add_connection();
+	void remove_connection();
+
+private:
+	MemoryBudget();
+
+	std::atomic<size_t> limit;
+	std::atomic<size_t> used;
+	std::atomic<int> connections;
+
+	/*
+	 * allowance() given a value of used, so try_charge() can check the
+	 * value its compare-and-swap expects.
+	 */
+	size_t allowance(size_t held, size_t used);
+};
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ * File: MulticastReceiver.cpp
+ *
+ * Receiving side of the reliable multicast distribution mode.
+ *
+ */
+
+// C++ library includes
+#include <iostream>
+
+//OS specific includes
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <cerrno>
+
+#include "MulticastReceiver.h"
+#include "rdt_fec.h"
+#include "rdt_time.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the MulticastReceiver header file
+*/
+
+MulticastReceiver::MulticastReceiver(const char *group, int port_num, const char *interface) {
+	this->sender_known = false;
+	memset(&this->sender_addr, 0, sizeof(this->sender_addr));
+
+	this->next_deliver = 0;
+	this->seen_limit = 0;
+	this->total_known = false;
+	this->total = 0;
+	this->failed = false;
+
+	this->fec_block = 0;
+	this->nack_backoff = DEFAULT_NACK_BACKOFF;
+	this->idle_timeout = DEFAULT_IDLE_TIMEOUT;
+	this->nack_rounds = 0;
+	this->received_at_last_nack = 0;
+	this->nack_count = 0;
+	this->recovered_count = 0;
+
+	// Receivers must not NACK in lockstep
+	this->random.seed(monotonic_usec() ^ getpid());
+
+	this->sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (this->sock_fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	// Let other receivers on this host bind the same port
+	int reuse = 1;
+	if (setsockopt(this->sock_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0) {
+		perror("setsockopt");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port_num);
+	addr.sin_addr.s_addr = INADDR_ANY;
+	if (bind(this->sock_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		perror("bind");
+		exit(EXIT_FAILURE);
+	}
+
+	struct ip_mreq membership;
+	membership.imr_multiaddr.s_addr = inet_addr(group);
+	membership.imr_interface.s_addr = inet_addr(interface);
+	if (setsockopt(this->sock_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership,
+			sizeof(membership)) < 0) {
+		perror("IP_ADD_MEMBERSHIP");
+		exit(EXIT_FAILURE);
+	}
+}
+
+MulticastReceiver::~MulticastReceiver() {
+	if (close(this->sock_fd) < 0) {
+		perror("MulticastReceiver close");
+	}
+}
+
+void MulticastReceiver::set_nack_backoff(int backoff_ms) {
+	this->nack_backoff = backoff_ms;
+}
+
+void MulticastReceiver::set_idle_timeout(int timeout_ms) {
+	this->idle_timeout = timeout_ms;
+}
+
+int MulticastReceiver::receive_data(char buffer[MAX_DATA_SIZE]) {
+	for (;;) {
+		auto next = this->pending.begin();
+		if (next != this->pending.end() && next->first == this->next_deliver) {
+			int length = next->second.size();
+			memcpy(buffer, next->second.data(), length);
+			this->pending.erase(next);
+			this->next_deliver++;
+
+			// Blocks that have been delivered can't need parity anymore
+			while (!this->blocks.empty() &&
+					this->blocks.begin()->first + this->fec_block <= this->next_deliver) {
+				this->blocks.erase(this->blocks.begin());
+			}
+			return length;
+		}
+
+		if (this->total_known && this->next_deliver == this->total) {
+			return 0;
+		}
+		if (this->failed) {
+			return -1;
+		}
+		this->pump();
+	}
+}
+
+int MulticastReceiver::get_nack_count() {
+	return this->nack_count;
+}
+
+int MulticastReceiver::get_recovered_count() {
+	return this->recovered_count;
+}
+
+void MulticastReceiver::pump() {
+	// Wait no longer than the next timer (rounded up so it has expired)
+	int64_t wait = this->timers.time_until_next(monotonic_msec());
+	struct pollfd pfd;
+	pfd.fd = this->sock_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, wait < 0 ? -1 : (int)wait + 1) < 0 && errno != EINTR) {
+		perror("poll");
+		exit(EXIT_FAILURE);
+	}
+
+	char segment[ReliableSocket::MAX_SEG_SIZE];
+	struct sockaddr_in fromaddr;
+	socklen_t addrlen = sizeof(fromaddr);
+	int recv_count;
+	while ((recv_count = recvfrom(this->sock_fd, segment, sizeof(segment), MSG_DONTWAIT,
+			(struct sockaddr*)&fromaddr, &addrlen)) >= 0) {
+		if (!this->sender_known) {
+			// NACKs go back to whoever sends to the group
+			this->sender_known = true;
+			this->sender_addr = fromaddr;
+		}
+		if (fromaddr.sin_addr.s_addr == this->sender_addr.sin_addr.s_addr &&
+				fromaddr.sin_port == this->sender_addr.sin_port) {
+			this->process_segment(segment, recv_count);
+		}
+		addrlen = sizeof(fromaddr);
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		perror("multicast recvfrom");
+	}
+
+	uint64_t now = monotonic_msec();
+	int timer_id;
+	while ((timer_id = this->timers.pop_expired(now)) >= 0) {
+		if (timer_id == TIMER_NACK) {
+			this->send_nack();
+		} else if (timer_id == TIMER_IDLE) {
+			cerr << "ERROR: Nothing heard from the sender for " << this->idle_timeout << " ms\n";
+			this->failed = true;
+		}
+	}
+}
+
+void MulticastReceiver::process_segment(char *seg, int seg_size) {
+	if (seg_size < (int)sizeof(RDTHeader)) {
+		return;
+	}
+
+	RDTHeader *hdr = (RDTHeader*)seg;
+	uint32_t seq_num = ntohl(hdr->sequence_number);
+	uint32_t ack_num = ntohl(hdr->ack_number);
+	char *data = (char*)(hdr + 1);
+	int data_size = seg_size - sizeof(RDTHeader);
+
+	if (hdr->type == RDT_MCAST_DATA) {
+		if (this->fec_block == 0 && ack_num > 0 && ack_num <= 0xffff) {
+			// ack_number is the sender's FEC block size
+			this->fec_block = ack_num;
+		}
+		this->accept_data(seq_num, data, data_size);
+	} else if (hdr->type == RDT_MCAST_PARITY) {
+		this->process_parity(seq_num, ack_num, data, data_size);
+	} else if (hdr->type == RDT_MCAST_CLOSE) {
+		if (!this->total_known) {
+			cerr << "INFO: Sender finished after " << seq_num << " segments\n";
+			this->total_known = true;
+			this->total = seq_num;
+		}
+	} else {
+		return;
+	}
+
+	this->timers.schedule(TIMER_IDLE, monotonic_msec() + this->idle_timeout);
+	if (this->missing_data()) {
+		this->schedule_nack(0);
+	} else {
+		this->timers.cancel(TIMER_NACK);
+		this->nack_rounds = 0;
+	}
+}
+
+void MulticastReceiver::accept_data(uint32_t seq_num, const char *data, int length) {
+	if (seq_num < this->next_deliver || this->pending.count(seq_num) > 0) {
+		// Repair for some other receiver
+		return;
+	}
+	if (seq_num - this->next_deliver >= (uint32_t)WINDOW_SEGMENTS) {
+		// Too far ahead to buffer; it gets NACKed once there is room
+		return;
+	}
+
+	this->pending[seq_num] = std::vector<char>(data, data + length);
+	if (seq_num >= this->seen_limit) {
+		this->seen_limit = seq_num + 1;
+	}
+
+	if (this->fec_block > 0) {
+		BlockParity &block = this->blocks[seq_num - seq_num % this->fec_block];
+		if (block.data.empty()) {
+			block.data.resize(MAX_DATA_SIZE);
+			block.length_xor = 0;
+			block.received = 0;
+		}
+		fec_xor(block.data.data(), data, length);
+		block.length_xor ^= length;
+		block.received++;
+	}
+}
+
+void MulticastReceiver::process_parity(uint32_t block_start, uint32_t packed,
+		const char *parity, int parity_size) {
+	int count, length_xor;
+	fec_unpack_block(packed, &count, &length_xor);
+	if (this->fec_block == 0 || block_start + count <= this->next_deliver ||
+			parity_size > MAX_DATA_SIZE) {
+		return;
+	}
+
+	// Parity only helps if exactly one segment of the block is missing
+	auto block = this->blocks.find(block_start);
+	int received = block == this->blocks.end() ? 0 : block->second.received;
+	if (received != count - 1) {
+		return;
+	}
+
+	uint32_t missing = block_start;
+	while (missing < block_start + count &&
+			(missing < this->next_deliver || this->pending.count(missing) > 0)) {
+		missing++;
+	}
+
+	char data[MAX_DATA_SIZE];
+	memset(data, 0, sizeof(data));
+	memcpy(data, parity, parity_size);
+	if (block != this->blocks.end()) {
+		fec_xor(data, block->second.data.data(), MAX_DATA_SIZE);
+		length_xor ^= block->second.length_xor;
+	}
+	if (length_xor <= 0 || length_xor > MAX_DATA_SIZE) {
+		return;
+	}
+
+	this->accept_data(missing, data, length_xor);
+	this->recovered_count++;
+}
+
+bool MulticastReceiver::missing_data() {
+	uint32_t limit = this->total_known ? this->total : this->seen_limit;
+	return this->pending.size() < limit - this->next_deliver;
+}
+
+void MulticastReceiver::schedule_nack(int min_delay) {
+	if (this->timers.is_scheduled(TIMER_NACK)) {
+		return;
+	}
+	int delay = min_delay + this->random() % (this->nack_backoff + 1);
+	this->timers.schedule(TIMER_NACK, monotonic_msec() + delay);
+}
+
+void MulticastReceiver::send_nack() {
+	if (!this->sender_known || !this->missing_data()) {
+		this->nack_rounds = 0;
+		return;
+	}
+
+	// Give up once NACKs stop bringing anything, e.g. because the sender
+	// no longer has the data
+	uint32_t received = this->next_deliver + this->pending.size();
+	if (received == this->received_at_last_nack) {
+		if (++this->nack_rounds >= MAX_NACK_ROUNDS) {
+			cerr << "ERROR: Missing data was not repaired after " << this->nack_rounds
+				<< " NACKs\n";
+			this->failed = true;
+			return;
+		}
+	} else {
+		this->nack_rounds = 0;
+	}
+	this->received_at_last_nack = received;
+
+	// List the gaps between the segments we have, as many as fit
+	char segment[ReliableSocket::MAX_SEG_SIZE];
+	RDTHeader *hdr = (RDTHeader*)segment;
+	uint32_t *ranges = (uint32_t*)(hdr + 1);
+	const int max_ranges = MAX_DATA_SIZE / (2 * sizeof(uint32_t));
+	int range_count = 0;
+
+	uint32_t limit = this->total_known ? this->total : this->seen_limit;
+	uint32_t seq_num = this->next_deliver;
+	for (auto it = this->pending.begin(); range_count < max_ranges; ++it) {
+		uint32_t next = (it == this->pending.end() || it->first >= limit) ? limit : it->first;
+		if (next > seq_num) {
+			ranges[2 * range_count] = htonl(seq_num);
+			ranges[2 * range_count + 1] = htonl(next - seq_num);
+			range_count++;
+		}
+		if (next == limit) {
+			break;
+		}
+		seq_num = next + 1;
+	}
+
+	memset(hdr, 0, sizeof(RDTHeader));
+	hdr->sequence_number = htonl(this->next_deliver);
+	hdr->ack_number = htonl(range_count);
+	hdr->type = RDT_MCAST_NACK;
+	int seg_size = sizeof(RDTHeader) + range_count * 2 * sizeof(uint32_t);
+	if (sendto(this->sock_fd, segment, seg_size, 0, (struct sockaddr*)&this->sender_addr,
+			sizeof(this->sender_addr)) < 0) {
+		perror("NACK sendto");
+	}
+	this->nack_count++;
+
+	// NACK again if the repairs are lost too
+	this->schedule_nack(NACK_RETRY);
+}
@@ -0,0 +1,158 @@
+/*
+ * File: MulticastReceiver.h
+ *
+ * Header / API file for the receiving side of the reliable multicast
+ * distribution mode.
+ *
+ */
+#ifndef MULTICAST_RECEIVER_H
+#define MULTICAST_RECEIVER_H
+
+#include <cstdint>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "ReliableSocket.h"
+#include "rdt_timer.h"
+
+/**
+ * Receives the stream a MulticastSender sends to a multicast group and
+ * delivers it in order.
+ *
+ * When segments go missing, the receiver waits a random time (up to the
+ * NACK backoff) before NACKing them. If the sender repairs them for
+ * another receiver meanwhile, the NACK is never sent, so a loss that many
+ * receivers share doesn't flood the sender with NACKs. Several receivers
+ * may run on one host and port.
+ */
+class MulticastReceiver {
+public:
+	static const int MAX_DATA_SIZE = ReliableSocket::MAX_DATA_SIZE;
+	static const int DEFAULT_NACK_BACKOFF = 20; // ms, upper bound of the random NACK delay
+	static const int NACK_RETRY = 100; // ms before NACKing the same loss again
+	static const int MAX_NACK_ROUNDS = 30; // NACKs without progress before giving up
+	static const int WINDOW_SEGMENTS = 8192; // segments buffered past a loss
+	static const int DEFAULT_IDLE_TIMEOUT = 10000; // ms without data before giving up
+
+	/**
+	 * Joins a multicast group.
+	 *
+	 * @param group IPv4 multicast address of the group.
+	 * @param port_num Port the sender sends to.
+	 * @param interface Address of the local interface to join on (e.g.
+	 * 		127.0.0.1 to test on one host), or 0.0.0.0 for the default.
+	 */
+	MulticastReceiver(const char *group, int port_num, const char *interface = "0.0.0.0");
+
+	~MulticastReceiver();
+
+	/**
+	 * Sets the upper bound of the random delay before NACKing a loss.
+	 * Larger values suppress more duplicate NACKs among many receivers.
+	 */
+	void set_nack_backoff(int backoff_ms);
+
+	/**
+	 * Sets how long to wait for the sender, once it has been heard from,
+	 * before giving up.
+	 */
+	void set_idle_timeout(int timeout_ms);
+
+	/**
+	 * Receives the next segment of data in order.
+	 *
+	 * @param buffer The buffer where received data will be stored.
+	 * @return The amount of data received, 0 once the sender has finished
+	 * 		and everything was received, or -1 if data was lost for good.
+	 */
+	int receive_data(char buffer[MAX_DATA_SIZE]);
+
+	/**
+	 * Returns the number of NACKs sent.
+	 */
+	int get_nack_count();
+
+	/**
+	 * Returns the number of segments rebuilt from parity.
+	 */
+	int get_recovered_count();
+
+private:
+	enum timer_id { TIMER_NACK, TIMER_IDLE };
+
+	// XOR of the data received so far from one FEC block
+	struct BlockParity {
+		std::vector<char> data;
+		int length_xor;
+		int received;
+	};
+
+	int sock_fd;
+	bool sender_known;
+	struct sockaddr_in sender_addr;
+
+	// Next segment to deliver, and one past the highest segment seen
+	uint32_t next_deliver;
+	uint32_t seen_limit;
+	bool total_known;
+	uint32_t total;
+	bool failed;
+
+	// Segments that arrived but can't be delivered yet
+	std::map<uint32_t, std::vector<char>> pending;
+
+	int fec_block;
+	std::map<uint32_t, BlockParity> blocks;
+
+	int nack_backoff;
+	int idle_timeout;
+	int nack_rounds;
+	uint32_t received_at_last_nack;
+	int nack_count;
+	int recovered_count;
+
+	TimerQueue timers;
+	std::minstd_rand random;
+
+	/*
+	 * Waits for segments and timers and handles them.
+	 */
+	void pump();
+
+	/*
+	 * Acts on one segment from the sender.
+	 */
+	void process_segment(char *seg, int seg_size);
+
+	/*
+	 * Buffers one data segment (received or rebuilt).
+	 */
+	void accept_data(uint32_t seq_num, const char *data, int length);
+
+	/*
+	 * Rebuilds the missing segment of a block from its parity, if only
+	 * one is missing.
+	 */
+	void process_parity(uint32_t block_start, uint32_t packed, const char *parity,
+			int parity_size);
+
+	/*
+	 * Checks whether any segment before seen_limit (or total) is missing.
+	 */
+	bool missing_data();
+
+	/*
+	 * Arms the NACK timer with a random delay, unless it is armed.
+	 */
+	void schedule_nack(int min_delay);
+
+	/*
+	 * NACKs the ranges of segments that are still missing.
+	 */
+	void send_nack();
+};
+
+#endif
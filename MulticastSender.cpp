@@ -0,0 +1,367 @@
+/*
+ * File: MulticastSender.cpp
+ *
+ * Sending side of the reliable multicast distribution mode.
+ *
+ */
+
+// C++ library includes
+#include <iostream>
+
+//OS specific includes
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <cstring>
+#include <cerrno>
+
+#include "MulticastSender.h"
+#include "rdt_fec.h"
+#include "rdt_time.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the MulticastSender header file
+*/
+
+MulticastSender::MulticastSender(const char *group, int port_num, const char *interface,
+		int ttl) {
+	this->rate = DEFAULT_RATE;
+	this->fec_block = 0;
+	this->linger = DEFAULT_LINGER;
+	this->history_size = DEFAULT_HISTORY_SEGMENTS;
+
+	this->next_seq = 0;
+	this->next_send_usec = 0;
+	this->finishing = false;
+	this->last_nack = 0;
+	this->repair_count = 0;
+
+	this->history.resize((size_t)this->history_size * MAX_DATA_SIZE);
+	this->history_length.resize(this->history_size);
+	this->last_repaired.resize(this->history_size);
+
+	this->sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (this->sock_fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&this->group_addr, 0, sizeof(this->group_addr));
+	this->group_addr.sin_family = AF_INET;
+	this->group_addr.sin_addr.s_addr = inet_addr(group);
+	this->group_addr.sin_port = htons(port_num);
+
+	// Receivers on this host (e.g. when testing over loopback) need their
+	// own copy of what we send
+	struct in_addr iface;
+	iface.s_addr = inet_addr(interface);
+	unsigned char hops = ttl;
+	unsigned char loop = 1;
+	if (setsockopt(this->sock_fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) < 0 ||
+			setsockopt(this->sock_fd, IPPROTO_IP, IP_MULTICAST_TTL, &hops, sizeof(hops)) < 0 ||
+			setsockopt(this->sock_fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0) {
+		perror("multicast setsockopt");
+		exit(EXIT_FAILURE);
+	}
+}
+
+MulticastSender::~MulticastSender() {
+	if (close(this->sock_fd) < 0) {
+		perror("MulticastSender close");
+	}
+}
+
+void MulticastSender::set_rate(int bytes_per_sec) {
+	if (bytes_per_sec > 0) {
+		this->rate = bytes_per_sec;
+	}
+}
+
+void MulticastSender::set_fec(int block_size) {
+	if (this->next_seq > 0) {
+		cerr << "ERROR: FEC must be set before sending data\n";
+		return;
+	}
+	if (block_size < 0 || block_size > 0xffff) {
+		cerr << "ERROR: Invalid FEC block size " << block_size << "\n";
+		return;
+	}
+	this->fec_block = block_size;
+}
+
+void MulticastSender::set_linger(int linger_ms) {
+	this->linger = linger_ms;
+}
+
+void MulticastSender::send_data(const void *buffer, int length) {
+	if (this->finishing) {
+		cerr << "ERROR: Cannot send after finish()\n";
+		return;
+	}
+	if (length <= 0 || length > MAX_DATA_SIZE) {
+		cerr << "ERROR: Multicast data must be 1 to " << MAX_DATA_SIZE << " bytes\n";
+		return;
+	}
+
+	// Wait for our turn, answering NACKs meanwhile
+	this->service(this->next_send_usec);
+
+	uint32_t slot = this->next_seq % this->history_size;
+	memcpy(&this->history[(size_t)slot * MAX_DATA_SIZE], buffer, length);
+	this->history_length[slot] = length;
+	this->last_repaired[slot] = 0;
+
+	// ack_number tells receivers the FEC block size
+	this->transmit(RDT_MCAST_DATA, this->next_seq, this->fec_block, (const char*)buffer, length);
+	this->next_seq++;
+}
+
+void MulticastSender::finish() {
+	this->finishing = true;
+
+	// The RDT_MCAST_CLOSE tells receivers how many segments there are, so
+	// they can NACK losses at the very end. It is repeated in case it is
+	// lost too.
+	this->transmit(RDT_MCAST_CLOSE, this->next_seq, 0, NULL, 0);
+	this->timers.schedule(TIMER_CLOSE, monotonic_msec() + CLOSE_INTERVAL);
+
+	// Receivers never say they are done, so keep repairing until none has
+	// asked for anything in a while
+	this->last_nack = monotonic_msec();
+	while (monotonic_msec() - this->last_nack < (uint64_t)this->linger ||
+			this->timers.is_scheduled(TIMER_REPAIR)) {
+		this->service(monotonic_usec() + (uint64_t)CLOSE_INTERVAL * 1000);
+	}
+	this->timers.cancel(TIMER_CLOSE);
+}
+
+uint32_t MulticastSender::get_segment_count() {
+	return this->next_seq;
+}
+
+int MulticastSender::get_repair_count() {
+	return this->repair_count;
+}
+
+void MulticastSender::service(uint64_t until_usec) {
+	for (;;) {
+		uint64_t now_ms = monotonic_msec();
+		int timer_id;
+		while ((timer_id = this->timers.pop_expired(now_ms)) >= 0) {
+			if (timer_id == TIMER_REPAIR) {
+				this->send_repairs();
+			} else if (timer_id == TIMER_CLOSE) {
+				this->transmit(RDT_MCAST_CLOSE, this->next_seq, 0, NULL, 0);
+				this->timers.schedule(TIMER_CLOSE, now_ms + CLOSE_INTERVAL);
+			}
+		}
+
+		// Handle every NACK that has arrived
+		char segment[ReliableSocket::MAX_SEG_SIZE];
+		int recv_count;
+		while ((recv_count = recv(this->sock_fd, segment, sizeof(segment), MSG_DONTWAIT)) >= 0) {
+			RDTHeader *hdr = (RDTHeader*)segment;
+			if (recv_count >= (int)sizeof(RDTHeader) && hdr->type == RDT_MCAST_NACK) {
+				this->process_nack(segment, recv_count);
+			}
+		}
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+			perror("multicast recv");
+		}
+
+		uint64_t now = monotonic_usec();
+		if (now >= until_usec) {
+			return;
+		}
+
+		// Sleep until a NACK arrives, a timer expires, or until_usec
+		uint64_t wait = until_usec - now;
+		int64_t timer_wait = this->timers.time_until_next(monotonic_msec());
+		if (timer_wait >= 0 && (uint64_t)timer_wait * 1000 < wait) {
+			wait = timer_wait * 1000;
+		}
+		struct pollfd pfd;
+		pfd.fd = this->sock_fd;
+		pfd.events = POLLIN;
+		struct timespec timeout;
+		timeout.tv_sec = wait / 1000000;
+		timeout.tv_nsec = (wait % 1000000) * 1000;
+		if (ppoll(&pfd, 1, &timeout, NULL) < 0 && errno != EINTR) {
+			perror("ppoll");
+			exit(EXIT_FAILURE);
+		}
+	}
+}
+
+void MulticastSender::transmit(RDTMessageType type, uint32_t seq_num, uint32_t ack_num,
+		const char *data, int length) {
+	char segment[ReliableSocket::MAX_SEG_SIZE];
+	RDTHeader *hdr = (RDTHeader*)segment;
+	memset(hdr, 0, sizeof(RDTHeader));
+	hdr->sequence_number = htonl(seq_num);
+	hdr->ack_number = htonl(ack_num);
+	hdr->type = type;
+	if (length > 0) {
+		memcpy(hdr + 1, data, length);
+	}
+
+	int seg_size = sizeof(RDTHeader) + length;
+	if (sendto(this->sock_fd, segment, seg_size, 0, (struct sockaddr*)&this->group_addr,
+			sizeof(this->group_addr)) < 0) {
+		// A full queue is just another loss for the receivers to NACK
+		if (errno != ENOBUFS && errno != EAGAIN) {
+			perror("multicast sendto");
+		}
+	}
+
+	// Repairs share the rate with new data
+	uint64_t now = monotonic_usec();
+	if (this->next_send_usec < now) {
+		this->next_send_usec = now;
+	}
+	this->next_send_usec += (uint64_t)seg_size * 1000000 / this->rate;
+}
+
+void MulticastSender::process_nack(char *seg, int seg_size) {
+	RDTHeader *hdr = (RDTHeader*)seg;
+	uint32_t *ranges = (uint32_t*)(hdr + 1);
+	int range_count = (seg_size - sizeof(RDTHeader)) / (2 * sizeof(uint32_t));
+	this->last_nack = monotonic_msec();
+
+	// How many segments of each block this receiver lost
+	std::map<uint32_t, int> lost_in_block;
+	bool too_old = false;
+	for (int i = 0; i < range_count; i++) {
+		uint32_t start = ntohl(ranges[2 * i]);
+		uint32_t count = ntohl(ranges[2 * i + 1]);
+		if (count > (uint32_t)this->history_size) {
+			count = this->history_size;
+		}
+
+		for (uint32_t k = 0; k < count; k++) {
+			uint32_t seq_num = start + k;
+			if (!this->in_history(seq_num)) {
+				too_old |= (int32_t)(seq_num - this->next_seq) < 0;
+				continue;
+			}
+			uint32_t block = this->block_of(seq_num);
+			this->repair_requests[block].insert(seq_num);
+			lost_in_block[block]++;
+		}
+	}
+
+	for (auto &lost : lost_in_block) {
+		if (lost.second > 1) {
+			this->needs_data_repair.insert(lost.first);
+		}
+	}
+	if (too_old) {
+		cerr << "WARNING: A receiver NACKed segments that are no longer in the history\n";
+	}
+
+	// Wait a little so NACKs from other receivers can share the repairs
+	if (!this->repair_requests.empty() && !this->timers.is_scheduled(TIMER_REPAIR)) {
+		this->timers.schedule(TIMER_REPAIR, monotonic_msec() + REPAIR_AGGREGATION);
+	}
+}
+
+void MulticastSender::send_repairs() {
+	uint64_t now = monotonic_msec();
+
+	for (auto &request : this->repair_requests) {
+		uint32_t block = request.first;
+
+		// Every receiver lost at most one segment of the block, so the
+		// parity repairs all of them at once
+		if (this->fec_block > 0 && this->needs_data_repair.count(block) == 0) {
+			auto sent = this->parity_sent.find(block);
+			if (sent != this->parity_sent.end() && now - sent->second < REPAIR_HOLDOFF) {
+				continue;
+			}
+			if (this->send_parity(block)) {
+				this->parity_sent[block] = now;
+				continue;
+			}
+		}
+
+		for (uint32_t seq_num : request.second) {
+			if (!this->in_history(seq_num)) {
+				continue;
+			}
+			// Several receivers NACKing the same loss get one repair
+			uint32_t slot = seq_num % this->history_size;
+			if (this->last_repaired[slot] != 0 && now - this->last_repaired[slot] < REPAIR_HOLDOFF) {
+				continue;
+			}
+			this->transmit(RDT_MCAST_DATA, seq_num, this->fec_block,
+					&this->history[(size_t)slot * MAX_DATA_SIZE], this->history_length[slot]);
+			this->last_repaired[slot] = now;
+			this->repair_count++;
+		}
+	}
+
+	this->repair_requests.clear();
+	this->needs_data_repair.clear();
+	for (auto it = this->parity_sent.begin(); it != this->parity_sent.end(); ) {
+		if (this->in_history(it->first)) {
+			++it;
+		} else {
+			it = this->parity_sent.erase(it);
+		}
+	}
+}
+
+bool MulticastSender::send_parity(uint32_t block_start) {
+	int count = this->block_count(block_start);
+	if (count == 0) {
+		return false;
+	}
+
+	char parity[MAX_DATA_SIZE];
+	memset(parity, 0, sizeof(parity));
+	int parity_size = 0;
+	int length_xor = 0;
+	for (int i = 0; i < count; i++) {
+		uint32_t slot = (block_start + i) % this->history_size;
+		int length = this->history_length[slot];
+		fec_xor(parity, &this->history[(size_t)slot * MAX_DATA_SIZE], length);
+		length_xor ^= length;
+		if (length > parity_size) {
+			parity_size = length;
+		}
+	}
+
+	this->transmit(RDT_MCAST_PARITY, block_start, fec_pack_block(count, length_xor),
+			parity, parity_size);
+	this->repair_count++;
+	return true;
+}
+
+bool MulticastSender::in_history(uint32_t seq_num) {
+	uint32_t age = this->next_seq - seq_num;
+	return age >= 1 && age <= (uint32_t)this->history_size;
+}
+
+uint32_t MulticastSender::block_of(uint32_t seq_num) {
+	return this->fec_block > 0 ? seq_num - seq_num % this->fec_block : seq_num;
+}
+
+int MulticastSender::block_count(uint32_t block_start) {
+	if (this->fec_block == 0 || !this->in_history(block_start)) {
+		return 0;
+	}
+
+	uint32_t sent = this->next_seq - block_start;
+	if (sent >= (uint32_t)this->fec_block) {
+		return this->fec_block;
+	}
+	// The last block is short, but only once we know nothing follows it
+	return this->finishing ? sent : 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * File: MulticastSender.h
+ *
+ * Header / API file for the sending side of the reliable multicast
+ * distribution mode.
+ *
+ */
+#ifndef MULTICAST_SENDER_H
+#define MULTICAST_SENDER_H
+
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "ReliableSocket.h"
+#include "rdt_timer.h"
+
+/**
+ * Sends one stream of data to every receiver in a multicast group, so the
+ * data crosses the network once no matter how many receivers there are.
+ *
+ * Reliability is NACK-based (like NORM): receivers never acknowledge what
+ * they get, they unicast an RDT_MCAST_NACK listing the ranges of segments
+ * they are missing. The sender collects NACKs for a short while and then
+ * multicasts each requested segment once, so one repair serves every
+ * receiver that lost it. With FEC enabled, a block in which each receiver
+ * lost at most one segment is repaired with a single parity segment
+ * instead (see rdt_fec.h).
+ *
+ * There is no congestion control: data is paced at a fixed rate. Repairs
+ * come from a history of the most recent segments, so a receiver that
+ * falls further behind than the history cannot recover.
+ */
+class MulticastSender {
+public:
+	static const int MAX_DATA_SIZE = ReliableSocket::MAX_DATA_SIZE;
+	static const int DEFAULT_RATE = 4000000; // bytes per second
+	static const int DEFAULT_HISTORY_SEGMENTS = 8192; // segments kept for repairs
+	static const int DEFAULT_LINGER = 2000; // ms without NACKs before finishing
+	static const int REPAIR_AGGREGATION = 10; // ms to collect NACKs before repairing
+	static const int REPAIR_HOLDOFF = 30; // ms before repairing a segment again
+	static const int CLOSE_INTERVAL = 100; // ms between end-of-data announcements
+
+	/**
+	 * Creates a sender for a multicast group.
+	 *
+	 * @param group IPv4 multicast address of the group.
+	 * @param port_num Port the receivers listen on.
+	 * @param interface Address of the local interface to send on (e.g.
+	 * 		127.0.0.1 to test on one host), or 0.0.0.0 for the default.
+	 * @param ttl Number of router hops the data may cross.
+	 */
+	MulticastSender(const char *group, int port_num, const char *interface = "0.0.0.0",
+			int ttl = 1);
+
+	~MulticastSender();
+
+	/**
+	 * Sets the rate (in bytes per second) data and repairs are sent at.
+	 */
+	void set_rate(int bytes_per_sec);
+
+	/**
+	 * Enables parity repairs over blocks of the given number of segments (0
+	 * disables them).
+	 */
+	void set_fec(int block_size);
+
+	/**
+	 * Sets how long finish() keeps answering NACKs after the last one.
+	 */
+	void set_linger(int linger_ms);
+
+	/**
+	 * Multicasts one segment of data, answering NACKs while waiting for its
+	 * turn under the rate limit.
+	 *
+	 * @param buffer The data to send.
+	 * @param length The size of the data (1 to MAX_DATA_SIZE bytes).
+	 */
+	void send_data(const void *buffer, int length);
+
+	/**
+	 * Announces the end of the data and repairs whatever receivers are
+	 * still missing until none has NACKed for the linger time.
+	 */
+	void finish();
+
+	/**
+	 * Returns the number of data segments sent (not counting repairs).
+	 */
+	uint32_t get_segment_count();
+
+	/**
+	 * Returns the number of repair segments sent (data and parity).
+	 */
+	int get_repair_count();
+
+private:
+	enum timer_id { TIMER_REPAIR, TIMER_CLOSE };
+
+	int sock_fd;
+	struct sockaddr_in group_addr;
+
+	int rate;
+	int fec_block;
+	int linger;
+	int history_size;
+
+	// Sequence number of the next data segment
+	uint32_t next_seq;
+	// When the rate limit allows the next segment to go out
+	uint64_t next_send_usec;
+	bool finishing;
+	uint64_t last_nack;
+	int repair_count;
+
+	// Most recent segments, indexed by sequence number modulo history_size
+	std::vector<char> history;
+	std::vector<int> history_length;
+	std::vector<uint64_t> last_repaired;
+
+	// Segments NACKed since the last round of repairs, by block (the
+	// block is the segment itself without FEC)
+	std::map<uint32_t, std::set<uint32_t>> repair_requests;
+	// Blocks some receiver lost more than one segment of, so parity
+	// can't repair them
+	std::set<uint32_t> needs_data_repair;
+	std::map<uint32_t, uint64_t> parity_sent;
+
+	TimerQueue timers;
+
+	/*
+	 * Handles NACKs and timers until the given monotonic time.
+	 */
+	void service(uint64_t until_usec);
+
+	/*
+	 * Multicasts one segment and charges it to the rate limit.
+	 */
+	void transmit(RDTMessageType type, uint32_t seq_num, uint32_t ack_num,
+			const char *data, int length);
+
+	/*
+	 * Records the ranges listed in a received RDT_MCAST_NACK.
+	 */
+	void process_nack(char *seg, int seg_size);
+
+	/*
+	 * Sends the repairs requested since the last round.
+	 */
+	void send_repairs();
+
+	/*
+	 * Sends the parity of a block. Returns false if it can't be built.
+	 */
+	bool send_parity(uint32_t block_start);
+
+	/*
+	 * Checks whether a segment is still in the history.
+	 */
+	bool in_history(uint32_t seq_num);
+
+	/*
+	 * Returns the first segment of the block a segment belongs to.
+	 */
+	uint32_t block_of(uint32_t seq_num);
+
+	/*
+	 * Returns the number of segments in a block that have been sent, or 0
+	 * if it can't be repaired with parity (yet).
+	 */
+	int block_count(uint32_t block_start);
+};
+
+#endif
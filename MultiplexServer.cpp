@@ -0,0 +1,273 @@
+/*
+ * File: MultiplexServer.cpp
+ *
+ * Server that receives any number of RDT connections over one UDP socket.
+ *
+ */
+
+// C++ library includes
+#include <iostream>
+
+//OS specific includes
+#include <unistd.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <endian.h>
+
+#include <cstring>
+#include <cerrno>
+
+#include "MultiplexServer.h"
+#include "rdt_hash.h"
+#include "rdt_time.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the MultiplexServer header file
+*/
+
+MultiplexServer::MultiplexServer(int port_num, DataHandler on_data, CloseHandler on_close)
+		: on_data(std::move(on_data)), on_close(std::move(on_close)) {
+	this->close_hash = htobe64(StreamHash().digest());
+
+	this->sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (this->sock_fd < 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port_num);
+	addr.sin_addr.s_addr = INADDR_ANY;
+	if (bind(this->sock_fd, (struct sockaddr*)&addr, sizeof(addr))) {
+		perror("bind");
+		exit(EXIT_FAILURE);
+	}
+}
+
+MultiplexServer::~MultiplexServer() {
+	if (close(this->sock_fd) < 0) {
+		perror("multiplex close");
+	}
+}
+
+void MultiplexServer::handle_events(int timeout_ms) {
+	struct pollfd pfd;
+	pfd.fd = this->sock_fd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, 1, timeout_ms) < 0 && errno != EINTR) {
+		perror("poll");
+		exit(EXIT_FAILURE);
+	}
+
+	uint64_t now = monotonic_msec();
+	char segment[ReliableSocket::MAX_WIRE_SIZE];
+	struct sockaddr_in fromaddr;
+	socklen_t addrlen = sizeof(fromaddr);
+	int recv_count;
+	while ((recv_count = recvfrom(this->sock_fd, segment, sizeof(segment), MSG_DONTWAIT,
+			(struct sockaddr*)&fromaddr, &addrlen)) >= 0) {
+		this->process_segment(fromaddr, segment, recv_count, now);
+		addrlen = sizeof(fromaddr);
+	}
+	if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+		perror("multiplex recvfrom");
+	}
+
+	this->connections.collect_expired(now, this->expired);
+	for (int slot : this->expired) {
+		this->handle_timer(slot, now);
+	}
+}
+
+size_t MultiplexServer::connection_count() {
+	return this->connections.size();
+}
+
+size_t MultiplexServer::memory_usage() {
+	return this->connections.memory_usage();
+}
+
+void MultiplexServer::process_segment(const struct sockaddr_in &from, char *segment, int seg_size,
+		uint64_t now) {
+	if (seg_size < (int)sizeof(RDTHeader)) {
+		return;
+	}
+	RDTHeader *hdr = (RDTHeader*)segment;
+	uint64_t conn_id = ConnectionTable::peer_id(from);
+	int slot = this->connections.find(conn_id);
+
+	if (slot < 0) {
+		if (hdr->type == RDT_SYN) {
+			this->accept_syn(from, hdr, seg_size, now);
+		} else if (hdr->type == RDT_CLOSE) {
+			// The connection is gone, so the client's earlier RDT_CLOSE was
+			// received and only our ACK of it was lost
+			uint32_t seq_num = ntohl(hdr->sequence_number);
+			this->send_segment(from, RDT_ACK, seq_num, seq_num, 0, NULL, 0);
+		}
+		return;
+	}
+
+	switch (this->connections.state(slot)) {
+	case SYN_RECEIVED:
+		if (hdr->type == RDT_SYN) {
+			// Our SYNACK was dropped
+			this->send_synack(slot);
+			return;
+		}
+		// Anything else means the client got our SYNACK. If its ACK was
+		// dropped and data is now being sent, keep processing it.
+		this->connections.set_state(slot, ESTABLISHED);
+		this->connections.retries(slot) = 0;
+		break;
+	case CLOSING:
+		if (hdr->type == RDT_ACK && !(hdr->flags & RDT_FLAG_HANDSHAKE)) {
+			if (ntohl(hdr->ack_number) == this->connections.send_seq(slot)) {
+				// Our RDT_CLOSE was acknowledged, so both sides are done
+				this->connections.erase(conn_id);
+			}
+		} else if (hdr->type != RDT_ACK) {
+			// Our RDT_CLOSE, and the ACK it carries, must have been dropped
+			this->send_close(slot);
+		}
+		return;
+	default:
+		break;
+	}
+
+	this->connections.next_timer(slot) = now + IDLE_TIMEOUT;
+	if (hdr->type == RDT_DATA) {
+		this->process_data(slot, hdr, seg_size - sizeof(RDTHeader));
+	} else if (hdr->type == RDT_CLOSE) {
+		this->process_close(slot, hdr, now);
+	} else if (hdr->type == RDT_KEEPALIVE) {
+		// Answer the probe so the client knows we are alive
+		this->send_ack(slot);
+	}
+}
+
+void MultiplexServer::accept_syn(const struct sockaddr_in &from, RDTHeader *hdr, int seg_size,
+		uint64_t now) {
+	if (seg_size > (int)sizeof(RDTHeader)) {
+		// Carries a key share: the client wants encryption
+		cerr << "INFO: Ignored RDT_SYN asking for encryption\n";
+		return;
+	}
+
+	int slot = this->connections.insert(ConnectionTable::peer_id(from), from);
+	this->connections.set_state(slot, SYN_RECEIVED);
+	// The handshake reuses the client's first sequence number
+	this->connections.ack_seq(slot) = ntohl(hdr->sequence_number);
+	this->send_synack(slot);
+	this->schedule_retransmit(slot, now);
+}
+
+void MultiplexServer::process_data(int slot, RDTHeader *hdr, int data_size) {
+	if (ntohl(hdr->sequence_number) == this->connections.ack_seq(slot)) {
+		this->connections.ack_seq(slot)++;
+		this->on_data(this->connections.conn_id(slot), (const char*)(hdr + 1), data_size);
+	}
+	// Repeats our last ACK for anything else, so the client retransmits
+	// the segment we are missing without waiting for its timer
+	this->send_ack(slot);
+}
+
+void MultiplexServer::process_close(int slot, RDTHeader *hdr, uint64_t now) {
+	if (ntohl(hdr->sequence_number) != this->connections.ack_seq(slot)) {
+		// Some of the data before it is missing
+		this->send_ack(slot);
+		return;
+	}
+
+	this->connections.ack_seq(slot)++;
+	this->connections.set_state(slot, CLOSING);
+	this->connections.retries(slot) = 0;
+	this->on_close(this->connections.conn_id(slot), true);
+	this->send_close(slot);
+	this->schedule_retransmit(slot, now);
+}
+
+void MultiplexServer::handle_timer(int slot, uint64_t now) {
+	connection_status state = this->connections.state(slot);
+	if (state == ESTABLISHED) {
+		cerr << "INFO: Dropped connection that stopped responding\n";
+		this->drop(slot);
+		return;
+	}
+
+	if (this->connections.retries(slot) >= MAX_RETRIES) {
+		this->drop(slot);
+		return;
+	}
+	this->connections.retries(slot)++;
+	if (state == SYN_RECEIVED) {
+		this->send_synack(slot);
+	} else {
+		this->send_close(slot);
+	}
+	this->schedule_retransmit(slot, now);
+}
+
+void MultiplexServer::schedule_retransmit(int slot, uint64_t now) {
+	this->connections.next_timer(slot) = now +
+		((uint64_t)RETRANSMIT_TIMEOUT << this->connections.retries(slot));
+}
+
+void MultiplexServer::drop(int slot) {
+	uint64_t conn_id = this->connections.conn_id(slot);
+	if (this->connections.state(slot) == ESTABLISHED) {
+		this->on_close(conn_id, false);
+	}
+	this->connections.erase(conn_id);
+}
+
+void MultiplexServer::send_synack(int slot) {
+	this->send_segment(this->connections.peer(slot), RDT_SYNACK, this->connections.send_seq(slot),
+			0, 0, NULL, 0);
+}
+
+void MultiplexServer::send_close(int slot) {
+	this->send_segment(this->connections.peer(slot), RDT_CLOSE, this->connections.send_seq(slot),
+			this->connections.ack_seq(slot) - 1, RDT_FLAG_ACK, &this->close_hash,
+			sizeof(this->close_hash));
+}
+
+void MultiplexServer::send_ack(int slot) {
+	uint32_t ack_num = this->connections.ack_seq(slot) - 1;
+	this->send_segment(this->connections.peer(slot), RDT_ACK, ack_num, ack_num, 0, NULL, 0);
+}
+
+void MultiplexServer::send_segment(const struct sockaddr_in &to, RDTMessageType type,
+		uint32_t seq_num, uint32_t ack_num, uint8_t flags, const void *data, int length) {
+	RDTHeader hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.sequence_number = htonl(seq_num);
+	hdr.ack_number = htonl(ack_num);
+	hdr.type = type;
+	hdr.flags = flags;
+	hdr.window = htons(RECV_WINDOW);
+
+	struct iovec iov[2];
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void*)data;
+	iov[1].iov_len = length;
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = (void*)&to;
+	msg.msg_namelen = sizeof(to);
+	msg.msg_iov = iov;
+	msg.msg_iovlen = length > 0 ? 2 : 1;
+	if (sendmsg(this->sock_fd, &msg, 0) < 0) {
+		perror("multiplex sendmsg");
+	}
+}
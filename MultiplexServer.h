@@ -0,0 +1,158 @@
+/*
+ * File: MultiplexServer.h
+ *
+ * Header / API file for the server that receives any number of RDT
+ * connections over one UDP socket.
+ *
+ */
+#ifndef MULTIPLEX_SERVER_H
+#define MULTIPLEX_SERVER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "ConnectionTable.h"
+#include "ReliableSocket.h"
+
+/**
+ * Server end of many RDT connections sharing one UDP socket. Segments are
+ * demultiplexed by the address they come from, and each connection's
+ * protocol state (handshake and close progress, sequence numbers, its
+ * timer) lives in a slot of a ConnectionTable rather than in a
+ * ReliableSocket and kernel socket of its own. Clients are ordinary
+ * ReliableSockets calling connect_to_remote(), send_data() and
+ * close_connection().
+ *
+ * It only receives. Data is handed to the application as soon as it
+ * arrives in order and is acknowledged right away, so nothing is buffered
+ * per connection: a segment that arrives out of order is dropped and
+ * answered with a duplicate ACK, which lets the client fast retransmit the
+ * missing one. The small window it advertises limits what a loss costs.
+ * The client's RDT_CLOSE ends its stream; the server then closes its side
+ * and forgets the connection once the client acknowledges that.
+ * Encryption isn't supported, so a client that asks for it never gets an
+ * answer.
+ *
+ * Not thread-safe: one thread calls handle_events() in a loop.
+ */
+class MultiplexServer {
+public:
+	static const int RECV_WINDOW = 16; // segments advertised
+	static const int RETRANSMIT_TIMEOUT = 200; // ms before the first resend of a SYNACK or RDT_CLOSE
+	static const int MAX_RETRIES = 6; // resends (each after twice the wait) before giving up
+	static const int IDLE_TIMEOUT = 30000; // ms without a segment before a connection is dropped
+
+	/**
+	 * Called with each connection's data, in order.
+	 *
+	 * @param conn_id The connection (see ConnectionTable::peer_id()).
+	 */
+	typedef std::function<void(uint64_t conn_id, const char *data, int length)> DataHandler;
+
+	/**
+	 * Called once per established connection, when its client has finished
+	 * sending (complete is true) or it was dropped before that.
+	 */
+	typedef std::function<void(uint64_t conn_id, bool complete)> CloseHandler;
+
+	/**
+	 * Listens for connections.
+	 *
+	 * @param port_num The port number to listen on.
+	 */
+	MultiplexServer(int port_num, DataHandler on_data, CloseHandler on_close);
+
+	~MultiplexServer();
+
+	/**
+	 * Waits for segments, then handles every segment that arrived and
+	 * every connection whose timer expired.
+	 *
+	 * @param timeout_ms Longest time to wait for a segment.
+	 */
+	void handle_events(int timeout_ms);
+
+	/**
+	 * Returns the number of connections, including ones still closing.
+	 */
+	size_t connection_count();
+
+	/**
+	 * Returns the bytes allocated for the connections' state.
+	 */
+	size_t memory_usage();
+
+private:
+	int sock_fd;
+	ConnectionTable connections;
+	DataHandler on_data;
+	CloseHandler on_close;
+	// Payload of our RDT_CLOSE: the hash of what we sent, i.e. nothing
+	uint64_t close_hash;
+	std::vector<int> expired;
+
+	/*
+	 * Acts on one segment from a remote host.
+	 */
+	void process_segment(const struct sockaddr_in &from, char *segment, int seg_size,
+			uint64_t now);
+
+	/*
+	 * Creates a connection for a remote host's RDT_SYN and answers it.
+	 */
+	void accept_syn(const struct sockaddr_in &from, RDTHeader *hdr, int seg_size, uint64_t now);
+
+	/*
+	 * Delivers a data segment if it is the next in order, and acknowledges
+	 * what was received in order.
+	 */
+	void process_data(int slot, RDTHeader *hdr, int data_size);
+
+	/*
+	 * Ends the client's stream at its RDT_CLOSE and sends our own.
+	 */
+	void process_close(int slot, RDTHeader *hdr, uint64_t now);
+
+	/*
+	 * Resends what the connection is waiting on an answer to, or gives up
+	 * on it.
+	 */
+	void handle_timer(int slot, uint64_t now);
+
+	/*
+	 * Arms the connection's timer for the next resend.
+	 */
+	void schedule_retransmit(int slot, uint64_t now);
+
+	/*
+	 * Removes a connection, telling the application if its stream hadn't
+	 * ended yet.
+	 */
+	void drop(int slot);
+
+	/*
+	 * Sends the RDT_SYNACK that answers a connection's RDT_SYN.
+	 */
+	void send_synack(int slot);
+
+	/*
+	 * Sends our RDT_CLOSE, acknowledging the client's.
+	 */
+	void send_close(int slot);
+
+	/*
+	 * Acknowledges everything received in order on a connection.
+	 */
+	void send_ack(int slot);
+
+	/*
+	 * Sends a segment to a remote host.
+	 */
+	void send_segment(const struct sockaddr_in &to, RDTMessageType type, uint32_t seq_num,
+			uint32_t ack_num, uint8_t flags, const void *data, int length);
+};
+
+#endif
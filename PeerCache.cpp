@@ -0,0 +1,140 @@
+/*
+ * File: PeerCache.cpp
+ *
+ * Process-wide cache of path measurements.
+ *
+ */
+
+// C++ library includes
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+//OS specific includes
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "PeerCache.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the PeerCache header file
+*/
+
+PeerCache &PeerCache::instance() {
+	static PeerCache cache;
+	return cache;
+}
+
+PeerCache::PeerCache() {
+	const char *env_path = getenv("RDT_PEER_CACHE");
+	if (env_path != NULL && env_path[0] != '\0') {
+		this->path = env_path;
+		this->load();
+	}
+}
+
+bool PeerCache::lookup(uint32_t addr, PeerInfo *info) {
+	std::lock_guard<std::mutex> guard(this->lock);
+
+	auto it = this->peers.find(addr);
+	if (it == this->peers.end()) {
+		return false;
+	}
+	if ((uint64_t)time(NULL) - it->second.updated > MAX_AGE) {
+		// The path may well have changed since
+		this->peers.erase(it);
+		return false;
+	}
+
+	*info = it->second;
+	return true;
+}
+
+void PeerCache::record(uint32_t addr, uint32_t srtt_ms, uint32_t rttvar_ms,
+		uint64_t delivery_rate) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	uint64_t now = time(NULL);
+
+	auto it = this->peers.find(addr);
+	if (it != this->peers.end() && now - it->second.updated <= MAX_AGE) {
+		// Average with what earlier connections saw, so one unusual
+		// connection doesn't decide the next one's timeouts
+		PeerInfo &info = it->second;
+		info.srtt_ms = (info.srtt_ms + srtt_ms) / 2;
+		info.rttvar_ms = (info.rttvar_ms + rttvar_ms) / 2;
+		if (delivery_rate > 0) {
+			info.delivery_rate = info.delivery_rate > 0 ?
+				(info.delivery_rate + delivery_rate) / 2 : delivery_rate;
+		}
+		info.updated = now;
+	} else {
+		if (it == this->peers.end() && (int)this->peers.size() >= MAX_ENTRIES) {
+			// Make room by dropping the stalest entry
+			auto oldest = this->peers.begin();
+			for (auto p = this->peers.begin(); p != this->peers.end(); ++p) {
+				if (p->second.updated < oldest->second.updated) {
+					oldest = p;
+				}
+			}
+			this->peers.erase(oldest);
+		}
+
+		PeerInfo info;
+		info.srtt_ms = srtt_ms;
+		info.rttvar_ms = rttvar_ms;
+		info.delivery_rate = delivery_rate;
+		info.updated = now;
+		this->peers[addr] = info;
+	}
+
+	if (!this->path.empty()) {
+		this->save();
+	}
+}
+
+void PeerCache::set_path(const std::string &path) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->path = path;
+	this->load();
+}
+
+void PeerCache::clear() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->peers.clear();
+}
+
+void PeerCache::load() {
+	// One entry per line: address, srtt, rttvar, delivery rate, updated
+	std::ifstream in(this->path);
+	std::string addr_str;
+	PeerInfo info;
+	while (in >> addr_str >> info.srtt_ms >> info.rttvar_ms >> info.delivery_rate >> info.updated) {
+		struct in_addr addr;
+		if (inet_aton(addr_str.c_str(), &addr) == 0) {
+			continue;
+		}
+		this->peers[addr.s_addr] = info;
+	}
+}
+
+void PeerCache::save() {
+	// Write a temporary file and rename it so readers never see half of it
+	std::string tmp_path = this->path + ".tmp";
+	std::ofstream out(tmp_path);
+	for (auto &peer : this->peers) {
+		struct in_addr addr;
+		addr.s_addr = peer.first;
+		out << inet_ntoa(addr) << " " << peer.second.srtt_ms << " " << peer.second.rttvar_ms
+			<< " " << peer.second.delivery_rate << " " << peer.second.updated << "\n";
+	}
+	out.close();
+
+	if (!out || rename(tmp_path.c_str(), this->path.c_str()) < 0) {
+		cerr << "ERROR: Could not save the peer cache to " << this->path << "\n";
+	}
+}
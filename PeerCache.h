@@ -0,0 +1,96 @@
+/*
+ * File: PeerCache.h
+ *
+ * Header / API file for the process-wide cache of path measurements used to
+ * seed new connections.
+ *
+ */
+#ifndef PEER_CACHE_H
+#define PEER_CACHE_H
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * What past connections measured on the path to one remote host.
+ */
+struct PeerInfo {
+	uint32_t srtt_ms; // smoothed RTT
+	uint32_t rttvar_ms; // RTT deviation
+	uint64_t delivery_rate; // bytes per second acknowledged, 0 if unknown
+	uint64_t updated; // UNIX time (in seconds) of the last update
+};
+
+/**
+ * Process-wide cache of RTT and bandwidth measurements by remote IPv4
+ * address (like TCP's metrics cache). A new connection starts from what
+ * earlier connections to the same host measured instead of fixed defaults,
+ * so its first retransmission timeouts already fit the path and its
+ * congestion controller can start from the path's bandwidth-delay product.
+ *
+ * The cache can be kept in a file so it survives the process: either call
+ * set_path() or set the RDT_PEER_CACHE environment variable to the file's
+ * name. Entries older than MAX_AGE are ignored.
+ */
+class PeerCache {
+public:
+	static const int MAX_AGE = 3600; // seconds
+	static const int MAX_ENTRIES = 4096;
+
+	/**
+	 * Returns the cache shared by every connection in the process.
+	 */
+	static PeerCache &instance();
+
+	/**
+	 * Looks up what is known about a remote host.
+	 *
+	 * @param addr IPv4 address of the remote host (network byte order).
+	 * @param info Filled in if the host has a fresh entry.
+	 * @return true if it has one.
+	 */
+	bool lookup(uint32_t addr, PeerInfo *info);
+
+	/**
+	 * Merges the measurements of a finished connection into the host's
+	 * entry, and saves the cache if it is persisted.
+	 *
+	 * @param addr IPv4 address of the remote host (network byte order).
+	 * @param srtt_ms Smoothed RTT at the end of the connection.
+	 * @param rttvar_ms RTT deviation at the end of the connection.
+	 * @param delivery_rate Bytes per second acknowledged, or 0 if the
+	 * 		connection didn't send enough data to tell.
+	 */
+	void record(uint32_t addr, uint32_t srtt_ms, uint32_t rttvar_ms, uint64_t delivery_rate);
+
+	/**
+	 * Keeps the cache in the given file, loading what it already holds.
+	 */
+	void set_path(const std::string &path);
+
+	/**
+	 * Forgets every entry (not the file).
+	 */
+	void clear();
+
+private:
+	PeerCache();
+
+	std::mutex lock;
+	std::unordered_map<uint32_t, PeerInfo> peers;
+	std::string path;
+
+	/*
+	 * Reads entries from the file. Expects lock to be held.
+	 */
+	void load();
+
+	/*
+	 * Writes every entry to the file. Expects lock to be held.
+	 */
+	void save();
+};
+
+#endif
@@ -0,0 +1,85 @@
+/*
+ * File: ProgressReporter.cpp
+ *
+ * Periodic progress reports of the sender and receiver tools.
+ *
+ */
+
+// C++ library includes
+#include <cstdio>
+
+#include "ProgressReporter.h"
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the ProgressReporter header file
+*/
+
+ProgressReporter::ProgressReporter(ReliableSocket &socket, int interval_ms, bool json,
+		std::function<uint64_t(const RDTStats&)> goodput)
+		: socket(socket), goodput(std::move(goodput)) {
+	this->interval = std::chrono::milliseconds(interval_ms);
+	this->json = json;
+	this->stopping = false;
+	this->start = std::chrono::steady_clock::now();
+	this->thread = std::thread([this] { this->run(); });
+}
+
+ProgressReporter::~ProgressReporter() {
+	this->stop();
+}
+
+void ProgressReporter::stop() {
+	{
+		std::lock_guard<std::mutex> guard(this->lock);
+		if (this->stopping) {
+			return;
+		}
+		this->stopping = true;
+	}
+	this->wake.notify_all();
+	this->thread.join();
+}
+
+void ProgressReporter::run() {
+	auto last_time = this->start;
+	uint64_t last_bytes = 0;
+	std::unique_lock<std::mutex> guard(this->lock);
+	bool last_report = false;
+	while (!last_report) {
+		auto next = last_time + this->interval;
+		last_report = this->wake.wait_until(guard, next, [this] { return this->stopping; });
+
+		auto now = std::chrono::steady_clock::now();
+		RDTStats stats = this->socket.get_stats();
+		uint64_t bytes = this->goodput(stats);
+		double elapsed = std::chrono::duration<double>(now - this->start).count();
+		double since_last = std::chrono::duration<double>(now - last_time).count();
+		this->report(stats, elapsed, bytes,
+				since_last > 0 ? (bytes - last_bytes) / since_last : 0,
+				elapsed > 0 ? bytes / elapsed : 0);
+		last_time = now;
+		last_bytes = bytes;
+	}
+}
+
+void ProgressReporter::report(const RDTStats &stats, double elapsed, uint64_t bytes,
+		double current_rate, double average_rate) {
+	double retransmit_percent = stats.segments_sent > 0 ?
+		100.0 * stats.retransmissions / stats.segments_sent : 0;
+	if (this->json) {
+		fprintf(stderr, "{\"elapsed_s\": %.3f, \"bytes\": %llu, \"current_Bps\": %.0f, "
+				"\"average_Bps\": %.0f, \"rtt_ms\": %u, \"rto_ms\": %u, "
+				"\"mode\": \"%s\", \"congestion_window\": %u, \"peer_window\": %u, "
+				"\"retransmit_percent\": %.2f}\n",
+				elapsed, (unsigned long long)bytes, current_rate, average_rate,
+				stats.estimated_rtt_ms, stats.rto_ms, protocol_mode_name(stats.protocol_mode),
+				stats.congestion_window, stats.peer_window, retransmit_percent);
+	} else {
+		fprintf(stderr, "progress: %7.1f s %10.2f MB  now %8.3f MB/s  avg %8.3f MB/s  "
+				"rtt %4u ms  rto %4u ms  %-13s cwnd %3u  rwnd %3u  retx %5.2f%%\n",
+				elapsed, bytes / 1e6, current_rate / 1e6, average_rate / 1e6,
+				stats.estimated_rtt_ms, stats.rto_ms, protocol_mode_name(stats.protocol_mode),
+				stats.congestion_window, stats.peer_window, retransmit_percent);
+	}
+}
@@ -0,0 +1,75 @@
+/*
+ * File: ProgressReporter.h
+ *
+ * Header / API file for the periodic progress reports of the sender and
+ * receiver tools.
+ *
+ */
+#ifndef PROGRESS_REPORTER_H
+#define PROGRESS_REPORTER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+#include "ReliableSocket.h"
+
+/**
+ * Prints a line about a transfer to standard error every interval, from a
+ * thread of its own: goodput over the last interval and since the start,
+ * the RTT estimate and RTO, the protocol mode, the congestion and advertised
+ * windows, and the share of segments that were retransmissions. A stall
+ * shows up as an interval with no goodput. Times come from steady_clock, so
+ * changes to the system clock don't skew them.
+ *
+ * Lines are human-readable, or JSON objects (one per line) for scripts.
+ */
+class ProgressReporter {
+public:
+	/**
+	 * Starts reporting.
+	 *
+	 * @param socket The connection to report on. Must outlive the reporter.
+	 * @param interval_ms Time between reports.
+	 * @param json true for JSON lines.
+	 * @param goodput Returns the bytes of application data transferred so
+	 * 		far, given the connection's counters (e.g. bytes_acked).
+	 */
+	ProgressReporter(ReliableSocket &socket, int interval_ms, bool json,
+			std::function<uint64_t(const RDTStats&)> goodput);
+
+	~ProgressReporter();
+
+	/**
+	 * Stops reporting, after one last report.
+	 */
+	void stop();
+
+private:
+	ReliableSocket &socket;
+	std::function<uint64_t(const RDTStats&)> goodput;
+	std::chrono::milliseconds interval;
+	bool json;
+	std::chrono::steady_clock::time_point start;
+
+	std::mutex lock;
+	std::condition_variable wake;
+	bool stopping;
+	std::thread thread;
+
+	/*
+	 * Reports every interval until stop() is called.
+	 */
+	void run();
+
+	/*
+	 * Prints one report.
+	 */
+	void report(const RDTStats &stats, double elapsed, uint64_t bytes, double current_rate,
+			double average_rate);
+};
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * File: ReassemblyRing.h
+ *
+ * Header / API file for the ring that holds segments received out of order
+ * until the ones before them arrive.
+ *
+ */
+#ifndef REASSEMBLY_RING_H
+#define REASSEMBLY_RING_H
+
+#include <bit>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Segments that arrived ahead of the next expected sequence number, kept in
+ * a power-of-two ring of slots indexed by sequence number modulo its size,
+ * with a bitmap saying which slots are full. Inserting or taking a segment
+ * is a couple of array accesses, and the run of segments that becomes
+ * deliverable once a gap is filled is found by counting trailing ones in
+ * the bitmap, 64 slots at a time.
+ *
+ * Every sequence number in the ring must be within capacity() of the others
+ * (a receive window no larger than the ring guarantees that), since
+ * sequence numbers that far apart share a slot.
+ */
+template <typename T>
+class ReassemblyRing {
+public:
+	/**
+	 * Creates an empty ring.
+	 *
+	 * @param capacity Widest range of sequence numbers it must hold at once.
+	 * 		Rounded up to a power of two of at least 64.
+	 */
+	ReassemblyRing(uint32_t capacity) {
+		uint32_t size = 64;
+		while (size < capacity) {
+			size *= 2;
+		}
+		this->slots.resize(size);
+		this->present.assign(size / 64, 0);
+		this->mask = size - 1;
+		this->count = 0;
+	}
+
+	/**
+	 * Returns the number of slots.
+	 */
+	uint32_t capacity() { return this->mask + 1; }
+
+	/**
+	 * Returns the number of segments held.
+	 */
+	uint32_t size() { return this->count; }
+
+	bool empty() { return this->count == 0; }
+
+	/**
+	 * Checks whether the segment with the given sequence number is held.
+	 */
+	bool contains(uint32_t seq) {
+		uint32_t index = seq & this->mask;
+		return (this->present[index / 64] >> (index % 64)) & 1;
+	}
+
+	/**
+	 * Stores a segment. Its slot must be empty (see contains()).
+	 */
+	void insert(uint32_t seq, const T &value) {
+		uint32_t index = seq & this->mask;
+		this->slots[index] = value;
+		this->present[index / 64] |= (uint64_t)1 << (index % 64);
+		this->count++;
+	}
+
+	/**
+	 * Removes and returns a segment that is held.
+	 */
+	T take(uint32_t seq) {
+		uint32_t index = seq & this->mask;
+		this->present[index / 64] &= ~((uint64_t)1 << (index % 64));
+		this->count--;
+		return this->slots[index];
+	}
+
+	/**
+	 * Returns the number of consecutive sequence numbers held, starting at
+	 * the given one.
+	 */
+	uint32_t run_length(uint32_t seq) {
+		uint32_t run = 0;
+		uint32_t index = seq & this->mask;
+		while (run < this->capacity()) {
+			// Bits shifted in from the top are 0, so this never counts past
+			// the end of the word
+			int bits = 64 - index % 64;
+			int ones = std::countr_one(this->present[index / 64] >> (index % 64));
+			run += ones;
+			if (ones < bits) {
+				break;
+			}
+			index = (index + bits) & this->mask;
+		}
+		return run < this->capacity() ? run : this->capacity();
+	}
+
+private:
+	std::vector<T> slots;
+	// Bit i of word i / 64 is set if slot i holds a segment
+	std::vector<uint64_t> present;
+	uint32_t mask;
+	uint32_t count;
+};
+
+#endif
@@ -1,6 +1,6 @@
 /*
  * File: ReliableSocket.cpp
- * 
+ *
  * Reliable data transport (RDT) library implementation.
  *
  * Author(s): Justin Cavalli, Chadmond Wu
@@ -12,15 +12,26 @@
 
 //OS specific includes
 #include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/uio.h>
 #include <sys/socket.h>
 #include <sys/select.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+#include <endian.h>
 
 #include <cstring>
+#include <cerrno>
+#include <functional>
 
+#include "MemoryBudget.h"
+#include "PeerCache.h"
 #include "ReliableSocket.h"
 #include "rdt_time.h"
 
@@ -31,26 +42,212 @@ using std::cerr;
 * in the ReliableSocket header file
 */
 
-ReliableSocket::ReliableSocket() {
+ReliableSocket::ReliableSocket() : segment_pool(MAX_WIRE_SIZE),
+		out_of_order(RECV_BUFFER_SEGMENTS) {
 	this->sequence_number = 0;
 	this->expected_sequence_number = 0;
 	this->estimated_rtt = 100;
 	this->dev_rtt = 10;
 	this->current_rtt = 0;
 
+	this->keepalive_idle = 0;
+	this->keepalive_interval = 0;
+	this->keepalive_max_probes = 0;
+	this->keepalive_probes_sent = 0;
+	this->idle_timeout = 0;
+	this->last_heard = monotonic_msec();
+
+	this->send_base = 0;
+	this->retransmit_timeout = 0;
+	this->duplicate_acks = 0;
+	// Until the remote host says otherwise
+	this->peer_window = 1;
+	this->congestion = std::make_unique<AdaptiveController>();
+
+	this->tx_timestamp_count = 0;
+	this->last_recv_usec = 0;
+	this->last_recv_kernel_ns = 0;
+	memset(&this->stats, 0, sizeof(this->stats));
+
+	this->peer_addr = 0;
+	this->data_start_usec = 0;
+	this->data_acked_usec = 0;
+
+	this->send_buffered = 0;
+	this->recv_buffered = 0;
+	MemoryBudget::instance().add_connection();
+
+	this->recv_offset = 0;
+	this->recv_segment = NULL;
+	this->received_data = false;
+	this->ack_pending = false;
+	this->delayed_ack = 0;
+
+	this->coalesce_delay = 0;
+	this->corked = false;
+	this->flush_deadline = 0;
+	this->flush_due = false;
+
+	this->remote_hash = 0;
+	this->transfer_check = RDT_CHECK_PENDING;
+
+	this->close_sent = false;
+	this->close_acked = false;
+	this->remote_closed = false;
+	this->needs_time_wait = false;
+	this->discard_data = false;
+
 	this->sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
 	if (this->sock_fd < 0) {
 		perror("socket");
 		exit(EXIT_FAILURE);
 	}
+	this->enable_timestamps();
+
+	this->pumping = false;
+	this->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (this->wake_fd < 0) {
+		perror("eventfd");
+		exit(EXIT_FAILURE);
+	}
 
 	this->state = INIT;
 }
 
+ReliableSocket::~ReliableSocket() {
+	MemoryBudget &budget = MemoryBudget::instance();
+	budget.release(this->send_buffered + this->recv_buffered);
+	budget.remove_connection();
+
+	if (close(this->wake_fd) < 0) {
+		perror("ReliableSocket close");
+	}
+}
+
+void ReliableSocket::enable_timestamps() {
+	// OPT_ID numbers the transmit timestamps, so each can be matched to
+	// its segment while several are in flight
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_OPT_TSONLY | SOF_TIMESTAMPING_OPT_ID;
+	this->kernel_timestamps = setsockopt(this->sock_fd, SOL_SOCKET, SO_TIMESTAMPING,
+			&flags, sizeof(flags)) == 0;
+	if (!this->kernel_timestamps) {
+		cerr << "INFO: Kernel timestamps unavailable, measuring RTT in user space\n";
+	}
+}
+
+// Converts the software timestamp in an SO_TIMESTAMPING control message
+static uint64_t timestamp_ns(struct cmsghdr *cmsg) {
+	struct scm_timestamping *tss = (struct scm_timestamping*)CMSG_DATA(cmsg);
+	return (uint64_t)tss->ts[0].tv_sec * 1000000000 + tss->ts[0].tv_nsec;
+}
+
+void ReliableSocket::read_tx_timestamps() {
+	char control[256];
+	char data[1];
+	for (;;) {
+		struct iovec iov;
+		iov.iov_base = data;
+		iov.iov_len = sizeof(data);
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(this->sock_fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			return;
+		}
+
+		uint64_t sent_ns = 0;
+		bool have_key = false;
+		uint32_t key = 0;
+		for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+				sent_ns = timestamp_ns(cmsg);
+			} else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+				struct sock_extended_err *err = (struct sock_extended_err*)CMSG_DATA(cmsg);
+				if (err->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+					key = err->ee_data;
+					have_key = true;
+				}
+			}
+		}
+		if (sent_ns == 0 || !have_key) {
+			continue;
+		}
+		// Segments acknowledged meanwhile are gone, so it may match nothing
+		for (OutstandingSegment &seg : this->outstanding) {
+			if (seg.tx_key == key) {
+				seg.sent_kernel_ns = sent_ns;
+				break;
+			}
+		}
+	}
+}
+
+int ReliableSocket::receive_segment(int flags) {
+	struct iovec iov;
+	iov.iov_base = this->recv_segment;
+	iov.iov_len = MAX_WIRE_SIZE;
+	char control[CMSG_SPACE(sizeof(struct scm_timestamping))];
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	int recv_count = recvmsg(this->sock_fd, &msg, flags);
+	if (recv_count < 0) {
+		return -1;
+	}
+
+	this->last_recv_usec = monotonic_usec();
+	this->last_recv_kernel_ns = 0;
+	for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+			this->last_recv_kernel_ns = timestamp_ns(cmsg);
+		}
+	}
+	this->stats.segments_received++;
+	return recv_count;
+}
+
 void ReliableSocket::accept_connection(int port_num) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (!this->start_accept(port_num)) {
+		exit(EXIT_FAILURE);
+	}
+
+	// Wait for a segment to come from a remote host. Like pump(), wait with
+	// the lock released, so other threads can still read the stats or abort
+	// the accept meanwhile.
+	this->set_timeout_length(0);
+	this->pumping = true;
+	while (this->state != CLOSED && !this->accept_syn(MSG_DONTWAIT)) {
+		this->wait_readable(-1);
+	}
+	this->pumping = false;
+	this->progress.notify_all();
+	if (this->state == CLOSED) {
+		cerr << "INFO: Stopped waiting for a connection\n";
+		return;
+	}
+
+	if (!this->pump_until(guard, [this] { return this->all_acked(); })) {
+		cerr << "ERROR: Remote host stopped responding during handshake\n";
+		return;
+	}
+
+	cerr << "Connection ESTABLISHED\n";
+}
+
+bool ReliableSocket::start_accept(int port_num) {
 	if (this->state != INIT) {
 		cerr << "cannot call accept on used socket\n";
-		exit(EXIT_FAILURE);
+		return false;
 	}
 
 	// Bind specified port num using our local IPv4 address.
@@ -63,16 +260,21 @@ void ReliableSocket::accept_connection(int port_num) {
 	if (bind(this->sock_fd, (struct sockaddr*)&addr, sizeof(addr))) {
 		perror("bind");
 	}
+	return true;
+}
 
-	// Wait for a segment to come from a remote host
+bool ReliableSocket::accept_syn(int flags) {
 	char segment[MAX_SEG_SIZE];
 	memset(segment, 0, MAX_SEG_SIZE);
 
 	struct sockaddr_in fromaddr;
 	unsigned int addrlen = sizeof(fromaddr);
-	int recv_count = recvfrom(this->sock_fd, segment, MAX_SEG_SIZE, 0, (struct sockaddr*)&fromaddr, &addrlen);
-	
+	int recv_count = recvfrom(this->sock_fd, segment, MAX_SEG_SIZE, flags, (struct sockaddr*)&fromaddr, &addrlen);
+
 	if (recv_count < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			return false;
+		}
 		perror("accept recvfrom");
 		exit(EXIT_FAILURE);
 	}
@@ -87,6 +289,7 @@ void ReliableSocket::accept_connection(int port_num) {
 		perror("accept connect");
 		exit(EXIT_FAILURE);
 	}
+	this->seed_from_cache(fromaddr.sin_addr.s_addr);
 
 	// Check that segment was the right type of message, namely a RDT_SYN
 	// message to indicate that the remote host wants to start a new
@@ -97,46 +300,49 @@ void ReliableSocket::accept_connection(int port_num) {
 		cerr << "Connection was not Established\n";
 		exit(EXIT_FAILURE);
 	}
+	this->peer_window = ntohs(hdr->window);
+	this->heard_from_remote();
+
+	if (this->cipher) {
+		if (recv_count < (int)sizeof(RDTHeader) + SegmentCipher::KEY_SHARE_SIZE ||
+				!this->cipher->complete(segment + sizeof(RDTHeader), false)) {
+			cerr << "ERROR: Remote host did not offer encryption.\n";
+			cerr << "Connection was not Established\n";
+			exit(EXIT_FAILURE);
+		}
+	}
 
-	// Send an RDT_SYNACK in response to the RDT_SYN
-	char send_seg[MAX_SEG_SIZE] = {0};
-	char recv_seg[MAX_SEG_SIZE];
+	// Send an RDT_SYNACK in response to the RDT_SYN (with our key share if
+	// encrypting). It counts as acknowledged once the remote host's ACK
+	// arrives, or its first data if the ACK was dropped.
+	this->state = SYN_RECEIVED;
+	if (this->cipher) {
+		this->send_reliably(RDT_SYNACK, this->cipher->key_share(), SegmentCipher::KEY_SHARE_SIZE);
+	} else {
+		this->send_reliably(RDT_SYNACK, NULL, 0);
+	}
+	return true;
+}
 
-	hdr = (RDTHeader*)send_seg;
-	hdr->ack_number = htonl(0);
-	hdr->sequence_number = htonl(0);
-	hdr->type = RDT_SYNACK;
 
-	do
-	{
-		set_timeout_length(this->estimated_rtt + (4 * this->dev_rtt));
-		this->reliable_send(send_seg, sizeof(RDTHeader), recv_seg);
+void ReliableSocket::connect_to_remote(char *hostname, int port_num) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (!this->start_connect(hostname, port_num)) {
+		return;
+	}
 
-		hdr = (RDTHeader*)recv_seg;
-		
-		// Check we get an ACK in return
-		if (hdr->type == RDT_ACK) {
-			break;
-		} 
-		// Assume the ACK was dropped and data is now being sent
-		else if (hdr->type == RDT_DATA) {
-			break;
-		}
-		else {
-			// Didn't get an RDT_ACK or RDT_DATA
-			continue;
-		}
-	} while (true);
+	if (!this->pump_until(guard, [this] { return this->all_acked(); })) {
+		cerr << "ERROR: Remote host stopped responding during handshake\n";
+		return;
+	}
 
-	cerr << "Connection ESTABLISHED\n";
-	this->state = ESTABLISHED;
+	cerr << "INFO: Connection ESTABLISHED\n";
 }
 
-
-void ReliableSocket::connect_to_remote(char *hostname, int port_num) {
+bool ReliableSocket::start_connect(char *hostname, int port_num) {
 	if (this->state != INIT) {
 		cerr << "Cannot call connect_to_remote on used socket\n";
-		return;
+		return false;
 	}
 
 	// Set up IPv4 address info with given hostname and port number
@@ -154,391 +360,1578 @@ void ReliableSocket::connect_to_remote(char *hostname, int port_num) {
 	if (connect(this->sock_fd, (struct sockaddr*)&addr, sizeof(addr))) {
 		perror("connect");
 	}
+	this->seed_from_cache(addr.sin_addr.s_addr);
+
+	// Send an RDT_SYN message to remote host to initiate an RDT connection.
+	// process_segment() answers the RDT_SYNACK with the final ACK of the
+	// three way handshake.
+	this->heard_from_remote();
+	this->state = SYN_SENT;
+	if (this->cipher) {
+		this->send_reliably(RDT_SYN, this->cipher->key_share(), SegmentCipher::KEY_SHARE_SIZE);
+	} else {
+		this->send_reliably(RDT_SYN, NULL, 0);
+	}
+	return true;
+}
 
-		// Send an RDT_SYN message to remote host to initiate an RDT connection.
-		char send_seg[MAX_SEG_SIZE] = {0};
-		char recv_seg[MAX_SEG_SIZE];
-
-		RDTHeader* hdr = (RDTHeader*)send_seg;
-		hdr->ack_number = htonl(0);
-		hdr->sequence_number = htonl(0);
-		hdr->type = RDT_SYN;
+int ReliableSocket::pump(bool block) {
+	if (this->state == CLOSED) {
+		return -1;
+	}
+	if (this->kernel_timestamps) {
+		// A queued timestamp makes the socket poll as having an error, which
+		// would keep waking an EventLoop
+		this->read_tx_timestamps();
+	}
 
-		this->set_timeout_length(this->estimated_rtt + (4 * this->dev_rtt));
-		this->reliable_send(send_seg, sizeof(RDTHeader), recv_seg);
-		
-		// Expecting a SYNACK in return for the RDT_SYN
-		memset(hdr, 0, sizeof(RDTHeader));
-		hdr = (RDTHeader*)recv_seg;
-		if (hdr->type != RDT_SYNACK) {
-			// Response was not an RDT_SYNACK type
-			perror("Message was not a SYNACK");
+	uint64_t now = monotonic_msec();
+	bool timer_expired = false;
+	int timer_id;
+	while ((timer_id = this->timers.pop_expired(now)) >= 0) {
+		this->handle_timer(timer_id, now);
+		if (this->state == CLOSED) {
+			return -1;
 		}
+		timer_expired = true;
+	}
+	if (timer_expired && block) {
+		// Let the caller see what the timer changed before waiting again
+		return 0;
+	}
 
+	if (block) {
+		// Wait no longer than the next timer (rounded up so it has expired)
+		int64_t wait = this->timers.time_until_next(now);
+		this->wait_readable(wait < 0 ? -1 : wait + 1);
+		if (this->state == CLOSED) {
+			// Another thread aborted the connection meanwhile
+			return -1;
+		}
+	}
 
-		// Send a final ACK for the three way handshake
-		memset(send_seg, 0, sizeof(RDTHeader));
-		hdr = (RDTHeader*)send_seg;
-		hdr->ack_number = htonl(0);
-		hdr->sequence_number = htonl(0);
-		hdr->type = RDT_ACK;
-		this->timeout_send(send_seg);
-
-		this->state = ESTABLISHED;
-		cerr << "INFO: Connection ESTABLISHED\n";
-}
-
-void ReliableSocket::reliable_send(char send_seg[MAX_SEG_SIZE], int send_seg_size, char recv_seg[MAX_SEG_SIZE]) {
-	int time_sent;
-	this->set_timeout_length(this->estimated_rtt + (4 * this->dev_rtt));
-	// Keeps track if the previous send timed out
-	bool previous_timeout = false;
-	// Stores the previous timeout time. So it can be doubled in the case of a
-	// timeout
-	uint32_t doubled_timeout;
-	do {
-			// Get time of send to calculate current_rtt
-			time_sent = current_msec();
-			// Send the send_seg
-			if (send(this->sock_fd, send_seg, send_seg_size, 0) < 0) {
-				perror("reliable_send send");
+	// Receive straight into a pooled buffer so queued data never has to be
+	// copied (process_data() keeps the buffer)
+	if (this->recv_segment == NULL) {
+		this->recv_segment = this->segment_pool.acquire();
+	}
+	int recv_count = this->receive_segment(MSG_DONTWAIT);
+	if (recv_count < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+			// A timer is due (or nothing was waiting)
+			return 0;
+		}
+		if (errno == ECONNREFUSED) {
+			if (this->state == SYN_SENT) {
+				// Remote host isn't listening yet, so keep sending RDT_SYN
+				return 0;
 			}
-			// Get ready to receive the segment
-			memset(recv_seg, 0, MAX_SEG_SIZE);
-			int bytes_received = recv(this->sock_fd, recv_seg, MAX_SEG_SIZE, 0);
-			if (bytes_received < 0) {
-				if (errno == EAGAIN) {
-					// set the timeout length to double whatever it was previously
-					cerr << "Timeout Occurred. Doubling the length.\n";
-					if (previous_timeout) {
-						doubled_timeout *= 2;
-						this->set_timeout_length(doubled_timeout);
-					}
-					else {
-						doubled_timeout = (2 * (this->estimated_rtt + 4 * this->dev_rtt));
-						this->set_timeout_length(doubled_timeout);
-					}
-					previous_timeout = true;
-					continue;
-				}
-				else {
-					// Some other error than timeouts
-					perror("ACK not received");
-					exit(EXIT_FAILURE);
-				}
+			if (this->remote_closed && this->close_acked) {
+				// Remote host got our final ACK and closed its socket
+				this->timers.cancel(TIMER_TIME_WAIT);
+				return 0;
 			}
+			cerr << "ERROR: Remote host is no longer listening\n";
+			this->drop_connection();
+			return -1;
+		}
+		perror("recv");
+		exit(EXIT_FAILURE);
+	}
+
+	this->heard_from_remote();
+	this->process_segment(this->recv_segment, recv_count);
+	return this->state == CLOSED ? -1 : 1;
+}
 
-			this->current_rtt = current_msec() - time_sent;
+void ReliableSocket::handle_timer(int timer_id, uint64_t now) {
+	switch (timer_id) {
+	case TIMER_RETRANSMIT:
+		if (this->outstanding.empty()) {
 			break;
-	} while (true); 
+		}
+		// set the timeout length to double whatever it was previously
+		cerr << "Timeout Occurred. Doubling the length.\n";
+		this->retransmit_timeout *= 2;
+		if (this->peer_window > 0) {
+			// (With a closed window the segment was only dropped for lack of
+			// room, which says nothing about congestion)
+			this->congestion->on_timeout();
+		}
+		this->duplicate_acks = 0;
+		this->retransmit_oldest();
+		this->timers.schedule(TIMER_RETRANSMIT, now + this->retransmit_timeout);
+		break;
 
-		// Update the timeout length using the new current_rtt
-		this->set_estimated_rtt();
-}
+	case TIMER_KEEPALIVE:
+		if (this->keepalive_probes_sent >= this->keepalive_max_probes) {
+			cerr << "INFO: Remote host did not answer " << this->keepalive_probes_sent
+				<< " keepalive probes\n";
+			this->drop_connection();
+			break;
+		}
+		// Any segment that comes back restarts the timers, so there is
+		// nothing to wait for here
+		this->send_probe();
+		this->keepalive_probes_sent++;
+		this->timers.schedule(TIMER_KEEPALIVE, now + this->keepalive_interval);
+		break;
 
-void ReliableSocket::timeout_send(char send_seg[]) {
-	char recv_seg[MAX_SEG_SIZE];
+	case TIMER_IDLE:
+		cerr << "INFO: No segment from remote host for " << this->idle_timeout << " ms\n";
+		this->drop_connection();
+		break;
 
-	do {
-			if (send(this->sock_fd, send_seg, sizeof(RDTHeader), 0) < 0) {
-				perror("timeout_send send");
-			}
+	case TIMER_DELAYED_ACK:
+		if (this->ack_pending) {
+			// Nothing was sent that the ACK could ride on
+			this->send_ack(this->expected_sequence_number - 1);
+		}
+		break;
 
-			memset(recv_seg, 0, MAX_SEG_SIZE);
-			this->set_timeout_length(this->estimated_rtt + (this->dev_rtt * 4));
-			if (recv(this->sock_fd, recv_seg, MAX_SEG_SIZE, 0) < 0) {
-				if (errno == EAGAIN) {
-					// The segment timed out as expected
-					break;
-				}
-				else {
-					perror("timeout_send recv");
-					exit(EXIT_FAILURE);
-				}
-			} else {
-				// Got a packet in return so continue the loop
-				continue;
-			}
-	} while (true);
+	case TIMER_COALESCE:
+		this->flush_due = true;
+		this->send_due_pending();
+		break;
 
+	default:
+		// TIMER_PROBE and TIMER_TIME_WAIT are waited on by probe_remote()
+		// and close_connection()
+		break;
+	}
 }
 
-// You should not modify this function in any way.
-uint32_t ReliableSocket::get_estimated_rtt() {
-	return this->estimated_rtt;
-}
+void ReliableSocket::process_segment(char *segment, int seg_size) {
+	if (seg_size < (int)sizeof(RDTHeader)) {
+		return;
+	}
 
-void ReliableSocket::set_estimated_rtt() {
-	// calculate the estimated_rtt
-	this->estimated_rtt *= (1 - 0.125);
-	this->estimated_rtt += this->current_rtt * 0.125;
-	this->dev_rtt *= (1 - 0.25);
-	// Find the difference (can't be negative)
-	int abs_dev = this->current_rtt - this->estimated_rtt;
-	if (abs_dev < 0) {
-		abs_dev *= -1;
+	RDTHeader* hdr = (RDTHeader*)segment;
+	if (this->is_sealed(hdr->type)) {
+		// Decrypted in place, so the data stays where process_data()
+		// expects it
+		int data_size = this->cipher->open(hdr, sizeof(RDTHeader), segment + sizeof(RDTHeader),
+				seg_size - sizeof(RDTHeader));
+		if (data_size < 0) {
+			cerr << "INFO: Dropped segment that failed authentication\n";
+			this->stats.segments_rejected++;
+			return;
+		}
+		seg_size = sizeof(RDTHeader) + data_size;
+	} else if (this->cipher && this->state > SYN_RECEIVED) {
+		// Once the keys are agreed on, a plaintext handshake segment can't
+		// be trusted with any connection state. The SYNACK still gets its
+		// handshake ACK, in case ours was dropped.
+		if (hdr->type == RDT_SYNACK) {
+			this->send_header(RDT_ACK, 0, 0, RDT_FLAG_HANDSHAKE);
+			return;
+		}
+		cerr << "INFO: Dropped unauthenticated segment\n";
+		this->stats.segments_rejected++;
+		return;
 	}
-	this->dev_rtt += (abs_dev * 0.25);
-	// Update the timeout length
-	this->set_timeout_length(this->estimated_rtt + 4 * this->dev_rtt);
-}
 
-// You shouldn't need to modify this function in any way.
-void ReliableSocket::set_timeout_length(uint32_t timeout_length_ms) {
-	cerr << "INFO: Setting timeout to " << timeout_length_ms << " ms\n";
-	struct timeval timeout;
-	msec_to_timeval(timeout_length_ms, &timeout);
+	cerr << "INFO: Received segment. "
+		<< "seq_num = " << ntohl(hdr->sequence_number) << ", "
+		<< "ack_num = " << ntohl(hdr->ack_number) << ", "
+		<< "type = " << (int)hdr->type << "\n";
 
-	if (setsockopt(this->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,sizeof(struct timeval)) < 0) {
-		perror("setsockopt");
-		exit(EXIT_FAILURE);
+	uint16_t previous_window = this->peer_window;
+	this->peer_window = ntohs(hdr->window);
+
+	if (this->state == SYN_SENT) {
+		// Expecting a SYNACK in return for the RDT_SYN
+		if (hdr->type == RDT_SYNACK && !this->outstanding.empty()) {
+			if (this->cipher && (seg_size < (int)sizeof(RDTHeader) + SegmentCipher::KEY_SHARE_SIZE ||
+					!this->cipher->complete(segment + sizeof(RDTHeader), true))) {
+				cerr << "ERROR: Remote host did not agree to encryption\n";
+				this->drop_connection();
+				return;
+			}
+			this->complete_handshake();
+			this->state = ESTABLISHED;
+			this->send_header(RDT_ACK, 0, 0, RDT_FLAG_HANDSHAKE);
+		}
+		return;
 	}
-}
 
-void ReliableSocket::send_data(const void *data, int length) {
-	if (this->state != ESTABLISHED) {
-		cerr << "INFO: Cannot send: Connection not established.\n";
+	if (this->state == SYN_RECEIVED) {
+		if (hdr->type == RDT_SYN) {
+			// Our SYNACK was dropped; the retransmission timer resends it
+			return;
+		}
+		// Anything else means the remote host got our SYNACK. If the ACK
+		// was dropped and data is now being sent, keep processing it.
+		this->complete_handshake();
+		this->state = ESTABLISHED;
+	}
+
+	if (hdr->type == RDT_SYNACK) {
+		// Our final handshake ACK was dropped
+		this->send_header(RDT_ACK, 0, 0, RDT_FLAG_HANDSHAKE);
 		return;
 	}
 
-	// Create the segment, which contains a header followed by the data.
-	char send_seg[MAX_SEG_SIZE] = {0};
-	char recv_seg[MAX_SEG_SIZE];
+	if (hdr->type == RDT_ACK) {
+		if (!(hdr->flags & RDT_FLAG_HANDSHAKE)) {
+			this->process_ack(ntohl(hdr->ack_number), this->peer_window == previous_window);
+		}
+		this->process_window_update(previous_window);
+		this->send_due_pending();
+		return;
+	}
+
+	if (hdr->flags & RDT_FLAG_ACK) {
+		// ACK piggybacked on the remote host's own data
+		this->process_ack(ntohl(hdr->ack_number), false);
+	}
+	this->process_window_update(previous_window);
+	this->send_due_pending();
+
+	if (hdr->type == RDT_DATA) {
+		this->process_data(hdr, seg_size - sizeof(RDTHeader));
+	} else if (hdr->type == RDT_CLOSE) {
+		this->process_close(hdr, seg_size - sizeof(RDTHeader));
+	} else if (hdr->type == RDT_KEEPALIVE) {
+		// Answer the probe so the remote host knows we are alive
+		this->send_ack(this->expected_sequence_number - 1);
+	}
+}
+
+void ReliableSocket::process_data(RDTHeader *hdr, int data_size) {
+	uint32_t seq_num = ntohl(hdr->sequence_number);
+	int32_t offset = seq_num - this->expected_sequence_number;
 
-	// Fill in the header
-	RDTHeader *hdr = (RDTHeader*)send_seg;
-	hdr->sequence_number = htonl(this->sequence_number);
-	hdr->ack_number = htonl(0);
-	hdr->type = RDT_DATA;
+	if (offset < 0) {
+		// Already have this one, so our ACK must have been dropped
+		this->send_ack(this->expected_sequence_number - 1);
+		return;
+	}
+
+	// hdr is at the start of recv_segment
+	ReceivedSegment received;
+	received.segment = (char*)hdr;
+	received.data_size = data_size;
+
+	if (offset > 0) {
+		// A segment before this one was lost. Keep this one if it fits in
+		// the window we advertised, and repeat our last ACK right away so
+		// the remote host can retransmit the lost one without waiting for
+		// its timer.
+		if (offset < this->advertised_window() && !this->out_of_order.contains(seq_num) &&
+				this->charge_received(false)) {
+			this->out_of_order.insert(seq_num, received);
+			this->recv_segment = NULL;
+		}
+		this->send_ack(this->expected_sequence_number - 1);
+		return;
+	}
 
-	// Copy the user-supplied data to the spot right past the
-	// header (i.e. hdr+1).
-	memcpy(hdr + 1, data, length);
+	if (!this->discard_data) {
+		// Segments waiting for this one can only be delivered through it,
+		// so it may go over the memory budget then
+		if ((int)this->recv_queue.size() >= RECV_BUFFER_SEGMENTS ||
+				!this->charge_received(!this->out_of_order.empty())) {
+			// No room until the application reads, so drop it and tell the
+			// remote host our window is closed. It retransmits once we
+			// advertise room again.
+			this->send_ack(this->expected_sequence_number - 1);
+			return;
+		}
+		this->recv_queue.push_back(received);
+		this->recv_segment = NULL;
+	}
+	this->recv_hash.update(hdr + 1, data_size);
+
+	this->expected_sequence_number++;
+	this->received_data = true;
+
+	// The segments that were waiting for this one are in order now
+	uint32_t deliverable = this->out_of_order.run_length(this->expected_sequence_number);
+	bool filled_gap = deliverable > 0;
+	for (uint32_t i = 0; i < deliverable; i++) {
+		ReceivedSegment next = this->out_of_order.take(this->expected_sequence_number);
+		this->recv_hash.update(next.segment + sizeof(RDTHeader), next.data_size);
+		if (this->discard_data) {
+			this->segment_pool.release(next.segment);
+			this->release_received();
+		} else {
+			this->recv_queue.push_back(next);
+		}
+		this->expected_sequence_number++;
+	}
 
-	do {
-			// Send the data
-			memset(recv_seg, 0, MAX_SEG_SIZE);
-			reliable_send(send_seg, sizeof(RDTHeader) + length, recv_seg);
+	if (this->delayed_ack > 0 && !this->discard_data && !this->ack_pending && !filled_gap) {
+		// Give the application a chance to send something the ACK can
+		// ride on
+		this->ack_pending = true;
+		this->timers.schedule(TIMER_DELAYED_ACK, monotonic_msec() + this->delayed_ack);
+	} else {
+		this->send_ack(this->expected_sequence_number - 1);
+	}
+}
 
-			// Check the type of message that was received
-			hdr = (RDTHeader*)recv_seg;
-			if (hdr->type == RDT_ACK) {
-				if (this->sequence_number == ntohl(hdr->ack_number)) {
-					// Expected ACK was received
-					break;
-				} else {
-	
-						// Out of Order ACK was received
-						continue;
-					}
-			} else {
-					// An ACK was not received so continue loop;
-					continue;
+void ReliableSocket::process_close(RDTHeader *hdr, int data_size) {
+	uint32_t seq_num = ntohl(hdr->sequence_number);
+
+	if (seq_num == this->expected_sequence_number) {
+		// Everything before the RDT_CLOSE has been received, so the hashes
+		// cover the same data
+		if (data_size >= (int)sizeof(uint64_t)) {
+			uint64_t hash;
+			memcpy(&hash, hdr + 1, sizeof(hash));
+			this->remote_hash = be64toh(hash);
+			this->transfer_check = this->remote_hash == this->recv_hash.digest() ?
+				RDT_CHECK_PASSED : RDT_CHECK_FAILED;
+			if (this->transfer_check == RDT_CHECK_FAILED) {
+				cerr << "ERROR: Received data does not match the remote host's hash\n";
 			}
-	} while (true);
-	
-	// Packet successfully sent so increase the seqnum
-	this->sequence_number++;
+		} else {
+			this->transfer_check = RDT_CHECK_UNAVAILABLE;
+		}
+		this->remote_closed = true;
+		this->expected_sequence_number++;
+		this->received_data = true;
+
+		// If we closed first, our ACK of this close is the last segment of
+		// the connection and we have to stay around in case it is lost
+		if (this->close_sent) {
+			this->needs_time_wait = true;
+		}
+		this->update_close_state();
+	} else if ((int32_t)(seq_num - this->expected_sequence_number) > 0) {
+		// Can't be in order, so let the remote host retransmit it
+		return;
+	} else if (this->timers.is_scheduled(TIMER_TIME_WAIT)) {
+		// Our final ACK was dropped, so start the TIME_WAIT over
+		this->timers.schedule(TIMER_TIME_WAIT, monotonic_msec() + TIME_WAIT);
+	}
+
+	this->send_ack(this->expected_sequence_number - 1);
 }
 
+void ReliableSocket::process_ack(uint32_t ack_num, bool may_be_duplicate) {
+	if (this->outstanding.empty()) {
+		return;
+	}
 
-int ReliableSocket::receive_data(char buffer[MAX_DATA_SIZE]) {
-	// We don't want the reciever timing out when receiving data
-	this->set_timeout_length(0);
-	if (this->state != ESTABLISHED) {
-		cerr << "INFO: Cannot receive: Connection not established.\n";
-		return 0;
+	// Handshake segments are answered by the next handshake step instead
+	uint8_t type = this->outstanding.front().header.type;
+	if (type != RDT_DATA && type != RDT_CLOSE) {
+		return;
 	}
-	int recv_data_size = 0;
-	while (true) {
-		char recv_seg[MAX_SEG_SIZE];
-		char send_seg[sizeof(RDTHeader)] = {0};
-		memset(recv_seg, 0, MAX_SEG_SIZE);
-
-		// Set up pointers to both the header (hdr) and data (data) portions
-		// of the received segment.
-		RDTHeader* hdr = (RDTHeader*)recv_seg;
-		void *data = (void*)(recv_seg + sizeof(RDTHeader));
-
-		// Receive the data
-		int	recv_count = recv(this->sock_fd, recv_seg, MAX_SEG_SIZE, 0);
-		// Check if there was an error or a timeout. NOTE: recv should never
-		// timeout
-		if (recv_count < 0) {
-			perror("receive_data recv");
-			exit(EXIT_FAILURE);
+
+	int32_t acked = ack_num - this->send_base + 1;
+	if (acked <= 0) {
+		// The remote host repeats its last ACK for each segment that arrives
+		// after a gap, so a few in a row mean the oldest one was lost
+		if (acked == 0 && may_be_duplicate && this->peer_window > 0 &&
+				++this->duplicate_acks == DUPLICATE_ACK_THRESHOLD) {
+			cerr << "INFO: " << DUPLICATE_ACK_THRESHOLD << " duplicate ACKs, retransmitting "
+				<< this->send_base << "\n";
+			this->stats.fast_retransmits++;
+			this->congestion->on_loss();
+			this->retransmit_oldest();
+			this->timers.schedule(TIMER_RETRANSMIT, monotonic_msec() + this->retransmit_timeout);
+		}
+		return;
+	}
+	if (acked > (int32_t)this->outstanding.size()) {
+		// Acknowledges something we never sent
+		return;
+	}
+
+	// Time the newest segment it acknowledges. If any of them was
+	// retransmitted, the rest were waiting at the remote host for it to fill
+	// the gap, so the ACK can't be timed at all (Karn's algorithm).
+	uint32_t in_flight = this->outstanding.size();
+	bool retransmitted = false;
+	for (int32_t i = 0; i < acked; i++) {
+		retransmitted = retransmitted || this->outstanding[i].retransmitted;
+	}
+	uint64_t rtt_us = 0;
+	if (!retransmitted) {
+		rtt_us = this->take_rtt_sample(this->outstanding[acked - 1]);
+	}
+
+	for (int32_t i = 0; i < acked; i++) {
+		OutstandingSegment &seg = this->outstanding.front();
+		if (seg.header.type == RDT_DATA) {
+			this->stats.bytes_acked += seg.length;
+			this->data_acked_usec = this->last_recv_usec;
+		} else if (seg.header.type == RDT_CLOSE) {
+			this->close_acked = true;
+			this->update_close_state();
 		}
+		this->send_buffered -= seg.buffered_size();
+		MemoryBudget::instance().release(seg.buffered_size());
+		this->outstanding.pop_front();
+	}
+	this->send_base += acked;
+	this->duplicate_acks = 0;
+	this->congestion->on_ack(acked, in_flight, rtt_us);
+
+	// The timer now covers the oldest segment still outstanding
+	this->retransmit_timeout = this->rto();
+	if (this->outstanding.empty()) {
+		this->timers.cancel(TIMER_RETRANSMIT);
+	} else {
+		this->timers.schedule(TIMER_RETRANSMIT, monotonic_msec() + this->retransmit_timeout);
+	}
+}
 
-		cerr << "INFO: Received segment. "
-			<< "seq_num = " << ntohl(hdr->sequence_number) << ", "
-			<< "ack_num = " << this->sequence_number << ", "
-			<< ", type = " << hdr->type << "\n";
+void ReliableSocket::process_window_update(uint16_t previous_window) {
+	if (previous_window != 0 || this->peer_window == 0 || this->outstanding.empty()) {
+		return;
+	}
+	uint8_t type = this->outstanding.front().header.type;
+	if (type != RDT_DATA && type != RDT_CLOSE) {
+		return;
+	}
 
-			uint32_t seqnum = hdr->sequence_number;
+	// The remote host dropped it while its window was closed
+	this->retransmit_timeout = this->rto();
+	this->retransmit_oldest();
+	this->timers.schedule(TIMER_RETRANSMIT, monotonic_msec() + this->retransmit_timeout);
+}
 
-			if (hdr->type == RDT_ACK) {
-				// Allow for the sender's ACK to timeout in the case of the
-				// initial three way handshake
-				continue;
-			}
-			if (hdr->type == RDT_CLOSE) {
-				// Sender initiated the close_connection
-				hdr = (RDTHeader*)send_seg;
-				hdr->sequence_number = htonl(0);
-				hdr->ack_number = htonl(0);
-				hdr->type = RDT_ACK;
-
-				// Send an ACK in response to the close message
-				this->timeout_send(send_seg);
-				
-				// Indicate it's on the server side of the connection teardown
-				this->state = FIN;
-				break;
-			} else {
-					// Send an ACK for the received data
-					hdr = (RDTHeader*)send_seg;
-					hdr->ack_number = seqnum;
-					hdr->sequence_number = seqnum;
-					hdr->type = RDT_ACK;
-					if (send(this->sock_fd, send_seg, sizeof(RDTHeader), 0) < 0) {
-						perror("receive_data send");
-					}
-
-					if (ntohl(seqnum) == this->sequence_number) {
-						// Expected sequence number so end the loop
-					} else {
-							// Out of order sequence number, so drop the data
-							continue;
-					}
-			}
-		// Increase the seqnum and output the data
-		recv_data_size = recv_count - sizeof(RDTHeader);
-		this->sequence_number++;
-		memcpy(buffer, data, recv_data_size);
-		break;
+void ReliableSocket::complete_handshake() {
+	if (!this->outstanding.front().retransmitted) {
+		this->take_rtt_sample(this->outstanding.front());
 	}
+	for (OutstandingSegment &seg : this->outstanding) {
+		this->send_buffered -= seg.buffered_size();
+		MemoryBudget::instance().release(seg.buffered_size());
+	}
+	this->outstanding.clear();
+	this->timers.cancel(TIMER_RETRANSMIT);
+}
 
-	return recv_data_size;
+void ReliableSocket::send_reliably(RDTMessageType type, const void *data, int length,
+		std::shared_ptr<const void> owner) {
+	this->queue_segment(type, data, length, std::move(owner));
+	this->transmit(this->outstanding.back());
+	this->start_retransmit_timer();
 }
 
+void ReliableSocket::queue_segment(RDTMessageType type, const void *data, int length,
+		std::shared_ptr<const void> owner) {
+	OutstandingSegment seg;
+	seg.sent_usec = 0;
+	seg.sent_kernel_ns = 0;
+	seg.tx_key = 0;
+	seg.retransmitted = false;
+
+	// Fill in the header. Only data and RDT_CLOSE take up a sequence
+	// number; the handshake segments reuse the first one.
+	memset(&seg.header, 0, sizeof(seg.header));
+	seg.header.sequence_number = htonl(this->sequence_number);
+	seg.header.type = type;
+	if (type == RDT_DATA || type == RDT_CLOSE) {
+		this->sequence_number++;
+	}
 
-void ReliableSocket::close_connection() {
-	if (this->state != FIN) {
-		// Initiating the close_connection
-		this->send_close_connection();
+	// Keep a reference to the payload if its owner keeps it alive until
+	// it is acknowledged, and a copy otherwise
+	if (type == RDT_DATA) {
+		// Hashed in sequence order, while the data is in cache anyway
+		this->send_hash.update(data, length);
+	}
+	seg.length = length;
+	if (owner) {
+		seg.data = (const char*)data;
+		seg.owner = std::move(owner);
 	} else {
-		// On the receiver side of close_connection	
-		this->receive_close_connection();
+		seg.data = NULL;
+		if (length > 0) {
+			seg.copy.assign((const char*)data, (const char*)data + length);
+		}
 	}
 
-	// Connection teardown is complete. Close the connection 
-	this->state = CLOSED;
-	if (close(this->sock_fd) < 0) {
-		perror("close_connection close");
+	// Sending never waits for the budget here; window_open() holds the
+	// application back instead
+	this->send_buffered += seg.buffered_size();
+	MemoryBudget::instance().charge(seg.buffered_size());
+	this->outstanding.push_back(std::move(seg));
+}
+
+void ReliableSocket::start_retransmit_timer() {
+	if (!this->timers.is_scheduled(TIMER_RETRANSMIT)) {
+		this->retransmit_timeout = this->rto();
+		this->timers.schedule(TIMER_RETRANSMIT, monotonic_msec() + this->retransmit_timeout);
+		this->wake_pumper();
 	}
-	cerr << "Connection successfully closed\n";
 }
 
-void ReliableSocket::send_close_connection() {
+void ReliableSocket::retransmit_oldest() {
+	OutstandingSegment &seg = this->outstanding.front();
+	seg.retransmitted = true;
+	this->stats.retransmissions++;
+	this->transmit(seg);
+}
 
-	char send_seg[MAX_SEG_SIZE] = {0};
-	char recv_seg[MAX_SEG_SIZE];
+void ReliableSocket::transmit(OutstandingSegment &seg) {
+	this->prepare_transmission(seg);
+	this->write_segment(seg);
+}
 
-	RDTHeader* hdr = (RDTHeader*)send_seg;
-	hdr->ack_number = htonl(0);
-	hdr->sequence_number = htonl(0);
-	hdr->type = RDT_CLOSE;
-
-	do
-	{
-			// Send the initial close message
-			memset(recv_seg, 0, MAX_SEG_SIZE);
-			this->reliable_send(send_seg, sizeof(RDTHeader), recv_seg);
-			hdr = (RDTHeader*)recv_seg;
-			if (hdr->type == RDT_ACK) {
-				break;
-			}	
-			// Check if ACK was dropped and the server is at the next part in
-			// the connection teardown
-			if (hdr->type == RDT_CLOSE) {
-				break;
-			}
-	} while (true);
-
-	do
-	{
-			memset(recv_seg, 0, MAX_SEG_SIZE);
-			int	recv_count = recv(this->sock_fd, recv_seg, MAX_SEG_SIZE, 0);
-			if (recv_count < 0) {
-				// Got a timeout so continue the loop
-				continue;
-			} else if (recv_count < 0 && errno != EAGAIN) {
-				// Error other than a timeout
-				perror("recv send_close_connection");
-				exit(EXIT_FAILURE);
-			}
+void ReliableSocket::prepare_transmission(OutstandingSegment &seg) {
+	// The header is rebuilt for every transmission, so a retransmission
+	// carries our latest ACK and window
+	RDTHeader &hdr = seg.header;
+	hdr.window = htons(this->advertised_window());
+	if ((hdr.type == RDT_DATA || hdr.type == RDT_CLOSE) && this->received_data) {
+		// Piggyback the ACK of the last in-order segment we received
+		hdr.flags |= RDT_FLAG_ACK;
+		hdr.ack_number = htonl(this->expected_sequence_number - 1);
+		this->ack_pending = false;
+		this->timers.cancel(TIMER_DELAYED_ACK);
+	}
 
-			hdr = (RDTHeader*)recv_seg;
-			if (hdr->type == RDT_CLOSE) {
-				// Received the CLOSE so stop the loop
-				break;
-			}
-	} while (true);
+	// Get time of send to calculate current_rtt
+	seg.sent_usec = monotonic_usec();
+	seg.sent_kernel_ns = 0;
+	if (hdr.type == RDT_DATA && this->data_start_usec == 0) {
+		this->data_start_usec = seg.sent_usec;
+	}
+	this->stats.segments_sent++;
+}
+
+void ReliableSocket::build_message(OutstandingSegment &seg, struct msghdr &msg,
+		struct iovec iov[2], char *control, char *sealed) {
+	// Header and payload go out as one datagram straight from where they
+	// are, without being copied together
+	iov[0].iov_base = &seg.header;
+	iov[0].iov_len = sizeof(RDTHeader);
+	iov[1].iov_base = (void*)seg.payload();
+	iov[1].iov_len = seg.length;
+	if (this->is_sealed(seg.header.type)) {
+		this->cipher->seal(&seg.header, sizeof(RDTHeader), seg.payload(), seg.length, sealed);
+		iov[1].iov_base = sealed;
+		iov[1].iov_len = seg.length + SegmentCipher::OVERHEAD;
+	}
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = iov;
+	msg.msg_iovlen = iov[1].iov_len > 0 ? 2 : 1;
+
+	if (control != NULL) {
+		// Ask the kernel to timestamp this transmission. The timestamps are
+		// numbered in the order they are requested.
+		memset(control, 0, TX_CONTROL_SIZE);
+		msg.msg_control = control;
+		msg.msg_controllen = TX_CONTROL_SIZE;
+		struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SO_TIMESTAMPING;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(uint32_t));
+		*(uint32_t*)CMSG_DATA(cmsg) = SOF_TIMESTAMPING_TX_SOFTWARE;
+	}
+}
 
-	hdr = (RDTHeader*)send_seg;
-	hdr->type = RDT_ACK;
+void ReliableSocket::write_segment(OutstandingSegment &seg) {
+	struct msghdr msg;
+	struct iovec iov[2];
+	char control[TX_CONTROL_SIZE];
+	this->sealed_segment.resize(seg.length + SegmentCipher::OVERHEAD);
+	this->build_message(seg, msg, iov, this->kernel_timestamps ? control : NULL,
+			this->sealed_segment.data());
+
+	if (this->kernel_timestamps) {
+		if (sendmsg(this->sock_fd, &msg, 0) >= 0) {
+			seg.tx_key = this->tx_timestamp_count++;
+			return;
+		}
+		if (errno != EINVAL) {
+			perror("sendmsg");
+			return;
+		}
+		// Kernel is too old for per-segment timestamp requests
+		cerr << "INFO: Kernel transmit timestamps unavailable, measuring RTT in user space\n";
+		this->kernel_timestamps = false;
+		msg.msg_control = NULL;
+		msg.msg_controllen = 0;
+	}
 
-	do {
-			// Send the final ACK
-			if (send(this->sock_fd, send_seg, sizeof(RDTHeader), 0) < 0) {
-				// Error occurred while sending
-				perror("send_close_connection send");
-			}
-			// Enter the TIME_WAIT state for the final ACK
-			memset(recv_seg, 0, MAX_SEG_SIZE);
-			this->set_timeout_length(TIME_WAIT);
-			if (recv(this->sock_fd, recv_seg, MAX_SEG_SIZE, 0) > 0) {
-				// Recieved a segment while expecting a timeout
-				hdr = (RDTHeader*)recv_seg;
-				if (hdr->type == RDT_CLOSE) {
-					// ACK must have been dropped. Continue loop
-					continue;
-				}
-			} else {
-				if (errno == EAGAIN) {
-					// Timeout as expected. Connection can close
-					break;
-				}
-				else {
-					perror("send_close_connection recv");
-					exit(EXIT_FAILURE);
-				}
-			}
-	} while (true);
+	if (sendmsg(this->sock_fd, &msg, 0) < 0) {
+		perror("sendmsg");
+	}
 }
 
-void ReliableSocket::receive_close_connection() {
+void ReliableSocket::transmit_batch(size_t first) {
+	size_t count = this->outstanding.size() - first;
+	if (count <= 1) {
+		if (count == 1) {
+			this->transmit(this->outstanding[first]);
+		}
+		return;
+	}
 
-	char send_seg[MAX_SEG_SIZE] = {0};
-	char recv_seg[MAX_SEG_SIZE];
+	std::vector<struct mmsghdr> messages(count);
+	std::vector<struct iovec> iovs(2 * count);
+	std::vector<char> controls(this->kernel_timestamps ? count * TX_CONTROL_SIZE : 0);
+	// Each segment is encrypted as its message is built, while its payload
+	// is still in cache from being packed
+	size_t sealed_stride = MAX_DATA_SIZE + SegmentCipher::OVERHEAD;
+	std::vector<char> sealed(this->cipher ? count * sealed_stride : 0);
+	for (size_t i = 0; i < count; i++) {
+		OutstandingSegment &seg = this->outstanding[first + i];
+		this->prepare_transmission(seg);
+		this->build_message(seg, messages[i].msg_hdr, &iovs[2 * i],
+				controls.empty() ? NULL : &controls[i * TX_CONTROL_SIZE],
+				sealed.empty() ? NULL : &sealed[i * sealed_stride]);
+	}
 
-	RDTHeader* hdr = (RDTHeader*)send_seg;
-	hdr->ack_number = htonl(0);
-	hdr->sequence_number = htonl(0);
-	hdr->type = RDT_CLOSE;
-	
-	// Want to resend RDT_CLOSE if it times out
-	this->set_timeout_length(this->estimated_rtt + (4 * this->dev_rtt));
-
-	do
-	{
-			// Send RDT_CLOSE until receiving final ACK
-			memset(recv_seg, 0, MAX_SEG_SIZE);
-			this->reliable_send(send_seg, sizeof(RDTHeader), recv_seg);
-			hdr = (RDTHeader*)recv_seg;
-			if (hdr->type == RDT_ACK) {
-				break;
+	// The kernel may take fewer than all of them at once
+	size_t done = 0;
+	while (done < count) {
+		int sent = sendmmsg(this->sock_fd, &messages[done], count - done, 0);
+		if (sent < 0) {
+			if (errno == EINVAL && this->kernel_timestamps) {
+				// Sending the rest one at a time finds out whether the
+				// kernel takes timestamp requests
+				for (; done < count; done++) {
+					this->write_segment(this->outstanding[first + done]);
+				}
+				return;
+			}
+			// The retransmission timer resends whatever didn't go out
+			perror("sendmmsg");
+			return;
+		}
+		for (int i = 0; i < sent; i++, done++) {
+			if (this->kernel_timestamps) {
+				this->outstanding[first + done].tx_key = this->tx_timestamp_count++;
 			}
-	} while (true);
+		}
+	}
+}
+
+uint16_t ReliableSocket::advertised_window() {
+	if (this->discard_data) {
+		// Everything is thrown away, so there is always room
+		return RECV_BUFFER_SEGMENTS;
+	}
+	int room = RECV_BUFFER_SEGMENTS - (int)this->recv_queue.size();
+	size_t allowed = MemoryBudget::instance().allowance(this->send_buffered +
+			this->recv_buffered) / MAX_SEG_SIZE;
+	if (allowed < (size_t)room) {
+		room = allowed;
+	}
+	return room < 0 ? 0 : room;
+}
+
+bool ReliableSocket::charge_received(bool force) {
+	MemoryBudget &budget = MemoryBudget::instance();
+	if (force) {
+		budget.charge(MAX_SEG_SIZE);
+	} else if (!budget.try_charge(MAX_SEG_SIZE, this->send_buffered + this->recv_buffered)) {
+		return false;
+	}
+	this->recv_buffered += MAX_SEG_SIZE;
+	return true;
+}
+
+void ReliableSocket::release_received(bool leased) {
+	this->recv_buffered -= MAX_SEG_SIZE;
+	if (!leased) {
+		MemoryBudget::instance().release(MAX_SEG_SIZE);
+	}
+}
+
+uint32_t ReliableSocket::send_window() {
+	uint32_t window = this->congestion->window();
+	if (this->peer_window < window) {
+		window = this->peer_window;
+	}
+	// A closed window still lets one segment out. The remote host drops it
+	// until the application reads, so its retransmissions probe the window.
+	return window < 1 ? 1 : window;
+}
+
+void ReliableSocket::send_header(RDTMessageType type, uint32_t seq_num, uint32_t ack_num, uint8_t flags) {
+	char send_seg[sizeof(RDTHeader)] = {0};
+
+	RDTHeader* hdr = (RDTHeader*)send_seg;
+	hdr->sequence_number = htonl(seq_num);
+	hdr->ack_number = htonl(ack_num);
+	hdr->type = type;
+	hdr->flags = flags;
+	hdr->window = htons(this->advertised_window());
+
+	// An encrypted header is followed by the trailer that authenticates it
+	char trailer[SegmentCipher::OVERHEAD];
+	struct iovec iov[2];
+	iov[0].iov_base = send_seg;
+	iov[0].iov_len = sizeof(RDTHeader);
+	iov[1].iov_base = trailer;
+	iov[1].iov_len = 0;
+	if (this->is_sealed(type)) {
+		this->cipher->seal(hdr, sizeof(RDTHeader), NULL, 0, trailer);
+		iov[1].iov_len = sizeof(trailer);
+	}
+
+	this->stats.segments_sent++;
+	if (writev(this->sock_fd, iov, iov[1].iov_len > 0 ? 2 : 1) < 0) {
+		perror("send_header send");
+	}
+}
+
+bool ReliableSocket::is_sealed(RDTMessageType type) {
+	return this->cipher && type != RDT_SYN && type != RDT_SYNACK;
+}
+
+void ReliableSocket::send_ack(uint32_t seq_num) {
+	if (seq_num == this->expected_sequence_number - 1) {
+		this->ack_pending = false;
+		this->timers.cancel(TIMER_DELAYED_ACK);
+	}
+	this->send_header(RDT_ACK, seq_num, seq_num);
+}
+
+void ReliableSocket::send_probe() {
+	// Probes reuse the last acknowledged sequence number so their ACK can
+	// never be mistaken for the ACK of new data.
+	this->send_header(RDT_KEEPALIVE, this->send_base - 1, 0);
+}
+
+bool ReliableSocket::pump_until(std::unique_lock<std::mutex> &guard,
+		const std::function<bool()> &done) {
+	while (!done()) {
+		if (this->state == CLOSED) {
+			return false;
+		}
+		if (this->pumping) {
+			// Another thread is waiting on the socket, and wakes us whenever
+			// it has handled something
+			this->progress.wait(guard);
+			continue;
+		}
+
+		this->pumping = true;
+		int result = this->pump(true);
+		this->pumping = false;
+		this->progress.notify_all();
+		if (result < 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void ReliableSocket::wait_readable(int timeout_ms) {
+	struct pollfd fds[2];
+	fds[0].fd = this->sock_fd;
+	fds[0].events = POLLIN;
+	fds[1].fd = this->wake_fd;
+	fds[1].events = POLLIN;
+
+	// Let other threads send and read what was already received while we
+	// wait. The caller's lock is held again when this returns.
+	this->lock.unlock();
+	int ready = poll(fds, 2, timeout_ms);
+	this->lock.lock();
+
+	if (ready < 0 && errno != EINTR) {
+		perror("poll");
+		exit(EXIT_FAILURE);
+	}
+	if (ready > 0 && (fds[1].revents & POLLIN)) {
+		uint64_t count;
+		if (read(this->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+			perror("eventfd read");
+		}
+	}
+}
+
+void ReliableSocket::wake_pumper() {
+	if (!this->pumping) {
+		return;
+	}
+	uint64_t one = 1;
+	if (write(this->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		perror("eventfd write");
+	}
+}
+
+int64_t ReliableSocket::time_until_next_timer() {
+	return this->timers.time_until_next(monotonic_msec());
+}
+
+void ReliableSocket::update_close_state() {
+	if (this->state == CLOSED) {
+		return;
+	}
+
+	if (this->remote_closed && this->close_acked) {
+		this->state = CLOSING;
+	} else if (this->remote_closed) {
+		this->state = FIN;
+	} else if (this->close_acked) {
+		this->state = HALF_CLOSED;
+	}
+}
+
+// You should not modify this function in any way.
+uint32_t ReliableSocket::get_estimated_rtt() {
+	return this->estimated_rtt;
+}
+
+void ReliableSocket::set_estimated_rtt() {
+	// calculate the estimated_rtt (in a local, since readers of the atomic
+	// shouldn't see the halfway value)
+	int estimated = this->estimated_rtt;
+	estimated *= (1 - 0.125);
+	estimated += this->current_rtt * 0.125;
+	this->estimated_rtt = estimated;
+	this->dev_rtt *= (1 - 0.25);
+	// Find the difference (can't be negative)
+	int abs_dev = this->current_rtt - estimated;
+	if (abs_dev < 0) {
+		abs_dev *= -1;
+	}
+	this->dev_rtt += (abs_dev * 0.25);
+}
+
+uint64_t ReliableSocket::take_rtt_sample(const OutstandingSegment &seg) {
+	if (this->kernel_timestamps) {
+		// The transmit timestamp may still be queued
+		this->read_tx_timestamps();
+	}
+
+	uint64_t user_rtt = this->last_recv_usec > seg.sent_usec ?
+		this->last_recv_usec - seg.sent_usec : 0;
+	uint64_t rtt = user_rtt;
+	if (seg.sent_kernel_ns != 0 && this->last_recv_kernel_ns > seg.sent_kernel_ns) {
+		uint64_t kernel_rtt = (this->last_recv_kernel_ns - seg.sent_kernel_ns) / 1000;
+		// The kernel clock may be adjusted while the monotonic one isn't, so
+		// distrust kernel samples that are longer than the user-space one
+		if (kernel_rtt <= user_rtt) {
+			rtt = kernel_rtt;
+			this->stats.kernel_rtt_samples++;
+			this->stats.user_rtt_excess_us += user_rtt - kernel_rtt;
+		}
+	}
+
+	this->stats.rtt_samples++;
+	this->stats.last_rtt_us = rtt;
+	this->stats.last_user_rtt_us = user_rtt;
+
+	this->current_rtt = (rtt + 500) / 1000;
+	this->set_estimated_rtt();
+	return rtt;
+}
+
+RDTStats ReliableSocket::get_stats() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	RDTStats stats = this->stats;
+	stats.estimated_rtt_ms = this->estimated_rtt;
+	stats.rto_ms = this->rto();
+	stats.delivery_rate = this->delivery_rate();
+	stats.congestion_window = this->congestion->window();
+	stats.protocol_mode = this->congestion->mode();
+	stats.peer_window = this->peer_window;
+	stats.send_buffered = this->send_buffered;
+	stats.recv_buffered = this->recv_buffered;
+	stats.cipher_suite = this->cipher ? this->cipher->suite() : 0;
+	stats.send_hash = this->send_hash.digest();
+	stats.recv_hash = this->recv_hash.digest();
+	stats.bytes_received = this->recv_hash.length();
+	stats.remote_hash = this->remote_hash;
+	stats.transfer_check = this->transfer_check;
+	return stats;
+}
+
+void ReliableSocket::set_congestion_control(std::unique_ptr<CongestionController> controller) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->congestion = std::move(controller);
+}
+
+void ReliableSocket::enable_encryption(const std::string &psk) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (this->state != INIT) {
+		cerr << "Cannot enable encryption on used socket\n";
+		return;
+	}
+	this->cipher = std::make_unique<SegmentCipher>(psk);
+}
+
+void ReliableSocket::seed_from_cache(uint32_t addr) {
+	this->peer_addr = addr;
 
+	PeerInfo info;
+	if (!PeerCache::instance().lookup(addr, &info)) {
+		return;
+	}
+	cerr << "INFO: Starting from cached RTT of " << info.srtt_ms << " ms (deviation "
+		<< info.rttvar_ms << " ms) and delivery rate of " << info.delivery_rate << " B/s\n";
+	this->estimated_rtt = info.srtt_ms;
+	this->dev_rtt = info.rttvar_ms;
+	this->congestion->seed((double)info.delivery_rate / MAX_DATA_SIZE, info.srtt_ms);
+}
+
+uint64_t ReliableSocket::delivery_rate() {
+	// A handful of stop-and-wait segments says more about the RTT than
+	// about the bandwidth
+	const uint64_t MIN_RATE_BYTES = 16 * MAX_DATA_SIZE;
+	if (this->stats.bytes_acked < MIN_RATE_BYTES || this->data_acked_usec <= this->data_start_usec) {
+		return 0;
+	}
+	return this->stats.bytes_acked * 1000000 / (this->data_acked_usec - this->data_start_usec);
+}
+
+uint32_t ReliableSocket::rto() {
+	// On a fast link both estimates round down to 0, and a timeout of 0
+	// would never grow when it is doubled. A window of segments also queues
+	// up behind the first, so the floor leaves room for that.
+	uint32_t timeout = this->estimated_rtt + 4 * this->dev_rtt;
+	return timeout < MIN_RTO ? MIN_RTO : timeout;
+}
+
+// You shouldn't need to modify this function in any way.
+void ReliableSocket::set_timeout_length(uint32_t timeout_length_ms) {
+	cerr << "INFO: Setting timeout to " << timeout_length_ms << " ms\n";
+	struct timeval timeout;
+	msec_to_timeval(timeout_length_ms, &timeout);
+
+	if (setsockopt(this->sock_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,sizeof(struct timeval)) < 0) {
+		perror("setsockopt");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void ReliableSocket::send_data(const void *data, int length) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if ((this->coalesce_delay > 0 || this->corked) && length > 0) {
+		this->coalesce_locked(guard, (const char*)data, length);
+		return;
+	}
+	// Whatever is pending goes first, so the data stays in order
+	if (this->send_pending(guard)) {
+		this->send_locked(guard, data, length);
+	}
+}
+
+void ReliableSocket::coalesce_locked(std::unique_lock<std::mutex> &guard, const char *data,
+		int length) {
+	if (!this->can_send()) {
+		cerr << "INFO: Cannot send: Connection not established.\n";
+		return;
+	}
+
+	while (length > 0) {
+		int size = this->add_pending(data, length);
+		data += size;
+		length -= size;
+
+		if ((int)this->pending_data.size() == MAX_DATA_SIZE && !this->send_pending(guard)) {
+			return;
+		}
+	}
+
+	if (!this->pending_data.empty() && !this->corked && this->pending_due()) {
+		this->send_pending(guard);
+	}
+}
+
+int ReliableSocket::add_pending(const char *data, int length) {
+	if (this->pending_data.empty()) {
+		this->flush_deadline = monotonic_msec() + this->coalesce_delay;
+	}
+	int room = MAX_DATA_SIZE - this->pending_data.size();
+	int size = length < room ? length : room;
+	this->pending_data.insert(this->pending_data.end(), data, data + size);
+	return size;
+}
+
+bool ReliableSocket::pending_due() {
+	if (monotonic_msec() >= this->flush_deadline) {
+		// Nobody was pumping when the timer expired
+		return true;
+	}
+	if (!this->timers.is_scheduled(TIMER_COALESCE)) {
+		this->timers.schedule(TIMER_COALESCE, this->flush_deadline);
+		this->wake_pumper();
+	}
+	return false;
+}
+
+std::vector<char> ReliableSocket::take_pending() {
+	std::vector<char> data;
+	data.swap(this->pending_data);
+	this->timers.cancel(TIMER_COALESCE);
+	this->flush_due = false;
+	return data;
+}
+
+bool ReliableSocket::send_pending(std::unique_lock<std::mutex> &guard) {
+	if (this->pending_data.empty()) {
+		return true;
+	}
+	// Taken out first, since other threads may add to it while we wait for
+	// the window
+	std::vector<char> data = this->take_pending();
+	return this->send_locked(guard, data.data(), data.size());
+}
+
+void ReliableSocket::send_due_pending() {
+	if (!this->flush_due || this->pending_data.empty()) {
+		return;
+	}
+	if (!this->can_send() || !this->window_open()) {
+		// The next ACK that opens the window sends it
+		return;
+	}
+	this->send_reliably(RDT_DATA, this->pending_data.data(), this->pending_data.size());
+	this->pending_data.clear();
+	this->flush_due = false;
+}
+
+void ReliableSocket::cork() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->corked = true;
+	this->timers.cancel(TIMER_COALESCE);
+	this->flush_due = false;
+}
+
+void ReliableSocket::flush() {
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->corked = false;
+	this->send_pending(guard);
+}
+
+size_t ReliableSocket::send_buffer(std::shared_ptr<const void> owner, const void *buffer,
+		size_t length) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (!this->send_pending(guard)) {
+		return 0;
+	}
+	const char *data = (const char*)buffer;
+	size_t sent = 0;
+	while (sent < length) {
+		int size = length - sent < (size_t)MAX_DATA_SIZE ? length - sent : MAX_DATA_SIZE;
+		if (!this->send_locked(guard, data + sent, size, owner)) {
+			break;
+		}
+		sent += size;
+	}
+	return sent;
+}
+
+size_t ReliableSocket::send_batch(std::span<const struct iovec> records) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (!this->send_pending(guard)) {
+		return 0;
+	}
+	if (!this->can_send()) {
+		cerr << "INFO: Cannot send: Connection not established.\n";
+		return 0;
+	}
+
+	size_t sent = 0; // records wholly queued
+	size_t offset = 0; // bytes of records[sent] already queued
+	std::vector<char> segment;
+	segment.reserve(MAX_DATA_SIZE);
+	while (sent < records.size()) {
+		if (!this->pump_until(guard, [this] { return this->window_open(); })) {
+			cerr << "ERROR: Remote host stopped responding, aborting connection\n";
+			break;
+		}
+
+		// Pack as many segments as the window has room for, then send them
+		// with one system call
+		size_t first = this->outstanding.size();
+		while (sent < records.size() && this->window_open()) {
+			segment.clear();
+			while (sent < records.size() && (int)segment.size() < MAX_DATA_SIZE) {
+				const struct iovec &record = records[sent];
+				size_t left = record.iov_len - offset;
+				size_t room = MAX_DATA_SIZE - segment.size();
+				if (offset == 0 && left > room && left <= (size_t)MAX_DATA_SIZE) {
+					// It fits in the next segment, so don't split it
+					break;
+				}
+				size_t size = left < room ? left : room;
+				const char *data = (const char*)record.iov_base + offset;
+				segment.insert(segment.end(), data, data + size);
+				offset += size;
+				if (offset == record.iov_len) {
+					sent++;
+					offset = 0;
+				}
+			}
+			if (!segment.empty()) {
+				this->queue_segment(RDT_DATA, segment.data(), segment.size());
+			}
+		}
+		this->transmit_batch(first);
+		this->start_retransmit_timer();
+	}
+	return sent;
+}
+
+ssize_t ReliableSocket::send_file(int fd) {
+	struct stat file_stat;
+	if (fstat(fd, &file_stat) < 0 || !S_ISREG(file_stat.st_mode)) {
+		return -1;
+	}
+	off_t offset = lseek(fd, 0, SEEK_CUR);
+	if (offset < 0) {
+		return -1;
+	}
+	if (file_stat.st_size <= offset) {
+		return 0;
+	}
+
+	size_t size = file_stat.st_size;
+	void *base = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		return -1;
+	}
+	madvise(base, size, MADV_SEQUENTIAL);
+
+	// Unmapped once the last segment referring to it is acknowledged
+	std::shared_ptr<const void> mapping(base, [size](const void *addr) {
+		munmap((void*)addr, size);
+	});
+	size_t sent = this->send_buffer(mapping, (const char*)base + offset, size - offset);
+	lseek(fd, offset + sent, SEEK_SET);
+	return sent;
+}
+
+bool ReliableSocket::send_locked(std::unique_lock<std::mutex> &guard, const void *data, int length,
+		std::shared_ptr<const void> owner) {
+	if (!this->can_send()) {
+		cerr << "INFO: Cannot send: Connection not established.\n";
+		return false;
+	}
+
+	// Wait for room in the window. Anything the remote host sends meanwhile
+	// is queued for receive_data().
+	if (!this->pump_until(guard, [this] { return this->window_open(); })) {
+		cerr << "ERROR: Remote host stopped responding, aborting connection\n";
+		return false;
+	}
+	this->send_reliably(RDT_DATA, data, length, std::move(owner));
+	return true;
+}
+
+bool ReliableSocket::can_send() {
+	// After the remote host shuts down its sending side we can still send
+	// to it (e.g. a response to its request)
+	return this->state == ESTABLISHED || this->state == FIN;
+}
+
+bool ReliableSocket::window_open() {
+	if (this->outstanding.size() >= this->send_window()) {
+		return false;
+	}
+	// Under memory pressure, wait for ACKs to free what we already hold
+	return this->outstanding.empty() || MemoryBudget::instance().allowance(
+			this->send_buffered + this->recv_buffered) >= MAX_SEG_SIZE;
+}
+
+bool ReliableSocket::all_acked() {
+	return this->outstanding.empty();
+}
+
+bool ReliableSocket::can_receive() {
+	// We can still receive after shutting down our own sending side
+	return this->state == ESTABLISHED || this->state == FIN ||
+		this->state == HALF_CLOSED || this->state == CLOSING;
+}
+
+
+int ReliableSocket::receive_data(char buffer[MAX_DATA_SIZE]) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (!this->can_receive()) {
+		cerr << "INFO: Cannot receive: Connection not established.\n";
+		return 0;
+	}
+
+	// This only fails if keepalives or the idle timeout decide the remote
+	// host is gone
+	if (!this->pump_until(guard, [this] { return this->receive_ready(); })) {
+		return -1;
+	}
+	return this->take_received(buffer);
+}
+
+bool ReliableSocket::receive_ready() {
+	return !this->recv_queue.empty() || this->remote_closed || this->state == CLOSED;
+}
+
+int ReliableSocket::take_received(char buffer[MAX_DATA_SIZE]) {
+	if (this->recv_queue.empty()) {
+		// Remote host has finished sending
+		return this->state == CLOSED ? -1 : 0;
+	}
+
+	// Output the oldest data (what is left of it)
+	ReceivedSegment received = this->recv_queue.front();
+	int size = received.data_size - this->recv_offset;
+	memcpy(buffer, received.segment + sizeof(RDTHeader) + this->recv_offset, size);
+	this->pop_received();
+	this->segment_pool.release(received.segment);
+
+	return size;
+}
+
+ssize_t ReliableSocket::receive_data(void *buffer, size_t length) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (!this->can_receive()) {
+		cerr << "INFO: Cannot receive: Connection not established.\n";
+		return 0;
+	}
+
+	if (!this->pump_until(guard, [this] { return this->receive_ready(); })) {
+		return -1;
+	}
+	this->drain_arrived(length);
+	return this->take_received((char*)buffer, length);
+}
+
+ssize_t ReliableSocket::take_received(char *buffer, size_t length) {
+	if (this->recv_queue.empty()) {
+		return this->state == CLOSED ? -1 : 0;
+	}
+
+	size_t copied = 0;
+	while (!this->recv_queue.empty() && copied < length) {
+		ReceivedSegment received = this->recv_queue.front();
+		if (received.data_size == 0) {
+			// The end of a transfer is returned as 0 by itself
+			if (copied == 0) {
+				this->pop_received();
+				this->segment_pool.release(received.segment);
+			}
+			break;
+		}
+
+		size_t left = received.data_size - this->recv_offset;
+		size_t size = left < length - copied ? left : length - copied;
+		memcpy(buffer + copied, received.segment + sizeof(RDTHeader) + this->recv_offset, size);
+		copied += size;
+		if (size < left) {
+			// The rest of the segment is for the next call
+			this->recv_offset += size;
+			break;
+		}
+		this->pop_received();
+		this->segment_pool.release(received.segment);
+	}
+	return copied;
+}
+
+void ReliableSocket::drain_arrived(size_t wanted) {
+	if (this->pumping) {
+		return;
+	}
+
+	while (this->recv_queue.size() < (size_t)RECV_BUFFER_SEGMENTS) {
+		size_t queued = 0;
+		for (ReceivedSegment &received : this->recv_queue) {
+			if (received.data_size == 0) {
+				// Nothing after the end of a transfer can be returned with it
+				return;
+			}
+			queued += received.data_size;
+		}
+		if (queued - this->recv_offset >= wanted || this->pump(false) <= 0) {
+			return;
+		}
+	}
+}
+
+int ReliableSocket::receive_data(SegmentLease &lease) {
+	lease.release();
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (!this->can_receive()) {
+		cerr << "INFO: Cannot receive: Connection not established.\n";
+		return 0;
+	}
+
+	if (!this->pump_until(guard, [this] { return this->receive_ready(); })) {
+		return -1;
+	}
+	return this->take_received(lease);
+}
+
+int ReliableSocket::take_received(SegmentLease &lease) {
+	if (this->recv_queue.empty()) {
+		return this->state == CLOSED ? -1 : 0;
+	}
+
+	ReceivedSegment received = this->recv_queue.front();
+	int offset = this->recv_offset;
+	// The buffer stays charged to the budget for as long as the
+	// application holds it
+	this->pop_received(true);
+	lease = SegmentLease(&this->segment_pool, received.segment, sizeof(RDTHeader) + offset,
+			received.data_size - offset, MAX_SEG_SIZE);
+
+	return received.data_size - offset;
+}
+
+void ReliableSocket::pop_received(bool leased) {
+	bool window_was_closed = this->advertised_window() == 0;
+	this->recv_queue.pop_front();
+	this->recv_offset = 0;
+	this->release_received(leased);
+	if (window_was_closed && this->state != CLOSED) {
+		// The remote host is waiting to hear that there is room again
+		this->send_ack(this->expected_sequence_number - 1);
+	}
+}
+
+void ReliableSocket::clear_recv_queue() {
+	for (ReceivedSegment &received : this->recv_queue) {
+		this->segment_pool.release(received.segment);
+		this->release_received();
+	}
+	this->recv_queue.clear();
+	this->recv_offset = 0;
+}
+
+void ReliableSocket::end_transfer() {
+	// An empty segment makes the remote receive_data() return 0
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (this->send_pending(guard)) {
+		this->send_locked(guard, "", 0);
+	}
+}
+
+bool ReliableSocket::probe_remote(int max_attempts) {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (this->state != ESTABLISHED) {
+		return false;
+	}
+
+	uint64_t probe_start = monotonic_msec();
+	uint32_t timeout = this->rto();
+
+	for (int attempt = 0; attempt < max_attempts; attempt++) {
+		this->send_probe();
+		this->timers.schedule(TIMER_PROBE, monotonic_msec() + timeout);
+		this->wake_pumper();
+
+		// Any segment from the remote host shows it is alive
+		if (!this->pump_until(guard, [this, probe_start] {
+				return !this->timers.is_scheduled(TIMER_PROBE) || this->last_heard >= probe_start; })) {
+			return false;
+		}
+		if (this->last_heard >= probe_start) {
+			this->timers.cancel(TIMER_PROBE);
+			return true;
+		}
+		timeout *= 2;
+	}
+
+	cerr << "INFO: Remote host did not answer keepalive probe\n";
+	return false;
+}
+
+void ReliableSocket::abort_connection() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->drop_connection();
+}
+
+void ReliableSocket::drop_connection() {
+	if (this->state == CLOSED) {
+		return;
+	}
+
+	this->state = CLOSED;
+	this->pending_data.clear();
+	if (close(this->sock_fd) < 0) {
+		perror("abort_connection close");
+	}
+	this->wake_pumper();
+	cerr << "Connection aborted\n";
+}
+
+connection_status ReliableSocket::get_state() {
+	return this->state;
+}
+
+void ReliableSocket::set_keepalive(int idle_ms, int interval_ms, int max_probes) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->keepalive_idle = idle_ms;
+	this->keepalive_interval = interval_ms;
+	this->keepalive_max_probes = max_probes;
+
+	if (idle_ms > 0) {
+		this->timers.schedule(TIMER_KEEPALIVE, this->last_heard + idle_ms);
+		this->wake_pumper();
+	} else {
+		this->timers.cancel(TIMER_KEEPALIVE);
+	}
+}
+
+void ReliableSocket::set_delayed_ack(int delay_ms) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->delayed_ack = delay_ms;
+}
+
+void ReliableSocket::set_coalescing(int delay_ms) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->coalesce_delay = delay_ms;
+}
+
+void ReliableSocket::set_buffer_placement(int numa_node, bool huge_pages) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->segment_pool.set_placement(numa_node, huge_pages);
+}
+
+void ReliableSocket::set_idle_timeout(int timeout_ms) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->idle_timeout = timeout_ms;
+
+	if (timeout_ms > 0) {
+		this->timers.schedule(TIMER_IDLE, this->last_heard + timeout_ms);
+		this->wake_pumper();
+	} else {
+		this->timers.cancel(TIMER_IDLE);
+	}
+}
+
+void ReliableSocket::heard_from_remote() {
+	this->last_heard = monotonic_msec();
+	this->keepalive_probes_sent = 0;
+
+	if (this->keepalive_idle > 0) {
+		this->timers.schedule(TIMER_KEEPALIVE, this->last_heard + this->keepalive_idle);
+	}
+	if (this->idle_timeout > 0) {
+		this->timers.schedule(TIMER_IDLE, this->last_heard + this->idle_timeout);
+	}
+}
+
+bool ReliableSocket::remote_timed_out() {
+	return this->idle_timeout > 0 &&
+		monotonic_msec() - this->last_heard >= (uint64_t)this->idle_timeout;
+}
+
+bool ReliableSocket::service_idle() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (this->state != ESTABLISHED) {
+		return false;
+	}
+
+	// Handle everything that has already arrived without waiting for more
+	int result;
+	while ((result = this->pump(false)) > 0) {
+	}
+
+	return result == 0 && this->state == ESTABLISHED;
+}
+
+void ReliableSocket::shutdown_send() {
+	std::unique_lock<std::mutex> guard(this->lock);
+	if (this->state == FIN) {
+		// Remote host is already done, so this finishes the teardown
+		this->close_locked(guard);
+		return;
+	}
+	if (this->state != ESTABLISHED) {
+		cerr << "INFO: Cannot shutdown: Connection not established.\n";
+		return;
+	}
+	if (!this->send_pending(guard)) {
+		return;
+	}
+
+	if (!this->pump_until(guard, [this] { return this->all_acked(); })) {
+		return;
+	}
+	this->send_close();
+	this->pump_until(guard, [this] { return this->all_acked(); });
+}
+
+void ReliableSocket::close_connection() {
+	std::unique_lock<std::mutex> guard(this->lock);
+	this->close_locked(guard);
+}
+
+void ReliableSocket::close_locked(std::unique_lock<std::mutex> &guard) {
+	if (this->can_send()) {
+		this->send_pending(guard);
+	}
+	if (!this->start_close()) {
+		return;
+	}
+
+	if (!this->pump_until(guard, [this] { return this->all_acked(); })) {
+		return;
+	}
+	this->send_close();
+	if (!this->pump_until(guard, [this] { return this->all_acked(); })) {
+		return;
+	}
+	if (!this->pump_until(guard, [this] { return this->remote_closed; })) {
+		return;
+	}
+
+	if (this->needs_time_wait) {
+		this->start_time_wait();
+		if (!this->pump_until(guard, [this] { return !this->timers.is_scheduled(TIMER_TIME_WAIT); })) {
+			return;
+		}
+	}
+
+	this->finish_close();
+}
+
+bool ReliableSocket::start_close() {
+	if (this->state == CLOSED) {
+		// Already aborted, so there is nothing left to tear down
+		return false;
+	}
+	if (this->state != ESTABLISHED && this->state != FIN &&
+			this->state != HALF_CLOSED && this->state != CLOSING) {
+		// Handshake never finished
+		this->drop_connection();
+		return false;
+	}
+
+	// The application won't read anything else, but the remote host can't
+	// finish until the data it is still sending is acknowledged
+	this->discard_data = true;
+	this->clear_recv_queue();
+	return true;
+}
+
+void ReliableSocket::send_close() {
+	if (this->close_sent) {
+		// shutdown_send() already did
+		return;
+	}
+
+	// The RDT_CLOSE takes the next sequence number, so it is only delivered
+	// after all of our data
+	this->close_sent = true;
+	uint64_t hash = htobe64(this->send_hash.digest());
+	this->send_reliably(RDT_CLOSE, &hash, sizeof(hash));
+}
+
+void ReliableSocket::start_time_wait() {
+	// Enter the TIME_WAIT state in case our final ACK is lost and the
+	// remote host's RDT_CLOSE is retransmitted
+	this->timers.cancel(TIMER_KEEPALIVE);
+	this->timers.schedule(TIMER_TIME_WAIT, monotonic_msec() + TIME_WAIT);
+}
+
+void ReliableSocket::finish_close() {
+	// Let the next connection to this host start from what we measured.
+	// (Aborted connections are left out: their RTT is likely bogus.)
+	if (this->peer_addr != 0 && this->stats.rtt_samples > 0) {
+		PeerCache::instance().record(this->peer_addr, this->estimated_rtt, this->dev_rtt,
+				this->delivery_rate());
+	}
+
+	// Connection teardown is complete. Close the connection
+	this->state = CLOSED;
+	if (close(this->sock_fd) < 0) {
+		perror("close_connection close");
+	}
+	cerr << "Connection successfully closed\n";
 }
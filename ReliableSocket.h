@@ -5,37 +5,167 @@
  * unreliable link.
  *
  */
+#ifndef RELIABLE_SOCKET_H
+#define RELIABLE_SOCKET_H
 
-enum RDTMessageType : uint8_t {RDT_SYN, RDT_SYNACK, RDT_ACK, RDT_DATA, RDT_CLOSE};
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include "CongestionController.h"
+#include "ReassemblyRing.h"
+#include "SegmentCipher.h"
+#include "SegmentPool.h"
+#include "rdt_hash.h"
+#include "rdt_timer.h"
+
+enum RDTMessageType : uint8_t {RDT_SYN, RDT_SYNACK, RDT_ACK, RDT_DATA, RDT_CLOSE,
+	RDT_KEEPALIVE,
+	// Multicast distribution (see MulticastSender and MulticastReceiver)
+	RDT_MCAST_DATA, RDT_MCAST_PARITY, RDT_MCAST_NACK, RDT_MCAST_CLOSE};
+
+// Bits of RDTHeader::flags
+enum RDTFlags : uint8_t {
+	RDT_FLAG_ACK = 0x01, // ack_number acknowledges the sender's data
+	RDT_FLAG_HANDSHAKE = 0x02 // RDT_ACK that only completes the handshake
+};
 
 /**
  * Format for the header of a segment send by our reliable socket.
+ *
+ * ACKs are cumulative: an RDT_ACK acknowledges every segment up to and
+ * including the one whose sequence number is in ack_number. Any other
+ * segment with RDT_FLAG_ACK set also carries (i.e. piggybacks) an
+ * acknowledgement of the last in-order segment its sender received, so a
+ * reply doesn't need a separate RDT_ACK.
+ *
+ * Every segment advertises in window how many more segments past the ones
+ * it acknowledges its sender can buffer.
  */
 struct RDTHeader {
 	uint32_t sequence_number;
 	uint32_t ack_number;
 	RDTMessageType type;
+	uint8_t flags;
+	uint16_t window;
 };
 
-enum connection_status { INIT, ESTABLISHED, FIN, CLOSED};
+/**
+ * Outcome of comparing the hash of the data we received with the remote
+ * host's hash of what it sent, which its RDT_CLOSE carries.
+ */
+enum RDTTransferCheck : uint32_t {
+	RDT_CHECK_PENDING, // the remote host hasn't closed yet
+	RDT_CHECK_PASSED,
+	RDT_CHECK_FAILED,
+	RDT_CHECK_UNAVAILABLE // its RDT_CLOSE carried no hash
+};
+
+/**
+ * Counters for one connection (see ReliableSocket::get_stats()).
+ *
+ * RTT samples are taken from kernel timestamps (SO_TIMESTAMPING) of when a
+ * segment left and when its ACK arrived, so they leave out the time our
+ * thread spent waiting to be scheduled. If the kernel doesn't provide the
+ * timestamps, user-space timestamps are used instead. Both are kept for
+ * every sample, so the difference shows how much a user-space measurement
+ * would have overestimated.
+ */
+struct RDTStats {
+	uint64_t segments_sent; // including retransmissions and bare ACKs
+	uint64_t retransmissions;
+	uint64_t fast_retransmits; // retransmissions triggered by duplicate ACKs
+	uint64_t segments_received;
+	uint64_t rtt_samples;
+	uint64_t kernel_rtt_samples; // samples measured with kernel timestamps
+	uint64_t last_rtt_us; // most recent sample used for the estimate
+	uint64_t last_user_rtt_us; // the same sample measured in user space
+	uint64_t user_rtt_excess_us; // total of user RTT minus kernel RTT
+	uint64_t bytes_acked; // application data acknowledged
+	uint64_t bytes_received; // application data received in order
+	uint64_t delivery_rate; // bytes per second acknowledged, 0 until known
+	uint32_t estimated_rtt_ms;
+	uint32_t rto_ms;
+	uint32_t congestion_window; // segments the congestion controller allows in flight
+	ProtocolMode protocol_mode; // stop-and-wait or windowed, as the controller chose
+	uint32_t peer_window; // segments the remote host last advertised
+	uint64_t send_buffered; // bytes of sent segments waiting for their ACK
+	uint64_t recv_buffered; // bytes of received segments the application hasn't read
+	uint64_t segments_rejected; // dropped for failing authentication (see enable_encryption())
+	uint32_t cipher_suite; // SegmentCipher::Suite in use, 0 if not encrypted
+	uint64_t send_hash; // XXH64 of the data sent (see StreamHash)
+	uint64_t recv_hash; // XXH64 of the data received in order
+	uint64_t remote_hash; // the remote host's send_hash, once it has closed
+	RDTTransferCheck transfer_check; // recv_hash against remote_hash
+};
+
+/**
+ * States of a connection. FIN means the remote host has finished sending;
+ * HALF_CLOSED means we have (see shutdown_send()); CLOSING means both have
+ * and only the final ACK is left.
+ */
+enum connection_status { INIT, SYN_SENT, SYN_RECEIVED, ESTABLISHED, FIN,
+	HALF_CLOSED, CLOSING, CLOSED};
 
 /**
  * Class that represents a socket using a reliable data transport protocol.
- * This socket uses a stop-and-wait protocol so your data is sent at a nice,
- * leisurely pace.
+ *
+ * Segments are sent in a sliding window: send_data() returns as soon as its
+ * segment is sent, and only waits while the window is full. The window is
+ * whatever the connection's CongestionController allows, capped by what the
+ * remote host advertises it can buffer. The default AdaptiveController
+ * measures the path in the first round trips and then stops and waits if
+ * its bandwidth-delay product is under a segment, or keeps about that
+ * product in flight otherwise. Lost segments are retransmitted when the retransmission timer
+ * expires, or after three duplicate ACKs.
+ *
+ * Data can flow in both directions at once: either side may call send_data()
+ * and receive_data() in any order. Data that arrives while the application
+ * is sending is kept (up to RECV_BUFFER_SEGMENTS segments) until it calls
+ * receive_data().
+ *
+ * The methods may be called from several threads at once, e.g. one thread
+ * sending while another receives, or several threads sending (each
+ * send_data() call is one segment, so their segments interleave but are
+ * never split, unless set_coalescing() or cork() merges small ones). Only
+ * one thread at a time waits on the UDP socket; it releases the lock while
+ * it waits and wakes the others whenever it has handled a segment or timer,
+ * so a sender blocked on a full window and a receiver blocked on an empty
+ * queue both make progress. get_state() and get_estimated_rtt() never
+ * block.
  */
 class ReliableSocket {
+	// The coroutine API drives the same protocol steps as the blocking API
+	friend class AsyncReliableSocket;
+
 public:
 	
 	// These are constants for all reliable connections
 	static const int MAX_SEG_SIZE  = 1400;
 	static const int MAX_DATA_SIZE = MAX_SEG_SIZE - sizeof(RDTHeader);
+	// Largest datagram: an encrypted segment carries a trailer as well
+	static const int MAX_WIRE_SIZE = MAX_SEG_SIZE + SegmentCipher::OVERHEAD;
 	static const int TIME_WAIT = 4000; // timed wait for closing the connection
+	static const int RECV_BUFFER_SEGMENTS = 32; // received data not yet read
+	static const uint32_t MIN_RTO = 10; // lower bound on the retransmission timeout (ms)
 	/**
 	 * Basic Constructor, setting estimated RTT to 100 and deviation RTT to 10.
 	 */
 	ReliableSocket();
 
+	~ReliableSocket();
+
 	/**
 	 * Connects to the specified remote hostname on the given port.
 	 *
@@ -45,49 +175,408 @@ public:
 	void connect_to_remote(char *hostname, int port_num);
 
 	/**
-	 * Waits for a connection attempt from a remote host.
+	 * Waits for a connection attempt from a remote host. Another thread may
+	 * call abort_connection() to stop waiting.
 	 *
 	 * @param port_num The port number to listen on.
 	 */
 	void accept_connection(int port_num);
 
 	/**
-	 * Send data to connected remote host.
+	 * Send data to connected remote host, waiting first if the window is
+	 * full.
 	 *
 	 * @param buffer The buffer with data to be sent.
 	 * @param length The amount of data in the buffer to send.
 	 */
 	void send_data(const void *buffer, int length);
 
+	/**
+	 * Sends a buffer of any size without copying it: each segment refers to
+	 * its part of the buffer until it is acknowledged, and only its header
+	 * is rebuilt when it is retransmitted. Memory for the send window is
+	 * then a header per segment rather than a copy of the window's data.
+	 *
+	 * @param owner Keeps the buffer alive (e.g. a chunk of the
+	 * 		application's send ring). The socket holds it until every
+	 * 		segment referring to the buffer has been acknowledged, and the
+	 * 		buffer must not change meanwhile.
+	 * @param buffer The data to send.
+	 * @param length Its size.
+	 * @return The amount of data sent, less than length if the connection
+	 * 		failed.
+	 */
+	size_t send_buffer(std::shared_ptr<const void> owner, const void *buffer, size_t length);
+
+	/**
+	 * Sends many small records (e.g. log lines or messages) in one call:
+	 * they are packed into as few segments as possible, and each window's
+	 * worth of segments goes out with a single sendmmsg(). A record no
+	 * larger than MAX_DATA_SIZE is never split across segments, so the
+	 * remote host's receive_data() returns whole records. Pending
+	 * coalesced data (see set_coalescing()) is sent first.
+	 *
+	 * @param records The records, in order.
+	 * @return The number of records sent. Every record before that index
+	 * 		was sent; if it is less than records.size(), the connection
+	 * 		failed, the record at that index may have been sent in part and
+	 * 		those after it weren't sent at all.
+	 */
+	size_t send_batch(std::span<const struct iovec> records);
+
+	/**
+	 * Sends the rest of a regular file (from its current offset) by mapping
+	 * it into memory and sending from the mapping with send_buffer(), and
+	 * moves the file offset past what was sent.
+	 *
+	 * @note The file must not be truncated while it is being sent.
+	 *
+	 * @param fd The open file.
+	 * @return The amount of data sent, or -1 if the file can't be mapped
+	 * 		(e.g. it is a pipe), in which case nothing was sent.
+	 */
+	ssize_t send_file(int fd);
+
 	/**
 	 * Receives data from remote host using a reliable connection.
 	 *
 	 * @param buffer The buffer where received data will be stored.
-	 * @return The amount of data actually received.
+	 * @return The amount of data actually received, or -1 if the remote host
+	 * 		stopped responding and the connection was aborted.
 	 */
 	int receive_data(char buffer[MAX_DATA_SIZE]);
 
+	/**
+	 * Receives data like receive_data(), but leaves it in the buffer it was
+	 * received into instead of copying it out.
+	 *
+	 * @param lease Set to a view of the received data. The socket can't
+	 * 		reuse the buffer until the lease is released.
+	 * @return The amount of data received, 0 at the end of the transfer, or
+	 * 		-1 if the connection was aborted.
+	 */
+	int receive_data(SegmentLease &lease);
+
+	/**
+	 * Receives as much data as is available and fits, rather than one
+	 * segment: waits until some has arrived, then also processes segments
+	 * already waiting on the UDP socket, and copies out a run of in-order
+	 * data that may span many segments. A bulk consumer with a large
+	 * buffer then makes one call per run instead of one per segment.
+	 *
+	 * @note A segment that doesn't fit is returned in part, and the rest
+	 * of it by the next call (of any receive_data()). The end of a
+	 * transfer (see end_transfer()) is never merged with data before it.
+	 *
+	 * @param buffer The buffer where received data will be stored.
+	 * @param length Its size (greater than 0).
+	 * @return The amount of data received, 0 at the end of the transfer, or
+	 * 		-1 if the connection was aborted.
+	 */
+	ssize_t receive_data(void *buffer, size_t length);
+
+	/**
+	 * Marks the end of one transfer without tearing down the connection.
+	 *
+	 * @note This sends an empty data segment, so the remote host's
+	 * receive_data() returns 0 while the connection stays ESTABLISHED and
+	 * can be used for the next transfer.
+	 */
+	void end_transfer();
+
+	/**
+	 * Checks that the remote host is still responding by sending an
+	 * RDT_KEEPALIVE probe and waiting for its ACK.
+	 *
+	 * @param max_attempts Number of probes to send before giving up.
+	 * @return true if the remote host acknowledged a probe.
+	 */
+	bool probe_remote(int max_attempts);
+
+	/**
+	 * Enables keepalive probes while waiting for data. After idle_ms without
+	 * hearing from the remote host an RDT_KEEPALIVE probe is sent, and
+	 * another every interval_ms until the remote host answers. If max_probes
+	 * go unanswered the connection is aborted.
+	 *
+	 * @param idle_ms Silence before the first probe (0 disables keepalives).
+	 * @param interval_ms Time between unanswered probes.
+	 * @param max_probes Number of unanswered probes before giving up.
+	 */
+	void set_keepalive(int idle_ms, int interval_ms, int max_probes);
+
+	/**
+	 * Delays the ACK for received data by up to delay_ms, so that it can
+	 * ride on the next segment we send (e.g. the response to a request)
+	 * instead of going out as a separate RDT_ACK.
+	 *
+	 * @note The remote host can't move its window past the data until this
+	 * ACK arrives, so only use this when the application usually answers
+	 * what it receives quickly. A second segment arriving while an ACK is
+	 * held back is acknowledged at once.
+	 *
+	 * @param delay_ms Longest time an ACK is held back (0, the default,
+	 * 		acknowledges immediately).
+	 */
+	void set_delayed_ack(int delay_ms);
+
+	/**
+	 * Coalesces small writes: send_data() adds its data to a pending
+	 * segment, which is sent once it holds MAX_DATA_SIZE bytes or delay_ms
+	 * after the first byte was added to it, whichever comes first. An
+	 * application writing a few bytes at a time then sends full segments
+	 * instead of a segment (and, with stop-and-wait, a round trip) per
+	 * call.
+	 *
+	 * @note Timers only run while a thread is in a call on this socket
+	 * (e.g. waiting in receive_data()), or when send_data() is next called.
+	 * Call flush() before waiting on anything else.
+	 *
+	 * @param delay_ms Longest time data waits for more to join it (0, the
+	 * 		default, sends every send_data() call as it comes). Data
+	 * 		already pending waits for the next send_data() or flush().
+	 */
+	void set_coalescing(int delay_ms);
+
+	/**
+	 * Holds back partial segments until flush(), whatever the coalescing
+	 * delay: full segments are still sent as they fill. Use this to build
+	 * a message from several small writes without it going out in pieces.
+	 */
+	void cork();
+
+	/**
+	 * Uncorks the socket and sends any pending partial segment, waiting
+	 * for room in the window if need be.
+	 *
+	 * @note end_transfer(), send_buffer(), shutdown_send() and
+	 * close_connection() flush first as well.
+	 */
+	void flush();
+
+	/**
+	 * Sets where buffers for received segments are allocated from now on
+	 * (see SegmentPool::set_placement()). A server whose threads are pinned
+	 * to CPUs (see Runtime) can use SegmentPool::LOCAL_NODE to keep each
+	 * connection's data on the NUMA node of the thread that handles it.
+	 *
+	 * @param numa_node NUMA node, SegmentPool::LOCAL_NODE or
+	 * 		SegmentPool::ANY_NODE (the default).
+	 * @param huge_pages Whether to back receive buffers with huge pages,
+	 * 		which takes at least one (2 MB) per connection.
+	 */
+	void set_buffer_placement(int numa_node, bool huge_pages);
+
+	/**
+	 * Aborts the connection if nothing is heard from the remote host for the
+	 * given amount of time, whether waiting for data or for an ACK.
+	 *
+	 * @param timeout_ms Longest allowed silence (0 waits forever).
+	 */
+	void set_idle_timeout(int timeout_ms);
+
+	/**
+	 * Answers keepalive probes and close requests that arrived while the
+	 * application wasn't using the connection. Never blocks.
+	 *
+	 * @return false if the connection can no longer carry data.
+	 */
+	bool service_idle();
+
+	/**
+	 * Signals the end of the data we are sending while leaving the
+	 * connection open for data from the remote host, whose receive_data()
+	 * returns 0. Keep calling receive_data() until it returns 0, then call
+	 * close_connection().
+	 *
+	 * @note If the remote host has already finished sending, this completes
+	 * the teardown just like close_connection().
+	 */
+	void shutdown_send();
+
 	/**
 	 * Closes an connection.
 	 */
 	void close_connection();
 
+	/**
+	 * Closes the connection locally without a teardown handshake. Used for
+	 * connections whose remote host has stopped responding.
+	 */
+	void abort_connection();
+
+	/**
+	 * Returns the current state of the connection.
+	 */
+	connection_status get_state();
+
 	/**
 	 * Returns the estimated RTT.
 	 * 
 	 * @return Estimated RTT for connection (in milliseconds)
 	 */
 	uint32_t get_estimated_rtt();
+
+	/**
+	 * Returns the counters for this connection so far.
+	 */
+	RDTStats get_stats();
+
+	/**
+	 * Selects the congestion controller for this connection (e.g. a
+	 * LedbatController for background transfers that should only use
+	 * spare capacity). The default is an AdaptiveController.
+	 */
+	void set_congestion_control(std::unique_ptr<CongestionController> controller);
+
+	/**
+	 * Encrypts and authenticates every segment of the connection after the
+	 * handshake (see SegmentCipher), with keys agreed on in the handshake.
+	 * Segments that fail authentication are dropped as if lost. Both hosts
+	 * must call this before connecting or accepting; a host that doesn't
+	 * answers with plaintext, and the connection fails.
+	 *
+	 * @param psk Secret both hosts were given beforehand (may be empty).
+	 * 		It authenticates the handshake, so without it an attacker who
+	 * 		can intercept the handshake could read and forge the data.
+	 */
+	void enable_encryption(const std::string &psk = "");
 	
 private:
 	// Private member variables are initialized in the constructor
 	int sock_fd;
 	uint32_t sequence_number;
 	uint32_t expected_sequence_number;
-	int estimated_rtt;
+	std::atomic<int> estimated_rtt;
 	int current_rtt;
 	int dev_rtt;
-	connection_status state;
+	std::atomic<connection_status> state;
+
+	// Guards everything else. The thread that is waiting on the socket
+	// (pumping) releases it while it waits; the other threads wait on
+	// progress, and wake_fd interrupts the pumping thread when they arm an
+	// earlier timer.
+	std::mutex lock;
+	std::condition_variable progress;
+	bool pumping;
+	int wake_fd;
+
+	// Keepalive and idle timeout settings (0 means disabled)
+	int keepalive_idle;
+	int keepalive_interval;
+	int keepalive_max_probes;
+	int keepalive_probes_sent;
+	int idle_timeout;
+	uint64_t last_heard;
+	TimerQueue timers;
+
+	enum rdt_timer_id { TIMER_RETRANSMIT, TIMER_KEEPALIVE, TIMER_IDLE,
+		TIMER_DELAYED_ACK, TIMER_PROBE, TIMER_TIME_WAIT, TIMER_COALESCE };
+
+	static const int DUPLICATE_ACK_THRESHOLD = 3; // duplicate ACKs that mean a loss
+	// Control message asking the kernel for a transmit timestamp
+	static const size_t TX_CONTROL_SIZE = CMSG_SPACE(sizeof(uint32_t));
+
+	// A segment that was sent but not acknowledged yet. The kernel send
+	// time is 0 until the kernel reports it.
+	// Its header is rebuilt on every transmission. The payload is either a
+	// copy, or (if owner is set) the application's memory that owner keeps
+	// alive until the segment is acknowledged.
+	struct OutstandingSegment {
+		RDTHeader header;
+		const char *data;
+		uint32_t length;
+		std::vector<char> copy;
+		std::shared_ptr<const void> owner;
+		uint64_t sent_usec;
+		uint64_t sent_kernel_ns;
+		uint32_t tx_key; // matches the segment's kernel transmit timestamp
+		bool retransmitted;
+
+		const char *payload() const {
+			return this->owner ? this->data : this->copy.data();
+		}
+
+		// What the segment costs us, for the MemoryBudget
+		size_t buffered_size() const {
+			return sizeof(RDTHeader) + this->copy.size();
+		}
+	};
+
+	// The send window, oldest first. The handshake segments wait here
+	// alone; data and RDT_CLOSE segments start at send_base, and
+	// sequence_number is the next one to be sent.
+	std::deque<OutstandingSegment> outstanding;
+	uint32_t send_base;
+	uint32_t retransmit_timeout;
+	int duplicate_acks;
+	uint16_t peer_window;
+	std::unique_ptr<CongestionController> congestion;
+
+	// Receive times for RTT samples (the kernel time is 0 when the kernel
+	// didn't report it), and the number of transmit timestamps requested
+	bool kernel_timestamps;
+	uint32_t tx_timestamp_count;
+	uint64_t last_recv_usec;
+	uint64_t last_recv_kernel_ns;
+	RDTStats stats;
+
+	// Set if segments are encrypted, with the ciphertext of the segment
+	// being sent
+	std::unique_ptr<SegmentCipher> cipher;
+	std::vector<char> sealed_segment;
+
+	// Remote host's IPv4 address (network byte order), for the PeerCache
+	uint32_t peer_addr;
+	// When the first data segment was sent and the latest one acknowledged
+	uint64_t data_start_usec;
+	uint64_t data_acked_usec;
+
+	// In-order segments that the application hasn't read yet. Their data
+	// stays in the pooled buffer they were received into.
+	struct ReceivedSegment {
+		char *segment;
+		int data_size;
+	};
+	SegmentPool segment_pool;
+	std::deque<ReceivedSegment> recv_queue;
+	// Bytes of the oldest queued segment the application has already read
+	int recv_offset;
+	// Segments that arrived after a gap, by sequence number, until the
+	// missing ones are retransmitted. We never advertise a window larger
+	// than RECV_BUFFER_SEGMENTS, so they all fit.
+	ReassemblyRing<ReceivedSegment> out_of_order;
+	// Bytes of sent and received segments charged to the MemoryBudget
+	size_t send_buffered;
+	size_t recv_buffered;
+	// Buffer the next segment is received into
+	char *recv_segment;
+	bool received_data;
+	bool ack_pending;
+	int delayed_ack;
+
+	// Small writes waiting to fill a segment (see set_coalescing()).
+	// flush_deadline is when the first of them must be sent, and
+	// flush_due is set once it has passed but the window was full.
+	std::vector<char> pending_data;
+	int coalesce_delay;
+	bool corked;
+	uint64_t flush_deadline;
+	bool flush_due;
+
+	// Running hashes of the data sent and received, for checking the
+	// transfer at close (see RDTTransferCheck)
+	StreamHash send_hash;
+	StreamHash recv_hash;
+	uint64_t remote_hash;
+	RDTTransferCheck transfer_check;
+
+	// Teardown progress
+	bool close_sent;
+	bool close_acked;
+	bool remote_closed;
+	bool needs_time_wait;
+	bool discard_data;
 
 	/**
 	 * Sets the timeout length of this connection.
@@ -100,40 +589,452 @@ private:
 	void set_timeout_length(uint32_t timeout_length_ms);
 
 	/*
-	 * Calls set_timeout_length() based on calculated current and dev RTT 
+	 * Updates the estimated and deviation RTT with current_rtt.
 	 *
 	 */
 	void set_estimated_rtt();
 
 	/*
-	 * Calls send() and waits for a message in response, storing it in
-	 * recv_seg. Updates timeout length based on the calculated current_rtt of
-	 * each send.
+	 * Sets current_rtt from the time between the last transmission of a
+	 * segment and the segment that just acknowledged it, and updates the
+	 * estimates.
 	 *
-	 * @param *send_seg pointer to the segment to be sent
-	 * @param send_seg_size the size of the segment to be sent
-	 * @param *recv_seg pointer to the buffer that will store the received msg
+	 * @return the sample in microseconds
 	 */
-	void reliable_send(char *send_seg, int send_seg_size, char *recv_seg);
+	uint64_t take_rtt_sample(const OutstandingSegment &seg);
 
 	/*
-	 * Calls send() and expects it to timeout. If not, the segment will be
-	 * resent.
-	 * 
-	 * @param *send_seg pointer to the segment to be sent
+	 * Starts the RTT estimates and the congestion controller from what
+	 * earlier connections to the remote host measured, if the PeerCache
+	 * knows it.
 	 */
-	void timeout_send(char *send_seg);
+	void seed_from_cache(uint32_t addr);
 
 	/*
-	 * The sender part of closing the connection between sender and receiver
+	 * Returns the rate data was acknowledged at, or 0 if too little was
+	 * sent to tell.
+	 */
+	uint64_t delivery_rate();
+
+	/*
+	 * Asks the kernel to timestamp received segments (and, per segment,
+	 * sent ones). Falls back to user-space timestamps if it can't.
+	 */
+	void enable_timestamps();
+
+	/*
+	 * Reads the transmit timestamps the kernel queued on the socket's error
+	 * queue and records them on the outstanding segments they belong to.
+	 */
+	void read_tx_timestamps();
+
+	/*
+	 * Receives one segment into recv_segment and records when it arrived.
 	 *
+	 * @param flags recvmsg() flags
+	 * @return the segment's size, or -1 (with errno set) on error
 	 */
-	void send_close_connection();
+	int receive_segment(int flags);
 
 	/*
-	 * The receiver part of closing the connection between the sender and
-	 * receiver
+	 * Returns the retransmission timeout implied by the RTT estimates.
+	 */
+	uint32_t rto();
+
+	/*
+	 * Handles expired timers, then waits (no longer than the next timer
+	 * deadline) for a segment from the remote host and processes it.
+	 *
+	 * @param block false to only look at segments that have already arrived
+	 * @return 1 if a segment was processed, 0 if none arrived, or -1 if the
+	 * 		connection has been closed or aborted
+	 */
+	int pump(bool block);
+
+	/*
+	 * Acts on one timer that has expired.
 	 *
+	 * @param timer_id the timer
+	 * @param now current monotonic time
 	 */
-	void receive_close_connection();
+	void handle_timer(int timer_id, uint64_t now);
+
+	/*
+	 * Acts on one segment received from the remote host: handshake and
+	 * teardown steps, ACKs (separate or piggybacked), data and probes.
+	 *
+	 * @param *seg pointer to the received segment
+	 * @param seg_size size of the received segment
+	 */
+	void process_segment(char *seg, int seg_size);
+
+	/*
+	 * Handles a received RDT_DATA segment, queueing it for the application
+	 * if it is the next one in order and there is room.
+	 */
+	void process_data(RDTHeader *hdr, int data_size);
+
+	/*
+	 * Handles a received RDT_CLOSE, which ends the remote host's data and
+	 * carries its hash of that data.
+	 */
+	void process_close(RDTHeader *hdr, int data_size);
+
+	/*
+	 * Removes the outstanding segments ack_num acknowledges, updating the
+	 * RTT estimate and the congestion controller, or counts a duplicate ACK.
+	 *
+	 * @param ack_num the cumulative ACK
+	 * @param may_be_duplicate true for an RDT_ACK that didn't change the
+	 * 		advertised window, which is the only kind that counts as a
+	 * 		duplicate
+	 */
+	void process_ack(uint32_t ack_num, bool may_be_duplicate);
+
+	/*
+	 * Retransmits the oldest outstanding segment at once if the remote
+	 * host's window just opened (it was dropped for lack of room).
+	 */
+	void process_window_update(uint16_t previous_window);
+
+	/*
+	 * Finishes the handshake segment once it has been answered, updating
+	 * the RTT estimate.
+	 */
+	void complete_handshake();
+
+	/*
+	 * Sends a segment that must be acknowledged, adding it to the send
+	 * window, and starts the retransmission timer unless it is running.
+	 *
+	 * @param type the message type
+	 * @param *data the payload (may be NULL if length is 0)
+	 * @param length the size of the payload
+	 * @param owner keeps the payload alive until it is acknowledged, so it
+	 * 		isn't copied (NULL to copy it)
+	 */
+	void send_reliably(RDTMessageType type, const void *data, int length,
+			std::shared_ptr<const void> owner = NULL);
+
+	/*
+	 * Adds a segment that must be acknowledged to the send window without
+	 * sending it (see send_reliably()).
+	 */
+	void queue_segment(RDTMessageType type, const void *data, int length,
+			std::shared_ptr<const void> owner = NULL);
+
+	/*
+	 * Starts the retransmission timer unless it is running.
+	 */
+	void start_retransmit_timer();
+
+	/*
+	 * Sends an outstanding segment (again), piggybacking our latest ACK and
+	 * window.
+	 */
+	void transmit(OutstandingSegment &seg);
+
+	/*
+	 * Sends the outstanding segments from index first on (queued by
+	 * queue_segment() and not sent yet) with as few sendmmsg() calls as
+	 * the kernel allows.
+	 */
+	void transmit_batch(size_t first);
+
+	/*
+	 * Rebuilds a segment's header for its next transmission and records
+	 * when it is sent.
+	 */
+	void prepare_transmission(OutstandingSegment &seg);
+
+	/*
+	 * Points a message at a segment's header and payload, and at a
+	 * transmit timestamp request in control (TX_CONTROL_SIZE bytes) unless
+	 * it is NULL. If the segment must be encrypted, the payload is
+	 * encrypted into sealed (with room for its length plus
+	 * SegmentCipher::OVERHEAD) and the message points there instead.
+	 */
+	void build_message(OutstandingSegment &seg, struct msghdr &msg, struct iovec iov[2],
+			char *control, char *sealed);
+
+	/*
+	 * Checks whether a segment of the given type is encrypted: all but the
+	 * handshake segments carrying the key shares, once encryption is on.
+	 */
+	bool is_sealed(RDTMessageType type);
+
+	/*
+	 * Sends a prepared segment with sendmsg().
+	 */
+	void write_segment(OutstandingSegment &seg);
+
+	/*
+	 * Retransmits the oldest outstanding segment.
+	 */
+	void retransmit_oldest();
+
+	/*
+	 * Returns the number of segments we can still buffer past the last one
+	 * we acknowledged, which the MemoryBudget may cut down.
+	 */
+	uint16_t advertised_window();
+
+	/*
+	 * Charges the buffer of a received segment we keep to the MemoryBudget.
+	 *
+	 * @param force Charge it even if the budget doesn't allow it.
+	 * @return false if the budget doesn't allow it (nothing is charged)
+	 */
+	bool charge_received(bool force);
+
+	/*
+	 * Stops counting one received segment as buffered by this connection,
+	 * and gives its charge back to the MemoryBudget unless it was leased.
+	 *
+	 * @param leased The buffer went to a SegmentLease, which gives the
+	 * 		charge back once it is released instead.
+	 */
+	void release_received(bool leased = false);
+
+	/*
+	 * Returns the number of segments that may be outstanding: the smaller
+	 * of the congestion window and the remote host's window.
+	 */
+	uint32_t send_window();
+
+	/*
+	 * Sends a bare header that doesn't need to be acknowledged.
+	 */
+	void send_header(RDTMessageType type, uint32_t seq_num, uint32_t ack_num,
+			uint8_t flags = 0);
+
+	/*
+	 * Sends an RDT_ACK for the given sequence number.
+	 */
+	void send_ack(uint32_t seq_num);
+
+	/*
+	 * Sends an RDT_KEEPALIVE probe.
+	 */
+	void send_probe();
+
+	/*
+	 * Pumps until done() returns true, or waits for the thread that is
+	 * already pumping to make done() true.
+	 *
+	 * @param guard the caller's hold on lock
+	 * @return false if the connection was closed or aborted while waiting
+	 */
+	bool pump_until(std::unique_lock<std::mutex> &guard, const std::function<bool()> &done);
+
+	/*
+	 * Waits until a segment arrives, the timeout passes or another thread
+	 * wakes us, releasing lock meanwhile.
+	 *
+	 * @param timeout_ms longest wait (-1 waits forever)
+	 */
+	void wait_readable(int timeout_ms);
+
+	/*
+	 * Makes the pumping thread, if any, look at the timers again.
+	 */
+	void wake_pumper();
+
+	/*
+	 * send_data(), send_buffer() and end_transfer() with lock already held,
+	 * for one segment. Returns false if it couldn't be sent.
+	 */
+	bool send_locked(std::unique_lock<std::mutex> &guard, const void *data, int length,
+			std::shared_ptr<const void> owner = NULL);
+
+	/*
+	 * send_data() with coalescing or corking on: adds the data to
+	 * pending_data, sending each segment it fills.
+	 */
+	void coalesce_locked(std::unique_lock<std::mutex> &guard, const char *data, int length);
+
+	/*
+	 * Adds as much of the data to pending_data as fits in its segment,
+	 * starting the coalescing delay if it was empty. Returns the number of
+	 * bytes added.
+	 */
+	int add_pending(const char *data, int length);
+
+	/*
+	 * Called after small writes were added to pending_data (and it isn't
+	 * corked): returns true if its delay already passed with nobody
+	 * pumping, so it should be sent now, and arms TIMER_COALESCE otherwise.
+	 */
+	bool pending_due();
+
+	/*
+	 * Takes pending_data out to be sent, disarming its timer.
+	 */
+	std::vector<char> take_pending();
+
+	/*
+	 * Sends pending_data (if any) as one segment, waiting for room in the
+	 * window. Returns false if it couldn't be sent.
+	 */
+	bool send_pending(std::unique_lock<std::mutex> &guard);
+
+	/*
+	 * Sends pending_data if its deadline has passed and the window has
+	 * room, without waiting. Called when the coalescing timer expires and
+	 * whenever an ACK may have opened the window.
+	 */
+	void send_due_pending();
+
+	/*
+	 * close_connection() with lock already held.
+	 */
+	void close_locked(std::unique_lock<std::mutex> &guard);
+
+	/*
+	 * abort_connection() with lock already held.
+	 */
+	void drop_connection();
+
+	/*
+	 * Returns the milliseconds until the next timer expires, or -1 if none
+	 * is armed.
+	 */
+	int64_t time_until_next_timer();
+
+	/*
+	 * The steps each public operation is made of. The blocking methods run
+	 * them with pump_until(); AsyncReliableSocket runs the same steps from
+	 * coroutines waiting on an EventLoop.
+	 */
+
+	/*
+	 * Binds the listening port. Returns false if the socket was used before.
+	 */
+	bool start_accept(int port_num);
+
+	/*
+	 * Reads the remote host's RDT_SYN, connects to it and sends the
+	 * RDT_SYNACK.
+	 *
+	 * @param flags recvfrom() flags (MSG_DONTWAIT to not block)
+	 * @return false if no segment was waiting
+	 */
+	bool accept_syn(int flags);
+
+	/*
+	 * Connects the UDP socket and sends the RDT_SYN. Returns false if the
+	 * socket was used before.
+	 */
+	bool start_connect(char *hostname, int port_num);
+
+	/*
+	 * Checks whether the connection allows send_data().
+	 */
+	bool can_send();
+
+	/*
+	 * Checks whether the send window has room for another segment, and the
+	 * MemoryBudget for buffering it.
+	 */
+	bool window_open();
+
+	/*
+	 * Checks whether every segment we sent has been acknowledged.
+	 */
+	bool all_acked();
+
+	/*
+	 * Checks whether the connection can still have data to receive.
+	 */
+	bool can_receive();
+
+	/*
+	 * Checks whether take_received() has something to return.
+	 */
+	bool receive_ready();
+
+	/*
+	 * Copies out the oldest received data.
+	 *
+	 * @return its size, 0 once the remote host has finished sending, or -1
+	 * 		if the connection was aborted
+	 */
+	int take_received(char *buffer);
+
+	/*
+	 * Hands the oldest received data to a lease without copying it.
+	 *
+	 * @return as take_received()
+	 */
+	int take_received(SegmentLease &lease);
+
+	/*
+	 * Copies out received data up to length bytes, across segments.
+	 *
+	 * @return as take_received()
+	 */
+	ssize_t take_received(char *buffer, size_t length);
+
+	/*
+	 * Processes segments that have already arrived, without waiting, until
+	 * wanted bytes are queued for the application, the queue is full or
+	 * none are left. Does nothing while another thread is pumping.
+	 */
+	void drain_arrived(size_t wanted);
+
+	/*
+	 * Removes the oldest segment from recv_queue (without releasing its
+	 * buffer), telling the remote host if that opens our window.
+	 *
+	 * @param leased The buffer goes to a SegmentLease (see
+	 * 		release_received()).
+	 */
+	void pop_received(bool leased = false);
+
+	/*
+	 * Drops the data the application hasn't read.
+	 */
+	void clear_recv_queue();
+
+	/*
+	 * Starts the teardown: further received data is discarded.
+	 *
+	 * @return false if there is nothing left to tear down
+	 */
+	bool start_close();
+
+	/*
+	 * Sends our RDT_CLOSE unless shutdown_send() already did.
+	 */
+	void send_close();
+
+	/*
+	 * Arms the TIME_WAIT timer.
+	 */
+	void start_time_wait();
+
+	/*
+	 * Closes the UDP socket once the teardown is complete.
+	 */
+	void finish_close();
+
+	/*
+	 * Moves between FIN, HALF_CLOSED and CLOSING as our close and the
+	 * remote host's close are acknowledged.
+	 */
+	void update_close_state();
+
+	/*
+	 * Records that a segment arrived from the remote host, restarting the
+	 * keepalive and idle timers.
+	 */
+	void heard_from_remote();
+
+	/*
+	 * Checks whether the idle timeout has passed since the remote host was
+	 * last heard from.
+	 */
+	bool remote_timed_out();
 };
+
+#endif
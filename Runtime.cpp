@@ -0,0 +1,291 @@
+/*
+ * File: Runtime.cpp
+ *
+ * Multi-threaded runtime for asynchronous RDT connections.
+ *
+ */
+
+//OS specific includes
+#include <pthread.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include "Runtime.h"
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the Runtime header file
+*/
+
+thread_local Runtime::Worker *Runtime::current = NULL;
+
+Runtime::Runtime(int worker_count, bool pin_workers) {
+	if (worker_count <= 0) {
+		worker_count = std::thread::hardware_concurrency();
+		if (worker_count <= 0) {
+			worker_count = 1;
+		}
+	}
+
+	// CPUs the workers are pinned to, if they are
+	std::vector<int> cpus;
+	if (pin_workers) {
+		cpu_set_t allowed;
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0) {
+			perror("sched_getaffinity");
+			exit(EXIT_FAILURE);
+		}
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &allowed)) {
+				cpus.push_back(cpu);
+			}
+		}
+	}
+
+	this->stopping = false;
+	this->steal_count = 0;
+	this->live_tasks = 0;
+
+	for (int i = 0; i < worker_count; i++) {
+		std::unique_ptr<Worker> worker = std::make_unique<Worker>();
+		worker->runtime = this;
+		worker->index = i;
+		worker->parked = false;
+		worker->task_count = 0;
+		worker->cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+		worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (worker->wake_fd < 0) {
+			perror("eventfd");
+			exit(EXIT_FAILURE);
+		}
+		this->workers.push_back(std::move(worker));
+	}
+
+	// Only start the threads once every worker exists, since they steal
+	// from each other
+	for (auto &worker : this->workers) {
+		worker->thread = std::thread(&Runtime::run_worker, this, worker.get());
+	}
+}
+
+Runtime::~Runtime() {
+	this->wait();
+
+	this->stopping = true;
+	for (auto &worker : this->workers) {
+		this->wake(worker.get());
+	}
+	for (auto &worker : this->workers) {
+		worker->thread.join();
+		if (close(worker->wake_fd) < 0) {
+			perror("Runtime close");
+		}
+	}
+}
+
+Runtime::OffloadAwaiter::OffloadAwaiter(Runtime &runtime, std::function<void()> job)
+		: runtime(runtime), job(std::move(job)) {
+}
+
+bool Runtime::OffloadAwaiter::await_ready() {
+	if (current == NULL || current->runtime != &this->runtime) {
+		// No worker to come back to
+		this->job();
+		return true;
+	}
+	return false;
+}
+
+void Runtime::OffloadAwaiter::await_suspend(std::coroutine_handle<> handle) {
+	Job job;
+	job.run = std::move(this->job);
+	job.handle = handle;
+	job.home = current;
+	this->runtime.push_job(current, std::move(job));
+}
+
+int Runtime::worker_count() {
+	return this->workers.size();
+}
+
+void Runtime::spawn(TaskStarter start) {
+	Worker *least_loaded = this->workers[0].get();
+	for (auto &worker : this->workers) {
+		if (worker->task_count < least_loaded->task_count) {
+			least_loaded = worker.get();
+		}
+	}
+	this->spawn_on(least_loaded, std::move(start));
+}
+
+void Runtime::spawn(uint64_t shard_key, TaskStarter start) {
+	this->spawn_on(this->workers[shard_key % this->workers.size()].get(), std::move(start));
+}
+
+Runtime::OffloadAwaiter Runtime::offload(std::function<void()> job) {
+	return OffloadAwaiter(*this, std::move(job));
+}
+
+void Runtime::wait() {
+	std::unique_lock<std::mutex> guard(this->live_lock);
+	this->all_done.wait(guard, [this] { return this->live_tasks == 0; });
+}
+
+uint64_t Runtime::get_steal_count() {
+	return this->steal_count;
+}
+
+void Runtime::spawn_on(Worker *worker, TaskStarter start) {
+	{
+		std::lock_guard<std::mutex> guard(this->live_lock);
+		this->live_tasks++;
+	}
+	worker->task_count++;
+	{
+		std::lock_guard<std::mutex> guard(worker->inbox_lock);
+		worker->new_tasks.push_back(std::move(start));
+	}
+	this->wake(worker);
+}
+
+void Runtime::run_worker(Worker *worker) {
+	if (worker->cpu >= 0) {
+		// Before anything is allocated, so it lands on this CPU's node
+		cpu_set_t cpu_set;
+		CPU_ZERO(&cpu_set);
+		CPU_SET(worker->cpu, &cpu_set);
+		int error = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+		if (error != 0) {
+			errno = error;
+			perror("pthread_setaffinity_np");
+		}
+	}
+
+	current = worker;
+	worker->loop.spawn(this->serve(worker));
+	worker->loop.run();
+	current = NULL;
+}
+
+Task<void> Runtime::serve(Worker *worker) {
+	while (!this->stopping) {
+		// Anything queued after this point wakes us up, and anything queued
+		// before it is found below
+		worker->parked = true;
+
+		bool busy = this->drain_inbox(worker);
+		Job job;
+		if (this->take_job(worker, job)) {
+			this->run_job(worker, job);
+			busy = true;
+		}
+
+		// After a job, only yield so this worker's connections get a turn
+		// before the next one
+		co_await worker->loop.wait_readable(worker->wake_fd, busy ? 0 : -1);
+
+		uint64_t count;
+		if (read(worker->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+			perror("Runtime read");
+		}
+	}
+}
+
+Task<void> Runtime::run_task(Worker *worker, TaskStarter start) {
+	co_await start(worker->loop);
+
+	worker->task_count--;
+	std::lock_guard<std::mutex> guard(this->live_lock);
+	if (--this->live_tasks == 0) {
+		this->all_done.notify_all();
+	}
+}
+
+bool Runtime::drain_inbox(Worker *worker) {
+	std::vector<TaskStarter> new_tasks;
+	std::vector<std::coroutine_handle<>> finished_jobs;
+	{
+		std::lock_guard<std::mutex> guard(worker->inbox_lock);
+		new_tasks.swap(worker->new_tasks);
+		finished_jobs.swap(worker->finished_jobs);
+	}
+
+	for (TaskStarter &start : new_tasks) {
+		worker->loop.spawn(this->run_task(worker, std::move(start)));
+	}
+	for (std::coroutine_handle<> handle : finished_jobs) {
+		handle.resume();
+	}
+	return !new_tasks.empty() || !finished_jobs.empty();
+}
+
+bool Runtime::take_job(Worker *worker, Job &job) {
+	{
+		// Newest first: its data is most likely still in this core's cache
+		std::lock_guard<std::mutex> guard(worker->jobs_lock);
+		if (!worker->jobs.empty()) {
+			job = std::move(worker->jobs.back());
+			worker->jobs.pop_back();
+			return true;
+		}
+	}
+
+	int count = this->workers.size();
+	for (int i = 1; i < count; i++) {
+		Worker *victim = this->workers[(worker->index + i) % count].get();
+		std::lock_guard<std::mutex> guard(victim->jobs_lock);
+		if (!victim->jobs.empty()) {
+			job = std::move(victim->jobs.front());
+			victim->jobs.pop_front();
+			return true;
+		}
+	}
+	return false;
+}
+
+void Runtime::run_job(Worker *worker, Job &job) {
+	job.run();
+
+	if (job.home == worker) {
+		job.handle.resume();
+		return;
+	}
+
+	// The task's connections belong to its own worker's thread
+	this->steal_count++;
+	{
+		std::lock_guard<std::mutex> guard(job.home->inbox_lock);
+		job.home->finished_jobs.push_back(job.handle);
+	}
+	this->wake(job.home);
+}
+
+void Runtime::push_job(Worker *worker, Job job) {
+	{
+		std::lock_guard<std::mutex> guard(worker->jobs_lock);
+		worker->jobs.push_back(std::move(job));
+	}
+
+	// Prefer another worker so this one can get on with its connections;
+	// if nobody is parked, they are all busy and will get to it anyway
+	int count = this->workers.size();
+	for (int i = 1; i <= count; i++) {
+		Worker *candidate = this->workers[(worker->index + i) % count].get();
+		if (candidate->parked.exchange(false)) {
+			this->wake(candidate);
+			return;
+		}
+	}
+}
+
+void Runtime::wake(Worker *worker) {
+	uint64_t one = 1;
+	if (write(worker->wake_fd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+		perror("Runtime write");
+	}
+}
@@ -0,0 +1,228 @@
+/*
+ * File: Runtime.h
+ *
+ * Header / API file for the multi-threaded runtime that runs many
+ * asynchronous RDT connections across worker threads.
+ *
+ */
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "rdt_event_loop.h"
+#include "rdt_task.h"
+
+/**
+ * Runs coroutine tasks (typically one per AsyncReliableSocket connection)
+ * on a fixed set of worker threads. Each worker has its own EventLoop, and
+ * so its own epoll set and timers, and a task stays on the worker it was
+ * spawned on: a connection's sockets and protocol state are only ever
+ * touched by one thread, so the data path needs no locks.
+ *
+ * CPU-heavy work that would stall a worker's other connections
+ * (checksumming, compression, FEC encoding, ...) can be handed to
+ * offload(). Each worker keeps a deque of such jobs; a worker whose own
+ * deque is empty steals the oldest job from a busy one, so every core
+ * stays busy even when a few bulk transfers share a worker with many idle
+ * connections. The task that offloaded a job always resumes on its own
+ * worker.
+ *
+ *     Runtime runtime;
+ *     runtime.spawn([&runtime](EventLoop &loop) -> Task<void> {
+ *         AsyncReliableSocket sock(loop);
+ *         ...
+ *         co_await runtime.offload([&] { fec_xor(parity, data, len); });
+ *         ...
+ *     });
+ */
+class Runtime {
+public:
+	/**
+	 * Function that starts a task on the loop of the worker it is given to.
+	 * Called on that worker's thread.
+	 */
+	typedef std::function<Task<void>(EventLoop &loop)> TaskStarter;
+
+	/**
+	 * Awaitable returned by offload().
+	 */
+	class OffloadAwaiter {
+	public:
+		OffloadAwaiter(Runtime &runtime, std::function<void()> job);
+
+		bool await_ready();
+		void await_suspend(std::coroutine_handle<> handle);
+		void await_resume() {}
+
+	private:
+		Runtime &runtime;
+		std::function<void()> job;
+	};
+
+	/**
+	 * Starts the worker threads.
+	 *
+	 * @param worker_count Number of workers, or 0 for one per CPU.
+	 * @param pin_workers Whether to pin worker i to the i-th CPU (modulo
+	 * 		the number of CPUs the process may use), so a worker stays on
+	 * 		one NUMA node and memory it allocates with
+	 * 		SegmentPool::LOCAL_NODE stays local to it.
+	 */
+	Runtime(int worker_count = 0, bool pin_workers = false);
+
+	/**
+	 * Waits for every spawned task to finish (see wait()) and stops the
+	 * workers.
+	 */
+	~Runtime();
+
+	/**
+	 * Returns the number of worker threads.
+	 */
+	int worker_count();
+
+	/**
+	 * Starts a task on the worker with the fewest running tasks. May be
+	 * called from any thread.
+	 */
+	void spawn(TaskStarter start);
+
+	/**
+	 * Starts a task on the worker chosen by a key, so that e.g. every
+	 * connection to the same peer (with the key hashed from its address)
+	 * shares a worker. May be called from any thread.
+	 */
+	void spawn(uint64_t shard_key, TaskStarter start);
+
+	/**
+	 * Suspends the calling task while a job runs on whichever worker gets
+	 * to it first. The job must not touch the calling task's connections,
+	 * since it may run on another thread; it may use anything the task
+	 * keeps alive while it is suspended.
+	 *
+	 * Called from outside the runtime's workers, the job just runs inline.
+	 */
+	OffloadAwaiter offload(std::function<void()> job);
+
+	/**
+	 * Blocks until every spawned task (including ones they spawned) has
+	 * finished. Must not be called from a worker.
+	 */
+	void wait();
+
+	/**
+	 * Returns how many offloaded jobs were run by a worker other than the
+	 * one they were offloaded from.
+	 */
+	uint64_t get_steal_count();
+
+private:
+	struct Worker;
+
+	struct Job {
+		std::function<void()> run;
+		// Task to resume once it has run, on the worker it came from
+		std::coroutine_handle<> handle;
+		Worker *home;
+	};
+
+	struct Worker {
+		Runtime *runtime;
+		int index;
+		EventLoop loop;
+		std::thread thread;
+		// CPU the thread is pinned to, or -1
+		int cpu;
+		// Written to wake serve() up when the inbox or a deque has work
+		int wake_fd;
+		// Set once serve() has looked for work, until somebody wakes it
+		std::atomic<bool> parked;
+		// Tasks spawned on this worker that haven't finished
+		std::atomic<int> task_count;
+
+		// Handed over by other threads; guarded by inbox_lock
+		std::mutex inbox_lock;
+		std::vector<TaskStarter> new_tasks;
+		std::vector<std::coroutine_handle<>> finished_jobs;
+
+		// Offloaded jobs, newest last; guarded by jobs_lock
+		std::mutex jobs_lock;
+		std::deque<Job> jobs;
+	};
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<bool> stopping;
+	std::atomic<uint64_t> steal_count;
+
+	// Tasks spawned but not finished, for wait()
+	std::mutex live_lock;
+	std::condition_variable all_done;
+	int live_tasks;
+
+	// Worker whose thread is the calling thread, if any
+	static thread_local Worker *current;
+
+	/*
+	 * Hands a task to a worker.
+	 */
+	void spawn_on(Worker *worker, TaskStarter start);
+
+	/*
+	 * Body of each worker thread.
+	 */
+	void run_worker(Worker *worker);
+
+	/*
+	 * Task that runs on every worker alongside its connections: starts
+	 * spawned tasks, resumes tasks whose jobs finished and runs offloaded
+	 * jobs until the runtime stops.
+	 */
+	Task<void> serve(Worker *worker);
+
+	/*
+	 * Runs a spawned task and accounts for it finishing.
+	 */
+	Task<void> run_task(Worker *worker, TaskStarter start);
+
+	/*
+	 * Starts the tasks and resumes the jobs handed to a worker.
+	 *
+	 * @return whether there was anything to do
+	 */
+	bool drain_inbox(Worker *worker);
+
+	/*
+	 * Takes the newest job from a worker's own deque, or steals the oldest
+	 * one from another worker's.
+	 *
+	 * @return whether a job was found
+	 */
+	bool take_job(Worker *worker, Job &job);
+
+	/*
+	 * Runs a job taken by a worker and gets its task resumed.
+	 */
+	void run_job(Worker *worker, Job &job);
+
+	/*
+	 * Queues a job on a worker's deque and wakes a parked worker to run it.
+	 */
+	void push_job(Worker *worker, Job job);
+
+	/*
+	 * Makes a worker's serve() task run if it is waiting.
+	 */
+	void wake(Worker *worker);
+};
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * File: SegmentCipher.cpp
+ *
+ * Authenticated encryption of a connection's segments.
+ *
+ */
+
+// C++ library includes
+#include <iostream>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <openssl/kdf.h>
+
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+#include "SegmentCipher.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the SegmentCipher header file
+*/
+
+/*
+ * Reports a libcrypto failure that leaves the connection unusable.
+ */
+static void crypto_failure(const char *what) {
+	cerr << "ERROR: " << what << " failed\n";
+	exit(EXIT_FAILURE);
+}
+
+SegmentCipher::SegmentCipher(const std::string &psk) : psk(psk) {
+	this->key_pair = NULL;
+	this->agreed_suite = (Suite)0;
+	this->send_ctx = NULL;
+	this->recv_ctx = NULL;
+	this->send_counter = 0;
+
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+	if (ctx == NULL || EVP_PKEY_keygen_init(ctx) <= 0 ||
+			EVP_PKEY_keygen(ctx, &this->key_pair) <= 0) {
+		crypto_failure("X25519 key generation");
+	}
+	EVP_PKEY_CTX_free(ctx);
+
+	this->share[0] = has_aes_hardware() ? AES_256_GCM : CHACHA20_POLY1305;
+	size_t key_size = PUBLIC_KEY_SIZE;
+	if (EVP_PKEY_get_raw_public_key(this->key_pair, (unsigned char*)this->share + 1,
+			&key_size) <= 0 || key_size != PUBLIC_KEY_SIZE) {
+		crypto_failure("X25519 public key export");
+	}
+}
+
+SegmentCipher::~SegmentCipher() {
+	EVP_PKEY_free(this->key_pair);
+	EVP_CIPHER_CTX_free(this->send_ctx);
+	EVP_CIPHER_CTX_free(this->recv_ctx);
+}
+
+const char *SegmentCipher::key_share() {
+	return this->share;
+}
+
+bool SegmentCipher::complete(const char *remote_share, bool initiator) {
+	if (this->is_ready()) {
+		return true;
+	}
+	Suite remote_suite = (Suite)remote_share[0];
+	if (remote_suite != AES_256_GCM && remote_suite != CHACHA20_POLY1305) {
+		return false;
+	}
+
+	// Shared secret
+	EVP_PKEY *remote_key = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL,
+			(const unsigned char*)remote_share + 1, PUBLIC_KEY_SIZE);
+	if (remote_key == NULL) {
+		return false;
+	}
+	unsigned char secret[32];
+	size_t secret_size = sizeof(secret);
+	EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new(this->key_pair, NULL);
+	bool derived = ctx != NULL && EVP_PKEY_derive_init(ctx) > 0 &&
+		EVP_PKEY_derive_set_peer(ctx, remote_key) > 0 &&
+		EVP_PKEY_derive(ctx, secret, &secret_size) > 0;
+	EVP_PKEY_CTX_free(ctx);
+	EVP_PKEY_free(remote_key);
+	if (!derived) {
+		// e.g. a low-order public key, which gives an all-zero secret
+		return false;
+	}
+
+	// Both key shares go into the derivation, initiator's first, so both
+	// sides derive the same keys and neither share can be swapped
+	unsigned char info[16 + 2 * KEY_SHARE_SIZE];
+	memcpy(info, "RDT segment keys", 16);
+	memcpy(info + 16, initiator ? this->share : remote_share, KEY_SHARE_SIZE);
+	memcpy(info + 16 + KEY_SHARE_SIZE, initiator ? remote_share : this->share, KEY_SHARE_SIZE);
+
+	// Initiator-to-responder key and salt, then the other direction's
+	unsigned char keys[2 * (32 + 4)];
+	size_t keys_size = sizeof(keys);
+	ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+	if (ctx == NULL || EVP_PKEY_derive_init(ctx) <= 0 ||
+			EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) <= 0 ||
+			(!this->psk.empty() && EVP_PKEY_CTX_set1_hkdf_salt(ctx,
+				(const unsigned char*)this->psk.data(), this->psk.size()) <= 0) ||
+			EVP_PKEY_CTX_set1_hkdf_key(ctx, secret, secret_size) <= 0 ||
+			EVP_PKEY_CTX_add1_hkdf_info(ctx, info, sizeof(info)) <= 0 ||
+			EVP_PKEY_derive(ctx, keys, &keys_size) <= 0) {
+		crypto_failure("HKDF key derivation");
+	}
+	EVP_PKEY_CTX_free(ctx);
+	OPENSSL_cleanse(secret, sizeof(secret));
+
+	this->agreed_suite = (remote_suite == AES_256_GCM && this->share[0] == AES_256_GCM) ?
+		AES_256_GCM : CHACHA20_POLY1305;
+	const EVP_CIPHER *cipher = this->agreed_suite == AES_256_GCM ?
+		EVP_aes_256_gcm() : EVP_chacha20_poly1305();
+
+	unsigned char *send_key = initiator ? keys : keys + 36;
+	unsigned char *recv_key = initiator ? keys + 36 : keys;
+	memcpy(this->send_salt, send_key + 32, 4);
+	memcpy(this->recv_salt, recv_key + 32, 4);
+	this->send_ctx = EVP_CIPHER_CTX_new();
+	this->recv_ctx = EVP_CIPHER_CTX_new();
+	if (this->send_ctx == NULL || this->recv_ctx == NULL ||
+			EVP_EncryptInit_ex(this->send_ctx, cipher, NULL, send_key, NULL) <= 0 ||
+			EVP_DecryptInit_ex(this->recv_ctx, cipher, NULL, recv_key, NULL) <= 0) {
+		crypto_failure("AEAD cipher setup");
+	}
+	OPENSSL_cleanse(keys, sizeof(keys));
+	return true;
+}
+
+bool SegmentCipher::is_ready() {
+	return this->send_ctx != NULL;
+}
+
+SegmentCipher::Suite SegmentCipher::suite() {
+	return this->agreed_suite;
+}
+
+void SegmentCipher::make_nonce(const uint8_t salt[4], uint64_t counter, uint8_t nonce[12]) {
+	memcpy(nonce, salt, 4);
+	for (int i = 0; i < 8; i++) {
+		nonce[4 + i] = counter >> (56 - 8 * i);
+	}
+}
+
+void SegmentCipher::seal(const void *aad, size_t aad_size, const char *data, size_t length,
+		char *out) {
+	uint64_t counter = this->send_counter++;
+	uint8_t nonce[12];
+	make_nonce(this->send_salt, counter, nonce);
+
+	// Encrypting reads the payload straight from where the segment refers
+	// to it, so this is the only pass over it
+	int size;
+	char *trailer = out + length;
+	if (EVP_EncryptInit_ex(this->send_ctx, NULL, NULL, NULL, nonce) <= 0 ||
+			EVP_EncryptUpdate(this->send_ctx, NULL, &size, (const unsigned char*)aad,
+				aad_size) <= 0 ||
+			(length > 0 && EVP_EncryptUpdate(this->send_ctx, (unsigned char*)out, &size,
+				(const unsigned char*)data, length) <= 0) ||
+			EVP_EncryptFinal_ex(this->send_ctx, (unsigned char*)out + length, &size) <= 0 ||
+			EVP_CIPHER_CTX_ctrl(this->send_ctx, EVP_CTRL_AEAD_GET_TAG, TAG_SIZE, trailer) <= 0) {
+		crypto_failure("Segment encryption");
+	}
+	memcpy(trailer + TAG_SIZE, nonce + 4, 8);
+}
+
+int SegmentCipher::open(const void *aad, size_t aad_size, char *sealed, size_t sealed_size) {
+	if (!this->is_ready() || sealed_size < (size_t)OVERHEAD) {
+		return -1;
+	}
+	size_t length = sealed_size - OVERHEAD;
+	char *trailer = sealed + length;
+	uint64_t counter = 0;
+	for (int i = 0; i < 8; i++) {
+		counter = (counter << 8) | (uint8_t)trailer[TAG_SIZE + i];
+	}
+	uint8_t nonce[12];
+	make_nonce(this->recv_salt, counter, nonce);
+
+	int size;
+	if (EVP_DecryptInit_ex(this->recv_ctx, NULL, NULL, NULL, nonce) <= 0 ||
+			EVP_DecryptUpdate(this->recv_ctx, NULL, &size, (const unsigned char*)aad,
+				aad_size) <= 0 ||
+			(length > 0 && EVP_DecryptUpdate(this->recv_ctx, (unsigned char*)sealed, &size,
+				(const unsigned char*)sealed, length) <= 0) ||
+			EVP_CIPHER_CTX_ctrl(this->recv_ctx, EVP_CTRL_AEAD_SET_TAG, TAG_SIZE, trailer) <= 0 ||
+			EVP_DecryptFinal_ex(this->recv_ctx, (unsigned char*)sealed + length, &size) <= 0) {
+		return -1;
+	}
+	return length;
+}
+
+bool SegmentCipher::has_aes_hardware() {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul");
+#elif defined(__aarch64__)
+	return (getauxval(AT_HWCAP) & HWCAP_AES) && (getauxval(AT_HWCAP) & HWCAP_PMULL);
+#else
+	return false;
+#endif
+}
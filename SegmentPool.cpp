@@ -0,0 +1,216 @@
+/*
+ * File: SegmentPool.cpp
+ *
+ * Pool of segment buffers and leases onto received data.
+ *
+ */
+
+#include <utility>
+
+//OS specific includes
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "MemoryBudget.h"
+#include "SegmentPool.h"
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the SegmentPool header file
+*/
+
+SegmentPool::SegmentPool(int segment_size) {
+	this->segment_size = segment_size;
+	this->stride = (segment_size + 63) & ~(size_t)63;
+	this->numa_node = ANY_NODE;
+	this->huge_pages = false;
+	this->unused = NULL;
+	this->unused_count = 0;
+	this->carved_count = 0;
+}
+
+SegmentPool::~SegmentPool() {
+	for (Arena &arena : this->arenas) {
+		if (munmap(arena.base, arena.size) < 0) {
+			perror("SegmentPool munmap");
+		}
+	}
+}
+
+void SegmentPool::set_placement(int numa_node, bool huge_pages) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->numa_node = numa_node;
+	this->huge_pages = huge_pages;
+}
+
+int SegmentPool::current_node() {
+	unsigned int cpu, node;
+	if (getcpu(&cpu, &node) < 0) {
+		return 0;
+	}
+	return node;
+}
+
+char *SegmentPool::acquire() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	if (!this->free_list.empty()) {
+		char *segment = this->free_list.back();
+		this->free_list.pop_back();
+		return segment;
+	}
+
+	if (this->unused_count == 0) {
+		this->add_arena();
+	}
+	char *segment = this->unused;
+	this->unused += this->stride;
+	this->unused_count--;
+	this->carved_count++;
+	return segment;
+}
+
+void SegmentPool::release(char *segment) {
+	std::lock_guard<std::mutex> guard(this->lock);
+	this->free_list.push_back(segment);
+}
+
+int SegmentPool::allocated_count() {
+	std::lock_guard<std::mutex> guard(this->lock);
+	return this->carved_count;
+}
+
+void SegmentPool::add_arena() {
+	size_t segments = this->arenas.empty() ? FIRST_ARENA_SEGMENTS :
+		2 * this->arenas.back().segments;
+	if (segments * this->stride > MAX_ARENA_SIZE) {
+		segments = MAX_ARENA_SIZE / this->stride;
+	}
+	if (segments == 0) {
+		segments = 1;
+	}
+
+	// A socket's pool rarely holds more than a few dozen segments, so with
+	// huge pages each arena is rounded up to whole huge pages (filled with
+	// as many buffers as fit) rather than waiting for one to grow that big
+	bool huge = this->huge_pages;
+	size_t align = huge ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+	size_t size = (segments * this->stride + align - 1) / align * align;
+
+	void *base = MAP_FAILED;
+	if (huge) {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	}
+	if (base == MAP_FAILED && huge) {
+		// No huge pages reserved: map a huge-page-aligned range and ask
+		// for transparent huge pages instead
+		char *raw = (char*)mmap(NULL, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (raw != MAP_FAILED) {
+			char *aligned = (char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) &
+				~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+			if (aligned > raw) {
+				munmap(raw, aligned - raw);
+			}
+			munmap(aligned + size, raw + HUGE_PAGE_SIZE - aligned);
+			madvise(aligned, size, MADV_HUGEPAGE);
+			base = aligned;
+		}
+	}
+	if (base == MAP_FAILED) {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (base == MAP_FAILED) {
+		perror("SegmentPool mmap");
+		exit(EXIT_FAILURE);
+	}
+
+	if (this->numa_node != ANY_NODE) {
+		// Pages are only allocated when first touched, so setting the policy
+		// now places all of them. A kernel without NUMA support refuses,
+		// which is harmless: there is only one node then.
+		int node = this->numa_node == LOCAL_NODE ? current_node() : this->numa_node;
+		unsigned long mask[16] = {};
+		if (node >= 0 && node < (int)(8 * sizeof(mask))) {
+			mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+			syscall(SYS_mbind, base, size, MPOL_PREFERRED, mask, 8 * sizeof(mask), 0);
+		}
+	}
+
+	Arena arena;
+	arena.base = (char*)base;
+	arena.size = size;
+	arena.segments = size / this->stride;
+	this->arenas.push_back(arena);
+	this->unused = arena.base;
+	this->unused_count = arena.segments;
+}
+
+SegmentLease::SegmentLease() {
+	this->pool = NULL;
+	this->segment = NULL;
+	this->data_offset = 0;
+	this->length = 0;
+	this->charge = 0;
+}
+
+SegmentLease::SegmentLease(SegmentPool *pool, char *segment, int offset, int length,
+		size_t charge) {
+	this->pool = pool;
+	this->segment = segment;
+	this->data_offset = offset;
+	this->length = length;
+	this->charge = charge;
+}
+
+SegmentLease::SegmentLease(SegmentLease &&other) noexcept {
+	this->pool = std::exchange(other.pool, nullptr);
+	this->segment = std::exchange(other.segment, nullptr);
+	this->data_offset = other.data_offset;
+	this->length = std::exchange(other.length, 0);
+	this->charge = std::exchange(other.charge, 0);
+}
+
+SegmentLease &SegmentLease::operator=(SegmentLease &&other) noexcept {
+	if (this != &other) {
+		this->release();
+		this->pool = std::exchange(other.pool, nullptr);
+		this->segment = std::exchange(other.segment, nullptr);
+		this->data_offset = other.data_offset;
+		this->length = std::exchange(other.length, 0);
+		this->charge = std::exchange(other.charge, 0);
+	}
+	return *this;
+}
+
+SegmentLease::~SegmentLease() {
+	this->release();
+}
+
+std::span<const char> SegmentLease::data() const {
+	if (this->segment == NULL) {
+		return std::span<const char>();
+	}
+	return std::span<const char>(this->segment + this->data_offset, this->length);
+}
+
+int SegmentLease::offset() const {
+	return this->data_offset;
+}
+
+void SegmentLease::release() {
+	if (this->segment != NULL) {
+		this->pool->release(this->segment);
+		MemoryBudget::instance().release(this->charge);
+	}
+	this->pool = NULL;
+	this->segment = NULL;
+	this->length = 0;
+	this->charge = 0;
+}
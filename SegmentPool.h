@@ -0,0 +1,168 @@
+/*
+ * File: SegmentPool.h
+ *
+ * Header / API file for the pool of segment buffers that received data is
+ * kept in, and for the leases that let applications read it in place.
+ *
+ */
+#ifndef SEGMENT_POOL_H
+#define SEGMENT_POOL_H
+
+#include <cstddef>
+#include <mutex>
+#include <span>
+#include <vector>
+
+/**
+ * Fixed-size buffers that segments are received into. Buffers are reused
+ * once released, so a steady transfer doesn't allocate after the first few
+ * segments. The pool owns every buffer it hands out and frees them all when
+ * it is destroyed.
+ *
+ * Buffers are carved out of arenas mapped with mmap(), each twice the size
+ * of the last (up to MAX_ARENA_SIZE), so a pool that only ever holds a few
+ * segments stays small while a large reorder buffer takes few mappings.
+ * See set_placement() for binding arenas to a NUMA node and backing them
+ * with huge pages.
+ *
+ * A pool may be used from several threads, since leases are released by
+ * application threads while the socket receives into new buffers.
+ */
+class SegmentPool {
+public:
+	static const int ANY_NODE = -1; // leave placement to the kernel (first touch)
+	static const int LOCAL_NODE = -2; // node of the thread that maps each arena
+	static const int FIRST_ARENA_SEGMENTS = 16;
+	static const size_t MAX_ARENA_SIZE = 8 << 20; // bytes
+	static const size_t HUGE_PAGE_SIZE = 2 << 20; // bytes
+
+	/**
+	 * Creates an empty pool.
+	 *
+	 * @param segment_size Size of every buffer in bytes.
+	 */
+	SegmentPool(int segment_size);
+
+	/**
+	 * Unmaps every arena.
+	 */
+	~SegmentPool();
+
+	/**
+	 * Sets where arenas mapped from now on are placed. Arenas that are
+	 * already mapped don't move.
+	 *
+	 * @param numa_node NUMA node to allocate from: a node number, LOCAL_NODE
+	 * 		or ANY_NODE (the default). The kernel falls back to other
+	 * 		nodes if the node runs out of memory.
+	 * @param huge_pages Whether to round arenas up to whole huge pages
+	 * 		(HUGE_PAGE_SIZE each) and back them with huge pages: reserved
+	 * 		ones (MAP_HUGETLB) if there are any, transparent ones
+	 * 		otherwise. The first arena then takes 2 MB.
+	 */
+	void set_placement(int numa_node, bool huge_pages);
+
+	/**
+	 * Returns the NUMA node of the CPU the calling thread is running on.
+	 */
+	static int current_node();
+
+	/**
+	 * Returns a buffer of segment_size bytes, allocating one if none is free.
+	 */
+	char *acquire();
+
+	/**
+	 * Makes a buffer returned by acquire() available again.
+	 */
+	void release(char *segment);
+
+	/**
+	 * Returns the number of buffers allocated so far.
+	 */
+	int allocated_count();
+
+private:
+	struct Arena {
+		char *base;
+		size_t size;
+		int segments;
+	};
+
+	int segment_size;
+	// Distance between buffers, so each starts on its own cache line
+	size_t stride;
+	int numa_node;
+	bool huge_pages;
+
+	std::mutex lock;
+	std::vector<Arena> arenas;
+	// Buffers of the newest arena that haven't been handed out yet
+	char *unused;
+	int unused_count;
+	int carved_count;
+	std::vector<char*> free_list;
+
+	/*
+	 * Maps the next arena, placed as set_placement() says. Expects lock to
+	 * be held.
+	 */
+	void add_arena();
+};
+
+/**
+ * Read-only view of the data of one received segment, which stays in the
+ * socket's pooled buffer until the lease is released (or destroyed). This
+ * lets the application parse or forward data without copying it. The
+ * buffer stays charged to the MemoryBudget until then too.
+ *
+ * @note A lease must be released before the socket it came from is
+ * destroyed.
+ */
+class SegmentLease {
+public:
+	/**
+	 * Creates an empty lease.
+	 */
+	SegmentLease();
+
+	SegmentLease(SegmentLease &&other) noexcept;
+	SegmentLease &operator=(SegmentLease &&other) noexcept;
+	SegmentLease(const SegmentLease&) = delete;
+	SegmentLease &operator=(const SegmentLease&) = delete;
+
+	/**
+	 * Releases the buffer, if the lease still holds one.
+	 */
+	~SegmentLease();
+
+	/**
+	 * Returns the leased data (empty if the lease holds nothing).
+	 */
+	std::span<const char> data() const;
+
+	/**
+	 * Returns the offset of the data in the segment buffer, i.e. the size of
+	 * the header in front of it.
+	 */
+	int offset() const;
+
+	/**
+	 * Gives the buffer back to the socket's pool. The data must not be used
+	 * afterwards.
+	 */
+	void release();
+
+private:
+	friend class ReliableSocket;
+
+	SegmentLease(SegmentPool *pool, char *segment, int offset, int length, size_t charge);
+
+	SegmentPool *pool;
+	char *segment;
+	int data_offset;
+	int length;
+	size_t charge; // bytes charged to the MemoryBudget for the buffer
+};
+
+#endif
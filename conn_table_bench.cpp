@@ -0,0 +1,121 @@
+/*
+ * File: conn_table_bench.cpp
+ *
+ * Program that measures the memory footprint and speed of ConnectionTable
+ * with many idle connections and a smaller set of active ones.
+ *
+ */
+
+// C++ standard libraries
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+
+// RDT library
+#include "ConnectionTable.h"
+#include "rdt_time.h"
+
+using std::cout;
+using std::cerr;
+
+/*
+ * Returns the nanoseconds per operation of a run of the given length.
+ */
+static double ns_per_op(std::chrono::steady_clock::time_point start, long ops) {
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	return std::chrono::duration<double, std::nano>(elapsed).count() / ops;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 3) {
+		cerr << "Usage: " << argv[0] << " [idle connections] [active connections]\n";
+		exit(1);
+	}
+	int idle = argc > 1 ? std::stoi(argv[1]) : 100000;
+	int active = argc > 2 ? std::stoi(argv[2]) : 10000;
+	const int ROUNDS = 100;
+
+	// Peers spread over a /16 with random ports, like NATed clients
+	std::mt19937_64 random(42);
+	std::vector<uint64_t> ids;
+	ConnectionTable table;
+	auto start = std::chrono::steady_clock::now();
+	while ((int)table.size() < idle + active) {
+		struct sockaddr_in addr = {};
+		addr.sin_family = AF_INET;
+		addr.sin_addr.s_addr = htonl(0x0a000000 | (random() & 0xffff));
+		addr.sin_port = htons(1024 + random() % 64000);
+		uint64_t id = ConnectionTable::peer_id(addr);
+		int slot = table.insert(id, addr);
+		if (slot >= 0) {
+			table.set_state(slot, ESTABLISHED);
+			ids.push_back(id);
+		}
+	}
+	double insert_ns = ns_per_op(start, ids.size());
+
+	cout << "connections:      " << table.size() << " (" << idle << " idle, "
+		<< active << " active)\n";
+	cout << "table memory:     " << table.memory_usage() << " bytes, "
+		<< (double)table.memory_usage() / table.size() << " per connection\n";
+	cout << "ReliableSocket:   " << sizeof(ReliableSocket)
+		<< " bytes per connection, before its buffers and kernel socket\n";
+	cout << "insert:           " << insert_ns << " ns\n";
+
+	// Each round, every active connection receives a segment: look it up,
+	// acknowledge it, send the next one and re-arm its timer; then sweep
+	// the timers of every connection
+	std::vector<uint64_t> active_ids(ids.end() - active, ids.end());
+	std::shuffle(active_ids.begin(), active_ids.end(), random);
+	std::vector<int> expired;
+	uint64_t now = monotonic_msec();
+	long misses = 0;
+	double update_ns = 0, sweep_ns = 0;
+	for (int round = 0; round < ROUNDS; round++) {
+		start = std::chrono::steady_clock::now();
+		for (uint64_t id : active_ids) {
+			int slot = table.find(id);
+			if (slot < 0) {
+				misses++;
+				continue;
+			}
+			table.ack_seq(slot)++;
+			table.send_seq(slot)++;
+			table.cwnd(slot) += 1;
+			table.next_timer(slot) = now + 200;
+		}
+		update_ns += ns_per_op(start, active_ids.size());
+
+		now += 100;
+		start = std::chrono::steady_clock::now();
+		table.collect_expired(now, expired);
+		sweep_ns += ns_per_op(start, 1);
+	}
+
+	// Churn: close and replace a tenth of the idle connections
+	start = std::chrono::steady_clock::now();
+	int churn = idle / 10;
+	for (int i = 0; i < churn; i++) {
+		table.erase(ids[i]);
+	}
+	for (int i = 0; i < churn; i++) {
+		struct sockaddr_in addr = {};
+		addr.sin_addr.s_addr = htonl(0x0b000000 | i);
+		table.insert(ConnectionTable::peer_id(addr), addr);
+	}
+	double churn_ns = ns_per_op(start, 2 * churn);
+
+	cout << "active update:    " << update_ns / ROUNDS << " ns per segment\n";
+	cout << "timer sweep:      " << sweep_ns / ROUNDS / 1000 << " us over every connection\n";
+	cout << "erase + insert:   " << churn_ns << " ns\n";
+	if (misses > 0 || (int)table.size() != idle + active) {
+		cerr << "ERROR: lost connections\n";
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,48 @@
+/*
+ * File: mcast_receiver.cpp
+ *
+ * Simple program that receives data multicast by mcast_sender, writing the
+ * received data to standard output.
+ */
+
+// C++ standard libraries
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <array>
+
+// RDT library
+#include "MulticastReceiver.h"
+
+using std::cerr;
+
+int main(int argc, char **argv) {
+	if (argc < 3 || argc > 4) {
+		cerr << "Usage: " << argv[0] << " <group> <port> [interface]\n";
+		exit(1);
+	}
+
+	MulticastReceiver receiver(argv[1], std::stoi(argv[2]), argc > 3 ? argv[3] : "0.0.0.0");
+
+	std::array<char, MulticastReceiver::MAX_DATA_SIZE> segment;
+	auto start_time = std::chrono::system_clock::now();
+
+	// Keep receiving until the sender has finished (0) or data was lost
+	// for good (-1)
+	long total_bytes = 0;
+	int bytes_received;
+	while ((bytes_received = receiver.receive_data(segment.data())) > 0) {
+		total_bytes += bytes_received;
+		fwrite(segment.data(), sizeof(char), bytes_received, stdout);
+	}
+	fflush(stdout);
+
+	auto end_time = std::chrono::system_clock::now();
+	std::chrono::duration<double> elapsed_seconds = end_time - start_time;
+
+	cerr << "\nReceived " << total_bytes << " bytes in "
+			<< elapsed_seconds.count() << " seconds (" << receiver.get_nack_count()
+			<< " NACKs, " << receiver.get_recovered_count() << " segments rebuilt from parity)\n";
+
+	return bytes_received < 0 ? 1 : 0;
+}
@@ -0,0 +1,56 @@
+/*
+ * File: mcast_sender.cpp
+ *
+ * Simple program that multicasts data on standard input to every receiver
+ * in a multicast group using the RDT library.
+ */
+
+// C++ standard libraries
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <array>
+
+// RDT library
+#include "MulticastSender.h"
+
+using std::cerr;
+
+int main(int argc, char** argv) {
+	if (argc < 3 || argc > 6) {
+		cerr << "Usage: " << argv[0]
+			<< " <group> <port> [interface] [FEC block size] [rate in bytes/s]\n";
+		exit(1);
+	}
+
+	MulticastSender sender(argv[1], std::stoi(argv[2]), argc > 3 ? argv[3] : "0.0.0.0");
+	if (argc > 4) {
+		sender.set_fec(std::stoi(argv[4]));
+	}
+	if (argc > 5) {
+		sender.set_rate(std::stoi(argv[5]));
+	}
+
+	std::array<char, MulticastSender::MAX_DATA_SIZE> buff;
+	auto start_time = std::chrono::system_clock::now();
+
+	// Use stdin as the source for the data we will be sending
+	long total_bytes = 0;
+	int num_bytes_read = 0;
+	while ((num_bytes_read = fread(buff.data(), sizeof(char), buff.size(), stdin))) {
+		total_bytes += num_bytes_read;
+		sender.send_data(buff.data(), num_bytes_read);
+	}
+
+	cerr << "\nFinished sending, repairing until the receivers are done.\n";
+	sender.finish();
+
+	auto end_time = std::chrono::system_clock::now();
+	std::chrono::duration<double> elapsed_seconds = end_time - start_time;
+
+	cerr << "\nSent " << total_bytes << " bytes in " << sender.get_segment_count()
+			<< " segments with " << sender.get_repair_count() << " repairs in "
+			<< elapsed_seconds.count() << " seconds\n";
+
+	return 0;
+}
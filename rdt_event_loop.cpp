@@ -0,0 +1,193 @@
+/*
+ * File: rdt_event_loop.cpp
+ *
+ * Event loop for asynchronous RDT connections.
+ *
+ */
+
+// C++ library includes
+#include <algorithm>
+#include <iostream>
+
+//OS specific includes
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+
+#include "rdt_event_loop.h"
+#include "rdt_time.h"
+
+using std::cerr;
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the rdt_event_loop header file
+*/
+
+namespace {
+
+/*
+ * Coroutine that owns a spawned task and destroys itself once it finishes.
+ */
+struct DetachedTask {
+	struct promise_type {
+		DetachedTask get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+DetachedTask run_detached(Task<void> task, int *live_tasks) {
+	co_await task;
+	(*live_tasks)--;
+}
+
+}
+
+EventLoop::EventLoop() {
+	this->live_tasks = 0;
+	this->next_waiter_id = 0;
+
+	this->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (this->epoll_fd < 0) {
+		perror("epoll_create1");
+		exit(EXIT_FAILURE);
+	}
+}
+
+EventLoop::~EventLoop() {
+	if (close(this->epoll_fd) < 0) {
+		perror("EventLoop close");
+	}
+}
+
+EventLoop::ReadableAwaiter::ReadableAwaiter(EventLoop &loop, int fd, int64_t timeout_ms)
+		: loop(loop), fd(fd), timeout(timeout_ms), readable(false) {
+}
+
+void EventLoop::ReadableAwaiter::await_suspend(std::coroutine_handle<> handle) {
+	this->loop.add_waiter(this->fd, this->timeout, handle, &this->readable);
+}
+
+EventLoop::ReadableAwaiter EventLoop::wait_readable(int fd, int64_t timeout_ms) {
+	return ReadableAwaiter(*this, fd, timeout_ms);
+}
+
+void EventLoop::spawn(Task<void> task) {
+	this->live_tasks++;
+	run_detached(std::move(task), &this->live_tasks);
+}
+
+void EventLoop::add_waiter(int fd, int64_t timeout_ms, std::coroutine_handle<> handle,
+		bool *readable) {
+	int waiter_id = this->next_waiter_id++;
+	if (this->next_waiter_id < 0) {
+		this->next_waiter_id = 0;
+	}
+
+	// One-shot so a socket only wakes its waiters once per wait; the
+	// registration disappears by itself when the socket is closed
+	struct epoll_event event;
+	event.events = EPOLLIN | EPOLLONESHOT;
+	event.data.fd = fd;
+	if (epoll_ctl(this->epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+		if (errno != ENOENT || epoll_ctl(this->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			perror("epoll_ctl");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (timeout_ms >= 0) {
+		this->timers.schedule(waiter_id, monotonic_msec() + timeout_ms);
+	}
+
+	Waiter waiter;
+	waiter.fd = fd;
+	waiter.handle = handle;
+	waiter.readable = readable;
+	this->waiters[waiter_id] = waiter;
+	this->fd_waiters[fd].push_back(waiter_id);
+}
+
+void EventLoop::resume(int waiter_id, bool readable) {
+	auto it = this->waiters.find(waiter_id);
+	if (it == this->waiters.end()) {
+		return;
+	}
+	Waiter waiter = it->second;
+	this->waiters.erase(it);
+	this->timers.cancel(waiter_id);
+
+	auto fd_it = this->fd_waiters.find(waiter.fd);
+	if (fd_it != this->fd_waiters.end()) {
+		std::vector<int> &ids = fd_it->second;
+		ids.erase(std::remove(ids.begin(), ids.end(), waiter_id), ids.end());
+		if (ids.empty()) {
+			this->fd_waiters.erase(fd_it);
+		}
+	}
+
+	*waiter.readable = readable;
+	waiter.handle.resume();
+}
+
+void EventLoop::resume_fd(int fd) {
+	auto it = this->fd_waiters.find(fd);
+	if (it == this->fd_waiters.end()) {
+		return;
+	}
+
+	// Resumed coroutines may start waiting on the same socket again
+	std::vector<int> ids;
+	ids.swap(it->second);
+	this->fd_waiters.erase(it);
+	for (int waiter_id : ids) {
+		this->resume(waiter_id, true);
+	}
+}
+
+void EventLoop::run() {
+	const int MAX_EVENTS = 64;
+	struct epoll_event events[MAX_EVENTS];
+
+	while (this->live_tasks > 0) {
+		if (this->waiters.empty()) {
+			cerr << "ERROR: EventLoop tasks are suspended but not waiting on anything\n";
+			return;
+		}
+
+		// Wait no longer than the next timeout (rounded up, so it has
+		// expired when epoll_wait returns)
+		int64_t wait = this->timers.time_until_next(monotonic_msec());
+		int event_count = epoll_wait(this->epoll_fd, events, MAX_EVENTS,
+				wait < 0 ? -1 : (int)wait + 1);
+		if (event_count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int i = 0; i < event_count; i++) {
+			this->resume_fd(events[i].data.fd);
+		}
+
+		// Collect the expired timeouts first: a resumed coroutine may wait
+		// again with a timeout of 0, which must not starve the sockets
+		uint64_t now = monotonic_msec();
+		std::vector<int> expired;
+		int waiter_id;
+		while ((waiter_id = this->timers.pop_expired(now)) >= 0) {
+			expired.push_back(waiter_id);
+		}
+		for (int id : expired) {
+			this->resume(id, false);
+		}
+	}
+}
@@ -0,0 +1,100 @@
+/*
+ * File: rdt_event_loop.h
+ *
+ * Header / API file for the event loop that drives asynchronous RDT
+ * connections.
+ *
+ */
+#ifndef RDT_EVENT_LOOP_H
+#define RDT_EVENT_LOOP_H
+
+#include <coroutine>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "rdt_task.h"
+#include "rdt_timer.h"
+
+/**
+ * Single-threaded event loop that runs coroutines waiting for UDP sockets
+ * to become readable (with epoll) or for timeouts to expire (with a
+ * TimerQueue). Lets one thread drive many connections at once.
+ */
+class EventLoop {
+public:
+	EventLoop();
+	~EventLoop();
+
+	/**
+	 * Awaitable returned by wait_readable(). Resumes with true if the socket
+	 * became readable or false if the timeout expired first.
+	 */
+	class ReadableAwaiter {
+	public:
+		ReadableAwaiter(EventLoop &loop, int fd, int64_t timeout_ms);
+
+		bool await_ready() { return false; }
+		void await_suspend(std::coroutine_handle<> handle);
+		bool await_resume() { return this->readable; }
+
+	private:
+		EventLoop &loop;
+		int fd;
+		int64_t timeout;
+		bool readable;
+	};
+
+	/**
+	 * Suspends the calling coroutine until a socket is readable.
+	 *
+	 * @param fd the socket
+	 * @param timeout_ms longest time to wait, or -1 to wait forever
+	 */
+	ReadableAwaiter wait_readable(int fd, int64_t timeout_ms);
+
+	/**
+	 * Starts a task that runs on this loop until it finishes. The task runs
+	 * up to its first suspension before spawn() returns.
+	 */
+	void spawn(Task<void> task);
+
+	/**
+	 * Runs until every spawned task has finished.
+	 */
+	void run();
+
+private:
+	struct Waiter {
+		int fd;
+		std::coroutine_handle<> handle;
+		bool *readable;
+	};
+
+	int epoll_fd;
+	int live_tasks;
+	// Waiter ids double as the ids of their timeouts in timers
+	int next_waiter_id;
+	std::unordered_map<int, Waiter> waiters;
+	// Ids of the waiters on each socket
+	std::unordered_map<int, std::vector<int>> fd_waiters;
+	TimerQueue timers;
+
+	/*
+	 * Registers a suspended coroutine and arms epoll (and its timeout).
+	 */
+	void add_waiter(int fd, int64_t timeout_ms, std::coroutine_handle<> handle,
+			bool *readable);
+
+	/*
+	 * Resumes a waiter, unless it was already resumed for another reason.
+	 */
+	void resume(int waiter_id, bool readable);
+
+	/*
+	 * Resumes everything waiting on a socket that became readable.
+	 */
+	void resume_fd(int fd);
+};
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ * File: rdt_fec.cpp
+ *
+ * Forward error correction for the multicast distribution mode.
+ *
+ */
+
+#include "rdt_fec.h"
+
+void fec_xor(char *parity, const char *data, int length) {
+	for (int i = 0; i < length; i++) {
+		parity[i] ^= data[i];
+	}
+}
+
+uint32_t fec_pack_block(int count, int length_xor) {
+	return ((uint32_t)count << 16) | ((uint32_t)length_xor & 0xffff);
+}
+
+void fec_unpack_block(uint32_t packed, int *count, int *length_xor) {
+	*count = packed >> 16;
+	*length_xor = packed & 0xffff;
+}
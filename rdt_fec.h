@@ -0,0 +1,43 @@
+/*
+ * File: rdt_fec.h
+ *
+ * Header / API file for the forward error correction (FEC) used by the
+ * multicast distribution mode of RDT library.
+ *
+ */
+#ifndef RDT_FEC_H
+#define RDT_FEC_H
+
+#include <cstdint>
+
+/*
+ * A parity segment is the XOR of the data of a block of consecutive data
+ * segments (shorter ones padded with zeros). A receiver that is missing
+ * exactly one segment of the block rebuilds it by XORing the parity with
+ * the segments it has.
+ *
+ * The RDT_MCAST_PARITY header carries the block's first sequence number in
+ * sequence_number, and its segment count and the XOR of the segment
+ * lengths packed into ack_number.
+ */
+
+/*
+ * Adds data to a parity (or removes it, since XOR is its own inverse).
+ *
+ * @param parity buffer at least length bytes long
+ * @param data the segment's data
+ * @param length the size of the data
+ */
+void fec_xor(char *parity, const char *data, int length);
+
+/*
+ * Packs the block size and XOR of the segment lengths into ack_number.
+ */
+uint32_t fec_pack_block(int count, int length_xor);
+
+/*
+ * Unpacks what fec_pack_block() packed.
+ */
+void fec_unpack_block(uint32_t packed, int *count, int *length_xor);
+
+#endif
@@ -0,0 +1,138 @@
+/*
+ * File: rdt_hash.cpp
+ *
+ * Streaming XXH64 hash of a transfer.
+ *
+ */
+
+#include <cstring>
+
+#include "rdt_hash.h"
+
+/*
+* NOTE: Function header comments shouldn't go in this file: they should be put
+* in the rdt_hash header file
+*/
+
+static const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+static const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+static const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(uint64_t x, int bits) {
+	return (x << bits) | (x >> (64 - bits));
+}
+
+// Little-endian loads, whatever the alignment
+static inline uint64_t read64(const unsigned char *p) {
+	uint64_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+	uint32_t value;
+	memcpy(&value, p, sizeof(value));
+	return value;
+}
+
+static inline uint64_t lane_round(uint64_t lane, uint64_t input) {
+	lane += input * PRIME2;
+	return rotl(lane, 31) * PRIME1;
+}
+
+static inline uint64_t merge_round(uint64_t hash, uint64_t lane) {
+	hash ^= lane_round(0, lane);
+	return hash * PRIME1 + PRIME4;
+}
+
+/*
+ * Feeds whole 32-byte stripes to the four lanes.
+ */
+static const unsigned char *consume_stripes(uint64_t lanes[4], const unsigned char *p,
+		const unsigned char *end) {
+	uint64_t v1 = lanes[0], v2 = lanes[1], v3 = lanes[2], v4 = lanes[3];
+	while (end - p >= 32) {
+		v1 = lane_round(v1, read64(p));
+		v2 = lane_round(v2, read64(p + 8));
+		v3 = lane_round(v3, read64(p + 16));
+		v4 = lane_round(v4, read64(p + 24));
+		p += 32;
+	}
+	lanes[0] = v1, lanes[1] = v2, lanes[2] = v3, lanes[3] = v4;
+	return p;
+}
+
+StreamHash::StreamHash(uint64_t seed) {
+	this->seed = seed;
+	this->lanes[0] = seed + PRIME1 + PRIME2;
+	this->lanes[1] = seed + PRIME2;
+	this->lanes[2] = seed;
+	this->lanes[3] = seed - PRIME1;
+	this->buffered = 0;
+	this->total_length = 0;
+}
+
+void StreamHash::update(const void *data, size_t length) {
+	const unsigned char *p = (const unsigned char*)data;
+	const unsigned char *end = p + length;
+	this->total_length += length;
+
+	if (this->buffered + length < 32) {
+		memcpy(this->buffer + this->buffered, p, length);
+		this->buffered += length;
+		return;
+	}
+	if (this->buffered > 0) {
+		// Complete the stripe left over from the last piece
+		size_t fill = 32 - this->buffered;
+		memcpy(this->buffer + this->buffered, p, fill);
+		consume_stripes(this->lanes, this->buffer, this->buffer + 32);
+		p += fill;
+		this->buffered = 0;
+	}
+	p = consume_stripes(this->lanes, p, end);
+	memcpy(this->buffer, p, end - p);
+	this->buffered = end - p;
+}
+
+uint64_t StreamHash::digest() {
+	uint64_t hash;
+	if (this->total_length >= 32) {
+		hash = rotl(this->lanes[0], 1) + rotl(this->lanes[1], 7) +
+			rotl(this->lanes[2], 12) + rotl(this->lanes[3], 18);
+		for (int i = 0; i < 4; i++) {
+			hash = merge_round(hash, this->lanes[i]);
+		}
+	} else {
+		hash = this->seed + PRIME5;
+	}
+	hash += this->total_length;
+
+	// The last bytes that didn't fill a stripe
+	const unsigned char *p = this->buffer;
+	const unsigned char *end = p + this->buffered;
+	while (end - p >= 8) {
+		hash ^= lane_round(0, read64(p));
+		hash = rotl(hash, 27) * PRIME1 + PRIME4;
+		p += 8;
+	}
+	if (end - p >= 4) {
+		hash ^= (uint64_t)read32(p) * PRIME1;
+		hash = rotl(hash, 23) * PRIME2 + PRIME3;
+		p += 4;
+	}
+	while (p < end) {
+		hash ^= *p * PRIME5;
+		hash = rotl(hash, 11) * PRIME1;
+		p++;
+	}
+
+	hash ^= hash >> 33;
+	hash *= PRIME2;
+	hash ^= hash >> 29;
+	hash *= PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
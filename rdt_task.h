@@ -0,0 +1,114 @@
+/*
+ * File: rdt_task.h
+ *
+ * Header / API file for the coroutine type returned by the asynchronous
+ * RDT API.
+ *
+ */
+#ifndef RDT_TASK_H
+#define RDT_TASK_H
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+namespace rdt_task_detail {
+
+/*
+ * Resumes whoever awaited the finished task, if anyone did.
+ */
+struct FinalAwaiter {
+	bool await_ready() noexcept { return false; }
+
+	template <typename Promise>
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+		std::coroutine_handle<> next = handle.promise().continuation;
+		return next ? next : std::noop_coroutine();
+	}
+
+	void await_resume() noexcept {}
+};
+
+struct PromiseBase {
+	std::coroutine_handle<> continuation;
+
+	std::suspend_always initial_suspend() noexcept { return {}; }
+	FinalAwaiter final_suspend() noexcept { return {}; }
+	// The RDT library reports errors with return values, not exceptions
+	void unhandled_exception() { std::terminate(); }
+};
+
+}
+
+/**
+ * Coroutine that produces a T. It doesn't start until it is awaited (or
+ * handed to EventLoop::spawn()), and it resumes its awaiter directly once
+ * it finishes so a long chain of awaits doesn't grow the stack.
+ */
+template <typename T>
+class Task {
+public:
+	struct promise_type : rdt_task_detail::PromiseBase {
+		T value;
+
+		Task get_return_object() {
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		void return_value(T result) { this->value = std::move(result); }
+	};
+
+	Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	Task(const Task&) = delete;
+	Task &operator=(const Task&) = delete;
+	~Task() {
+		if (this->handle) {
+			this->handle.destroy();
+		}
+	}
+
+	bool await_ready() { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+		this->handle.promise().continuation = awaiting;
+		return this->handle;
+	}
+	T await_resume() { return std::move(this->handle.promise().value); }
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+template <>
+class Task<void> {
+public:
+	struct promise_type : rdt_task_detail::PromiseBase {
+		Task get_return_object() {
+			return Task(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+		void return_void() {}
+	};
+
+	Task(Task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+	Task(const Task&) = delete;
+	Task &operator=(const Task&) = delete;
+	~Task() {
+		if (this->handle) {
+			this->handle.destroy();
+		}
+	}
+
+	bool await_ready() { return false; }
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) {
+		this->handle.promise().continuation = awaiting;
+		return this->handle;
+	}
+	void await_resume() {}
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+	std::coroutine_handle<promise_type> handle;
+};
+
+#endif
@@ -4,6 +4,8 @@
  * Reliable data transport (RDT) timing library implementation.
  *
  */
+#include <time.h>
+
 #include "rdt_time.h"
 
 int timeval_to_msec(struct timeval *t) { 
@@ -20,3 +22,15 @@ int current_msec() {
 	gettimeofday(&t,0);
 	return timeval_to_msec(&t);
 }
+
+uint64_t monotonic_msec() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000+t.tv_nsec/1000000;
+}
+
+uint64_t monotonic_usec() {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec*1000000+t.tv_nsec/1000;
+}
@@ -5,6 +5,7 @@
  *
  */
 #include <sys/time.h>
+#include <stdint.h>
 
 
 /*
@@ -35,3 +36,21 @@ void msec_to_timeval(int millis, struct timeval *out_timeval);
  * @return Number of milliseconds (as specified by t)
  */
 int timeval_to_msec(struct timeval *t);
+
+/*
+ * Get the current time of the monotonic clock (in milliseconds).
+ *
+ * @note Unlike current_msec(), this never jumps when the system clock is
+ * adjusted, so it should be used for deadlines and timers.
+ *
+ * @return The number of milliseconds since an arbitrary starting point.
+ */
+uint64_t monotonic_msec();
+
+/*
+ * Get the current time of the monotonic clock (in microseconds), for pacing
+ * that needs finer steps than monotonic_msec().
+ *
+ * @return The number of microseconds since an arbitrary starting point.
+ */
+uint64_t monotonic_usec();
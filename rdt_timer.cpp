@@ -0,0 +1,81 @@
+/*
+ * File: rdt_timer.cpp
+ *
+ * Reliable data transport (RDT) timer engine implementation.
+ *
+ */
+#include "rdt_timer.h"
+
+TimerQueue::TimerQueue() {
+	this->next_generation = 0;
+}
+
+void TimerQueue::schedule(int timer_id, uint64_t deadline) {
+	Entry entry;
+	entry.deadline = deadline;
+	entry.timer_id = timer_id;
+	entry.generation = ++this->next_generation;
+
+	this->armed[timer_id] = entry.generation;
+	this->heap.push(entry);
+	this->compact();
+}
+
+void TimerQueue::cancel(int timer_id) {
+	this->armed.erase(timer_id);
+}
+
+bool TimerQueue::is_scheduled(int timer_id) {
+	return this->armed.count(timer_id) > 0;
+}
+
+bool TimerQueue::is_current(const Entry &entry) {
+	auto it = this->armed.find(entry.timer_id);
+	return it != this->armed.end() && it->second == entry.generation;
+}
+
+void TimerQueue::discard_stale() {
+	while (!this->heap.empty() && !this->is_current(this->heap.top())) {
+		this->heap.pop();
+	}
+}
+
+void TimerQueue::compact() {
+	if (this->heap.size() < MIN_COMPACT_SIZE || this->heap.size() <= 2 * this->armed.size()) {
+		return;
+	}
+	// Rebuilding costs as much as the stale entries it drops took to push,
+	// so rescheduling stays O(log n) amortized
+	std::vector<Entry> current;
+	current.reserve(this->armed.size());
+	while (!this->heap.empty()) {
+		if (this->is_current(this->heap.top())) {
+			current.push_back(this->heap.top());
+		}
+		this->heap.pop();
+	}
+	this->heap = std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>>(
+			std::greater<Entry>(), std::move(current));
+}
+
+int64_t TimerQueue::time_until_next(uint64_t now) {
+	this->discard_stale();
+	if (this->heap.empty()) {
+		return -1;
+	}
+
+	uint64_t deadline = this->heap.top().deadline;
+	return deadline > now ? (int64_t)(deadline - now) : 0;
+}
+
+int TimerQueue::pop_expired(uint64_t now) {
+	this->discard_stale();
+	if (this->heap.empty() || this->heap.top().deadline > now) {
+		return -1;
+	}
+
+	int timer_id = this->heap.top().timer_id;
+	this->heap.pop();
+	this->armed.erase(timer_id);
+	return timer_id;
+}
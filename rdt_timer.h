@@ -0,0 +1,106 @@
+/*
+ * File: rdt_timer.h
+ *
+ * Header / API file for the timer engine of RDT library.
+ *
+ */
+#ifndef RDT_TIMER_H
+#define RDT_TIMER_H
+
+#include <cstdint>
+#include <functional>
+#include <queue>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Set of one-shot timers, each identified by an integer id and expiring at a
+ * deadline given in monotonic milliseconds (see monotonic_msec()).
+ *
+ * Deadlines are kept in a min-heap. Rescheduling or cancelling a timer
+ * doesn't search the heap: the old entry is just skipped when it reaches
+ * the top. A timer rescheduled on every segment (e.g. a keepalive) would
+ * leave its old entries piling up behind a later deadline, so the heap is
+ * rebuilt from the armed timers once stale entries outnumber them. Ids are
+ * forgotten once their timer expires or is cancelled, so
+ * callers may use a fresh id for every timer.
+ */
+class TimerQueue {
+public:
+	static const size_t MIN_COMPACT_SIZE = 64; // heap entries worth compacting
+
+	TimerQueue();
+
+	/**
+	 * Arms a timer, replacing its previous deadline if it was already armed.
+	 *
+	 * @param timer_id Id of the timer.
+	 * @param deadline Time (in monotonic milliseconds) it should expire at.
+	 */
+	void schedule(int timer_id, uint64_t deadline);
+
+	/**
+	 * Disarms a timer. Does nothing if it isn't armed.
+	 *
+	 * @param timer_id Id of the timer.
+	 */
+	void cancel(int timer_id);
+
+	/**
+	 * Checks whether a timer is armed.
+	 *
+	 * @param timer_id Id of the timer.
+	 */
+	bool is_scheduled(int timer_id);
+
+	/**
+	 * Returns how long until the earliest armed timer expires.
+	 *
+	 * @param now Current time (in monotonic milliseconds).
+	 * @return Milliseconds until the next deadline (0 if it has already
+	 * 		passed), or -1 if no timer is armed.
+	 */
+	int64_t time_until_next(uint64_t now);
+
+	/**
+	 * Removes and returns one timer whose deadline has passed.
+	 *
+	 * @param now Current time (in monotonic milliseconds).
+	 * @return Id of an expired timer, or -1 if none have expired.
+	 */
+	int pop_expired(uint64_t now);
+
+private:
+	struct Entry {
+		uint64_t deadline;
+		int timer_id;
+		uint64_t generation;
+
+		bool operator>(const Entry &other) const {
+			return deadline > other.deadline;
+		}
+	};
+
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+	// Generation of the heap entry that is current for each armed timer
+	std::unordered_map<int, uint64_t> armed;
+	uint64_t next_generation;
+
+	/*
+	 * Checks whether a heap entry is the current one for its timer.
+	 */
+	bool is_current(const Entry &entry);
+
+	/*
+	 * Pops heap entries left behind by cancelled or rescheduled timers.
+	 */
+	void discard_stale();
+
+	/*
+	 * Rebuilds the heap from its current entries if stale ones outnumber
+	 * them.
+	 */
+	void compact();
+};
+
+#endif
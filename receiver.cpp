@@ -3,17 +3,19 @@
  *
  * Simple program that receives data from a remote host using the
  * RDT library, writing the received data to standard output.
- * 
- * You should NOT modify this file.
  */
 
 // C++ standard libraries
 #include <string>
 #include <chrono>
 #include <iostream>
-#include <array>
+#include <cstdio>
+#include <optional>
+#include <thread>
 
 // RDT library
+#include "BufferRing.h"
+#include "ProgressReporter.h"
 #include "ReliableSocket.h"
 
 using std::cerr;
@@ -25,25 +27,63 @@ int main(int argc, char **argv) {
 	}
 
 	ReliableSocket socket;
+	// Setting RDT_KEY (to a pre-shared key, or empty) encrypts the
+	// connection; the other side must set the same one
+	const char *key = getenv("RDT_KEY");
+	if (key != NULL) {
+		socket.enable_encryption(key);
+	}
 	socket.accept_connection(std::stoi(argv[1]));
 
-	auto start_time = std::chrono::system_clock::now();
-	std::array<char, ReliableSocket::MAX_DATA_SIZE> segment;
-	int bytes_received = socket.receive_data(segment.data());		
+	auto start_time = std::chrono::steady_clock::now();
+
+	// RDT_PROGRESS=<seconds> reports progress at that interval, as JSON
+	// lines if RDT_PROGRESS_FORMAT=json
+	std::optional<ProgressReporter> progress;
+	const char *interval = getenv("RDT_PROGRESS");
+	if (interval != NULL && atof(interval) > 0) {
+		const char *format = getenv("RDT_PROGRESS_FORMAT");
+		progress.emplace(socket, (int)(atof(interval) * 1000),
+				format != NULL && std::string(format) == "json",
+				[](const RDTStats &stats) { return stats.bytes_received; });
+	}
+
+	// Another thread writes received data to stdout, so a slow disk or
+	// pipe doesn't hold up receiving (and acknowledging) the next segments
+	const int RING_BUFFERS = 8;
+	const size_t RING_BUFFER_SIZE = 256 * 1024;
+	BufferRing ring(RING_BUFFERS, RING_BUFFER_SIZE);
+	std::thread writer([&ring] {
+		int index;
+		size_t length = 0;
+		while ((index = ring.consume(&length)) >= 0 && length > 0) {
+			fwrite(ring.data(index), sizeof(char), length, stdout);
+			fflush(stdout);
+			ring.release(index);
+		}
+	});
 
-	// Keep receiving data until we do a receive that gives us 0 bytes.
-	int total_bytes = 0;
-	while (bytes_received != 0) {
+	// Keep receiving data until we do a receive that gives us 0 bytes (or
+	// -1 if the sender stopped responding). Each receive takes a whole run
+	// of segments if that many have arrived.
+	long total_bytes = 0;
+	int index;
+	while ((index = ring.acquire()) >= 0) {
+		ssize_t bytes_received = socket.receive_data(ring.data(index), ring.size());
+		if (bytes_received <= 0) {
+			ring.publish(index, 0);
+			break;
+		}
 		cerr << "receiver: received " << bytes_received << " bytes of app data\n";
 		total_bytes += bytes_received;
-
-		// write received data to stdout
-		fwrite(segment.data(), sizeof(char), bytes_received, stdout);
-		fflush(stdout);
-		bytes_received = socket.receive_data(segment.data());		
+		ring.publish(index, bytes_received);
 	}
+	writer.join();
 
-	auto end_time = std::chrono::system_clock::now();
+	auto end_time = std::chrono::steady_clock::now();
+	if (progress) {
+		progress->stop();
+	}
 	std::chrono::duration<double> elapsed_seconds = end_time - start_time;
 
 	cerr << "\nReceived " << total_bytes << " bytes in " 
@@ -54,4 +94,21 @@ int main(int argc, char **argv) {
 	socket.close_connection();
 
 	fflush(stdout);
+
+	// The sender's hash of what it sent arrived with its close, so this
+	// checks the file without reading it again
+	RDTStats stats = socket.get_stats();
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)stats.recv_hash);
+	cerr << "Transfer hash:  " << hash << " (XXH64) ";
+	if (stats.transfer_check == RDT_CHECK_PASSED) {
+		cerr << "matches the sender's\n";
+	} else if (stats.transfer_check == RDT_CHECK_FAILED) {
+		snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)stats.remote_hash);
+		cerr << "does NOT match the sender's " << hash << "\n";
+		return 1;
+	} else {
+		cerr << "was not checked: the sender sent no hash\n";
+	}
+	return 0;
 }
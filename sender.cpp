@@ -3,56 +3,137 @@
  *
  * Simple program that sends data on standard input to a remote host using the
  * RDT library.
- * 
- * You should NOT modify this file.
  */
 
 // C++ standard libraries
 #include <string>
 #include <chrono>
 #include <iostream>
-#include <array>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <thread>
+
+#include <poll.h>
+#include <unistd.h>
 
 // RDT library
+#include "BufferRing.h"
+#include "ProgressReporter.h"
 #include "ReliableSocket.h"
 
 using std::cerr;
 
 int main(int argc, char** argv) {	
-	if (argc != 3) {
-		cerr << "Usage: " << argv[0] << " <remote host> <remote port>\n";
+	if (argc != 3 && argc != 4) {
+		cerr << "Usage: " << argv[0] << " <remote host> <remote port> "
+				<< "[adaptive | stop-and-wait | ledbat]\n";
 		exit(1);
 	}
 
 	int remote_port_num = std::stoi(argv[2]);
 
+	// Input that isn't a regular file is read into these ahead of the
+	// network. Declared first, since the socket may still hold buffers
+	// until it is destroyed.
+	const int RING_BUFFERS = 8;
+	const size_t RING_BUFFER_SIZE = 256 * 1024;
+	BufferRing ring(RING_BUFFERS, RING_BUFFER_SIZE);
+
 	// Create a reliable connection and connect to the specified remote host
 	ReliableSocket socket;
+	if (argc == 4) {
+		std::unique_ptr<CongestionController> controller = make_congestion_controller(argv[3]);
+		if (!controller) {
+			cerr << "Unknown congestion control: " << argv[3] << "\n";
+			exit(1);
+		}
+		socket.set_congestion_control(std::move(controller));
+	}
+	// Setting RDT_KEY (to a pre-shared key, or empty) encrypts the
+	// connection; the other side must set the same one
+	const char *key = getenv("RDT_KEY");
+	if (key != NULL) {
+		socket.enable_encryption(key);
+	}
 	socket.connect_to_remote(argv[1], remote_port_num);
 
-	// Create a char array and fill it with 0's
-	std::array<char, ReliableSocket::MAX_DATA_SIZE> buff;
-	buff.fill(0);
-
-	auto start_time = std::chrono::system_clock::now();
-
-	// Use stdin as the source for the data we will be sending
-	int total_bytes = 0;
-	int num_bytes_read = 0;
-	while ((num_bytes_read = fread(buff.data(), 
-									sizeof(char), 
-									ReliableSocket::MAX_DATA_SIZE, 
-									stdin))) {
-		total_bytes += num_bytes_read;
-		socket.send_data(buff.data(), num_bytes_read);
-		cerr << "sender: sent " << num_bytes_read << " bytes of app data\n";
+	auto start_time = std::chrono::steady_clock::now();
+
+	// RDT_PROGRESS=<seconds> reports progress at that interval, as JSON
+	// lines if RDT_PROGRESS_FORMAT=json
+	std::optional<ProgressReporter> progress;
+	const char *interval = getenv("RDT_PROGRESS");
+	if (interval != NULL && atof(interval) > 0) {
+		const char *format = getenv("RDT_PROGRESS_FORMAT");
+		progress.emplace(socket, (int)(atof(interval) * 1000),
+				format != NULL && std::string(format) == "json",
+				[](const RDTStats &stats) { return stats.bytes_acked; });
 	}
 
-	auto end_time = std::chrono::system_clock::now();
+	// A regular file on stdin is sent straight from a mapping of it
+	long total_bytes = 0;
+	ssize_t file_bytes = socket.send_file(fileno(stdin));
+	if (file_bytes >= 0) {
+		total_bytes = file_bytes;
+		cerr << "sender: sent " << file_bytes << " bytes of app data from the mapped file\n";
+	} else {
+		// Anything else (e.g. a pipe) is read by another thread into the
+		// ring while this one sends, so waiting for input overlaps with
+		// waiting for ACKs
+		std::thread reader([&ring] {
+			int index;
+			while ((index = ring.acquire()) >= 0) {
+				// Waits for input in slices, so a closed ring stops it even
+				// if no more input ever comes
+				struct pollfd input = {STDIN_FILENO, POLLIN, 0};
+				while (poll(&input, 1, 100) == 0 && !ring.is_closed()) {
+				}
+				if (ring.is_closed()) {
+					break;
+				}
+				ssize_t length = read(STDIN_FILENO, ring.data(index), ring.size());
+				if (length < 0) {
+					perror("read");
+					length = 0;
+				}
+				ring.publish(index, length);
+				if (length == 0) {
+					break;
+				}
+			}
+		});
+
+		int index;
+		size_t length = 0;
+		while ((index = ring.consume(&length)) >= 0 && length > 0) {
+			// Sent without copying: the buffer goes back to the reader once
+			// every segment of it has been acknowledged
+			std::shared_ptr<const void> owner(ring.data(index),
+					[&ring, index](const void*) { ring.release(index); });
+			size_t sent = socket.send_buffer(owner, ring.data(index), length);
+			total_bytes += sent;
+			cerr << "sender: sent " << sent << " bytes of app data\n";
+			if (sent < length) {
+				break;
+			}
+		}
+		if (index >= 0 && length > 0) {
+			// Connection failed, so stop the reader, which may be waiting
+			// for input that will never be sent
+			ring.close();
+		}
+		reader.join();
+	}
+
+	auto end_time = std::chrono::steady_clock::now();
 	std::chrono::duration<double> elapsed_seconds = end_time - start_time;
 
 	cerr << "\nFinished sending, closing socket.\n";
 	socket.close_connection();
+	if (progress) {
+		progress->stop();
+	}
 
 	cerr << "\nSent " << total_bytes << " bytes in " 
 			<< elapsed_seconds.count() << " seconds "
@@ -60,5 +141,20 @@ int main(int argc, char** argv) {
 
 	cerr << "Estimated RTT:  " << socket.get_estimated_rtt() << " ms\n";
 
+	RDTStats stats = socket.get_stats();
+	cerr << "RTT samples:    " << stats.rtt_samples << " (" << stats.kernel_rtt_samples
+			<< " from kernel timestamps)\n";
+	cerr << "Protocol mode:  " << protocol_mode_name(stats.protocol_mode) << " (window "
+			<< stats.congestion_window << ")\n";
+	cerr << "Retransmissions: " << stats.retransmissions << " (" << stats.fast_retransmits
+			<< " after duplicate ACKs)\n";
+	if (stats.kernel_rtt_samples > 0) {
+		cerr << "User-space RTT excess: "
+				<< stats.user_rtt_excess_us / stats.kernel_rtt_samples << " us per sample\n";
+	}
+	char hash[17];
+	snprintf(hash, sizeof(hash), "%016llx", (unsigned long long)stats.send_hash);
+	cerr << "Transfer hash:  " << hash << " (XXH64)\n";
+
 	return 0;
 }
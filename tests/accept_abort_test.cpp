@@ -0,0 +1,50 @@
+/*
+ * File: accept_abort_test.cpp
+ *
+ * Checks that a ReliableSocket waiting in accept_connection() doesn't hold
+ * its lock, so other threads can read its stats and abort the accept.
+ *
+ */
+
+// C++ library includes
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include <cstdlib>
+
+#include <unistd.h>
+
+// RDT library
+#include "ReliableSocket.h"
+#include "test_util.h"
+
+int main() {
+	int port = 20000 + getpid() % 20000;
+	ReliableSocket server;
+	std::atomic<bool> returned(false);
+	std::thread server_thread([&server, &returned, port] {
+		server.accept_connection(port);
+		returned = true;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	auto start = std::chrono::steady_clock::now();
+	server.get_stats();
+	auto elapsed = std::chrono::steady_clock::now() - start;
+	check(elapsed < std::chrono::milliseconds(100), "get_stats() doesn't wait for a client");
+
+	server.abort_connection();
+	for (int i = 0; i < 100 && !returned; i++) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	check(returned, "abort_connection() ends the accept");
+	if (!returned) {
+		// Still blocked, so the thread can't be joined
+		_exit(EXIT_FAILURE);
+	}
+	server_thread.join();
+	check(server.get_state() == CLOSED, "aborted accept leaves the socket closed");
+
+	return test_result("accept_abort_test");
+}
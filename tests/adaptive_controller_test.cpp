@@ -0,0 +1,69 @@
+/*
+ * File: adaptive_controller_test.cpp
+ *
+ * Checks how AdaptiveController's window reacts to losses once it has
+ * settled on windowed mode, and how it starts from cached measurements.
+ *
+ */
+
+// C++ library includes
+#include <chrono>
+#include <thread>
+
+#include <cstdlib>
+
+// RDT library
+#include "CongestionController.h"
+#include "test_util.h"
+
+/*
+ * Acknowledges a whole round, 2 ms after the last one, with a 20 ms RTT.
+ */
+static void ack_round(AdaptiveController &controller) {
+	std::this_thread::sleep_for(std::chrono::milliseconds(2));
+	uint32_t all = AdaptiveController::MAX_WINDOW;
+	controller.on_ack(all, all, 20000);
+}
+
+int main() {
+	AdaptiveController controller;
+	controller.on_ack(1, 1, 20000); // starts the first round
+	for (int i = 0; i < 20 && controller.mode() == MODE_MEASURING; i++) {
+		ack_round(controller);
+	}
+	check(controller.mode() == MODE_WINDOWED, "fat pipe ends startup in windowed mode");
+	uint32_t start = controller.window();
+
+	controller.on_loss();
+	uint32_t after_first = controller.window();
+	check(after_first < start, "first loss cuts the window");
+	ack_round(controller); // ends the round with the loss
+
+	controller.on_loss();
+	uint32_t after_second = controller.window();
+	check(after_second < after_first, "loss in a later round cuts the window again");
+	ack_round(controller);
+	check(controller.window() == after_second, "cap doesn't grow after a round with a loss");
+
+	ack_round(controller);
+	check(controller.window() == after_second + 1, "cap grows after a clean round");
+	ack_round(controller);
+	check(controller.window() == after_second + 2, "cap keeps growing while rounds are clean");
+
+	// 1000 segments per second over 20 ms is a BDP of 20 segments
+	AdaptiveController fat;
+	fat.seed(1000, 20);
+	check(fat.window() == 20 && fat.mode() == MODE_MEASURING, "fat pipe seed starts from its BDP");
+	AdaptiveController slow;
+	slow.seed(10, 20);
+	check(slow.window() == 1 && slow.mode() == MODE_STOP_AND_WAIT,
+			"seed under one segment of BDP starts in stop-and-wait");
+	AdaptiveController huge;
+	huge.seed(1e6, 100);
+	check(huge.window() == AdaptiveController::MAX_WINDOW, "seeded window is capped");
+	fat.on_ack(1, 1, 20000);
+	fat.seed(10, 20);
+	check(fat.window() == 20, "seed is ignored once the controller is measuring");
+
+	return test_result("adaptive_controller_test");
+}
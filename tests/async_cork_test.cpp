@@ -0,0 +1,67 @@
+/*
+ * File: async_cork_test.cpp
+ *
+ * Checks that an AsyncReliableSocket holds small writes back while corked
+ * and sends them, as one segment, before the connection closes.
+ *
+ */
+
+// C++ library includes
+#include <string>
+#include <thread>
+
+#include <cstdlib>
+
+#include <unistd.h>
+
+// RDT library
+#include "AsyncReliableSocket.h"
+#include "rdt_event_loop.h"
+#include "test_util.h"
+
+/*
+ * Corks, writes in pieces and closes without flushing.
+ */
+static Task<void> send_corked(EventLoop &loop, int port, bool *connected) {
+	AsyncReliableSocket sock(loop);
+	char host[] = "127.0.0.1";
+	*connected = co_await sock.connect_to_remote(host, port);
+	if (!*connected) {
+		co_return;
+	}
+	sock.socket().cork();
+	co_await sock.send_data("corked ", 7);
+	co_await sock.send_data("data", 4);
+	co_await sock.close_connection();
+}
+
+int main() {
+	int port = 20000 + getpid() % 20000;
+
+	std::string received;
+	int segments = 0;
+	std::thread receiver([&received, &segments, port] {
+		ReliableSocket sock;
+		sock.accept_connection(port);
+		char buffer[ReliableSocket::MAX_DATA_SIZE];
+		int size;
+		while ((size = sock.receive_data(buffer)) > 0) {
+			received.append(buffer, size);
+			segments++;
+		}
+		sock.close_connection();
+	});
+	usleep(100000);
+
+	EventLoop loop;
+	bool connected = false;
+	loop.spawn(send_corked(loop, port, &connected));
+	loop.run();
+	receiver.join();
+
+	check(connected, "connects");
+	check(received == "corked data", "corked data arrives before the close");
+	check(segments == 1, "corked writes go out as one segment");
+
+	return test_result("async_cork_test");
+}
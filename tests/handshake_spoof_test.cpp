@@ -0,0 +1,162 @@
+/*
+ * File: handshake_spoof_test.cpp
+ *
+ * Checks that an encrypted connection ignores a forged plaintext handshake
+ * segment once it is established.
+ *
+ */
+
+// C++ library includes
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// RDT library
+#include "ReliableSocket.h"
+#include "test_util.h"
+
+static int udp_socket(int port) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (fd < 0 || bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("proxy socket");
+		exit(EXIT_FAILURE);
+	}
+	return fd;
+}
+
+/*
+ * Relays segments between the two ends, so the test owns the address the
+ * receiving end is connected to and can send it anything from there.
+ */
+class Relay {
+public:
+	Relay(int listen_port, int server_port) {
+		this->client_fd = udp_socket(listen_port);
+		this->server_fd = udp_socket(0);
+		struct sockaddr_in server;
+		memset(&server, 0, sizeof(server));
+		server.sin_family = AF_INET;
+		server.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		server.sin_port = htons(server_port);
+		connect(this->server_fd, (struct sockaddr*)&server, sizeof(server));
+		this->have_client = false;
+		this->stopping = false;
+		this->thread = std::thread([this] { this->run(); });
+	}
+
+	~Relay() {
+		this->stopping = true;
+		this->thread.join();
+		close(this->client_fd);
+		close(this->server_fd);
+	}
+
+	/*
+	 * Sends a segment to the server end as if the client had sent it.
+	 */
+	void inject(const void *segment, size_t length) {
+		send(this->server_fd, segment, length, 0);
+	}
+
+private:
+	int client_fd;
+	int server_fd;
+	struct sockaddr_in client;
+	std::atomic<bool> have_client;
+	std::atomic<bool> stopping;
+	std::thread thread;
+
+	void run() {
+		char segment[ReliableSocket::MAX_WIRE_SIZE];
+		while (!this->stopping) {
+			struct pollfd fds[2] = {{this->client_fd, POLLIN, 0}, {this->server_fd, POLLIN, 0}};
+			if (poll(fds, 2, 50) <= 0) {
+				continue;
+			}
+			if (fds[0].revents & POLLIN) {
+				socklen_t length = sizeof(this->client);
+				ssize_t size = recvfrom(this->client_fd, segment, sizeof(segment), 0,
+						(struct sockaddr*)&this->client, &length);
+				this->have_client = true;
+				if (size > 0) {
+					send(this->server_fd, segment, size, 0);
+				}
+			}
+			if (fds[1].revents & POLLIN) {
+				ssize_t size = recv(this->server_fd, segment, sizeof(segment), 0);
+				if (size > 0 && this->have_client) {
+					sendto(this->client_fd, segment, size, 0, (struct sockaddr*)&this->client,
+							sizeof(this->client));
+				}
+			}
+		}
+	}
+};
+
+int main() {
+	int server_port = 20000 + getpid() % 20000;
+	int relay_port = server_port + 1;
+	Relay relay(relay_port, server_port);
+
+	ReliableSocket server;
+	server.enable_encryption("spoof test");
+	std::string received;
+	std::thread server_thread([&server, &received, server_port] {
+		server.accept_connection(server_port);
+		char buffer[4096];
+		ssize_t size;
+		while ((size = server.receive_data(buffer, sizeof(buffer))) > 0) {
+			received.append(buffer, size);
+		}
+		server.close_connection();
+	});
+
+	ReliableSocket client;
+	client.enable_encryption("spoof test");
+	char host[] = "127.0.0.1";
+	client.connect_to_remote(host, relay_port);
+	client.send_data("first", 5);
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	RDTStats before = server.get_stats();
+	check(server.get_state() == ESTABLISHED, "server is established");
+
+	// Plaintext SYN that claims to acknowledge data and closes the window
+	RDTHeader forged;
+	memset(&forged, 0, sizeof(forged));
+	forged.sequence_number = htonl(1000);
+	forged.ack_number = htonl(1000);
+	forged.type = RDT_SYN;
+	forged.flags = RDT_FLAG_ACK;
+	forged.window = htons(0);
+	relay.inject(&forged, sizeof(forged));
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+	RDTStats after = server.get_stats();
+	check(after.segments_rejected == before.segments_rejected + 1, "forged SYN is rejected");
+	check(after.peer_window == before.peer_window, "forged SYN leaves the peer window alone");
+	check(after.bytes_acked == before.bytes_acked, "forged SYN acknowledges nothing");
+	check(server.get_state() == ESTABLISHED, "forged SYN leaves the state alone");
+
+	client.send_data("second", 6);
+	client.close_connection();
+	server_thread.join();
+	check(received == "firstsecond", "data still arrives intact");
+
+	return test_result("handshake_spoof_test");
+}
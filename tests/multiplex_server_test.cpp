@@ -0,0 +1,102 @@
+/*
+ * File: multiplex_server_test.cpp
+ *
+ * Checks that a MultiplexServer receives several ReliableSocket clients'
+ * streams intact over its one UDP socket, and forgets each connection once
+ * it is closed.
+ *
+ */
+
+// C++ library includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdlib>
+
+#include <unistd.h>
+
+// RDT library
+#include "MultiplexServer.h"
+#include "ReliableSocket.h"
+#include "test_util.h"
+
+/*
+ * Returns the data client number index sends: different for every client.
+ */
+static std::string client_data(int index) {
+	std::string data(100000 + 1000 * index, '\0');
+	for (size_t i = 0; i < data.size(); i++) {
+		data[i] = (char)((i * 7 + index * 31) % 251);
+	}
+	return data;
+}
+
+int main() {
+	const int CLIENTS = 8;
+	int port = 20000 + getpid() % 20000;
+
+	std::map<uint64_t, std::string> received;
+	int complete = 0;
+	int dropped = 0;
+	MultiplexServer server(port,
+			[&received](uint64_t conn_id, const char *data, int length) {
+				received[conn_id].append(data, length);
+			},
+			[&complete, &dropped](uint64_t, bool finished) {
+				if (finished) {
+					complete++;
+				} else {
+					dropped++;
+				}
+			});
+	std::atomic<bool> stopping(false);
+	std::thread server_thread([&server, &stopping] {
+		while (!stopping) {
+			server.handle_events(20);
+		}
+	});
+
+	std::vector<std::thread> clients;
+	for (int i = 0; i < CLIENTS; i++) {
+		clients.emplace_back([i, port] {
+			ReliableSocket client;
+			char host[] = "127.0.0.1";
+			client.connect_to_remote(host, port);
+			std::string data = client_data(i);
+			for (size_t sent = 0; sent < data.size(); sent += ReliableSocket::MAX_DATA_SIZE) {
+				client.send_data(data.data() + sent,
+						std::min((size_t)ReliableSocket::MAX_DATA_SIZE, data.size() - sent));
+			}
+			client.close_connection();
+		});
+	}
+	for (std::thread &client : clients) {
+		client.join();
+	}
+
+	// The clients are done once their TIME_WAIT is over, long after the
+	// server saw their ACKs
+	stopping = true;
+	server_thread.join();
+
+	check(complete == CLIENTS, "every stream ends with its client's RDT_CLOSE");
+	check(dropped == 0, "no connection is dropped");
+	check(server.connection_count() == 0, "closed connections are forgotten");
+	std::vector<std::string> expected, got;
+	for (int i = 0; i < CLIENTS; i++) {
+		expected.push_back(client_data(i));
+	}
+	for (auto &stream : received) {
+		got.push_back(stream.second);
+	}
+	std::sort(expected.begin(), expected.end());
+	std::sort(got.begin(), got.end());
+	check(got == expected, "every client's data arrives intact on its own connection");
+
+	return test_result("multiplex_server_test");
+}
@@ -0,0 +1,83 @@
+/*
+ * File: segment_pool_test.cpp
+ *
+ * Checks that a SegmentPool asked for huge pages maps its buffers in whole
+ * huge pages, and that the kernel backs them with huge pages when it can.
+ *
+ */
+
+// C++ library includes
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+// RDT library
+#include "SegmentPool.h"
+#include "test_util.h"
+
+using std::cerr;
+
+/*
+ * Returns the kB of huge pages backing the mapping that contains address,
+ * from /proc/self/smaps (hugetlbfs or transparent ones).
+ */
+static long huge_kb(const char *address) {
+	std::ifstream smaps("/proc/self/smaps");
+	std::string line;
+	bool inside = false;
+	long kb = 0;
+	while (std::getline(smaps, line)) {
+		uintptr_t start, end;
+		if (sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2 && line.find(':') > line.find(' ')) {
+			inside = (uintptr_t)address >= start && (uintptr_t)address < end;
+			continue;
+		}
+		if (!inside) {
+			continue;
+		}
+		std::istringstream fields(line);
+		std::string name;
+		long value;
+		fields >> name >> value;
+		if (name == "AnonHugePages:" && value > kb) {
+			kb = value;
+		} else if (name == "KernelPageSize:" && value == (long)(SegmentPool::HUGE_PAGE_SIZE >> 10)) {
+			kb = SegmentPool::HUGE_PAGE_SIZE >> 10;
+		}
+	}
+	return kb;
+}
+
+int main() {
+	const int SEGMENT_SIZE = 1424;
+	const size_t STRIDE = (SEGMENT_SIZE + 63) & ~(size_t)63;
+
+	SegmentPool pool(SEGMENT_SIZE);
+	pool.set_placement(SegmentPool::ANY_NODE, true);
+	char *first = pool.acquire();
+	check((uintptr_t)first % SegmentPool::HUGE_PAGE_SIZE == 0,
+			"first buffer starts a huge page");
+
+	// The whole huge page is one arena, carved in order
+	size_t per_page = SegmentPool::HUGE_PAGE_SIZE / STRIDE;
+	bool contiguous = true;
+	for (size_t i = 1; i < per_page; i++) {
+		contiguous = contiguous && pool.acquire() == first + i * STRIDE;
+	}
+	check(contiguous, "one arena fills the huge page");
+
+	memset(first, 1, SegmentPool::HUGE_PAGE_SIZE);
+	long kb = huge_kb(first);
+	if (kb == 0) {
+		cerr << "segment_pool_test: the kernel gave no huge pages, only the layout was checked\n";
+	} else {
+		check(kb >= (long)(SegmentPool::HUGE_PAGE_SIZE >> 10), "arena is backed by a huge page");
+	}
+
+	return test_result("segment_pool_test");
+}
@@ -0,0 +1,43 @@
+/*
+ * File: test_util.h
+ *
+ * Checks and reporting shared by the tests.
+ *
+ */
+#ifndef TEST_UTIL_H
+#define TEST_UTIL_H
+
+#include <cstdlib>
+#include <iostream>
+
+/**
+ * Number of checks that have failed so far.
+ */
+inline int test_failures = 0;
+
+/**
+ * Reports a check that failed, and counts it. The test carries on, so one
+ * run shows every failure.
+ *
+ * @param what What was expected.
+ */
+inline void check(bool ok, const char *what) {
+	if (!ok) {
+		std::cerr << "FAIL: " << what << "\n";
+		test_failures++;
+	}
+}
+
+/**
+ * Returns what main() should return: EXIT_SUCCESS, after printing
+ * "<name>: OK", if no check failed, and EXIT_FAILURE otherwise.
+ */
+inline int test_result(const char *name) {
+	if (test_failures > 0) {
+		return EXIT_FAILURE;
+	}
+	std::cerr << name << ": OK\n";
+	return EXIT_SUCCESS;
+}
+
+#endif